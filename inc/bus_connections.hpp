@@ -1,9 +1,11 @@
 #ifndef NOS3_BUS_CONNECTIONS_HPP
 #define NOS3_BUS_CONNECTIONS_HPP
 
+#include <atomic>
 #include <memory>
 #include <iostream>
 #include <stdexcept>
+#include <utility>
 
 #include <ItcLogger/Logger.hpp>
 #include <Client/Bus.hpp>
@@ -16,82 +18,324 @@
 #include <Can/Client/CanMaster.hpp>
 #include <Spi/Client/SpiMaster.hpp>
 #include <Uart/Client/Uart.hpp>
+#include <Transport/TransportHub.hpp>
 
+#include <bus_result.hpp>
+#include <tracer.hpp>
+#include <traffic_monitor.hpp>
 #include <simulator_terminal.hpp>
 
 namespace Nos3 {
 
     //TODO: Add transactions (Which will be send_request_message on the base node)
 
+    // Each connection offers two sets of operations:
+    //   - the virtual write/read/transact, used by the interactive commands, which throw std::runtime_error on a bad
+    //     target or unsupported operation, print "Wrote N bytes..." style messages when verbose and return the BusResult
+    //   - the non-virtual try_write/try_read/try_transact on the concrete (final) classes, which return a BusResult and
+    //     never print.  Loops that issue many operations use these through visit_bus_connection so that each call is
+    //     resolved at compile time.  try_transact takes the reply timeout per call; only the base bus, which has a
+    //     request/reply protocol, honours it, and the other masters block until the bus answers.
+    // The target is parsed once by set_target; an invalid target is remembered and reported on the next operation.
     class BusConnection {
     public:
+        enum Kind {BASE_KIND, I2C_KIND, CAN_KIND, SPI_KIND, UART_KIND};
+
+        // The hub is held for the connection's lifetime; members of the derived classes, which use it, go first
+        BusConnection(Kind kind, std::shared_ptr<NosEngine::Transport::TransportHub> hub) :
+            _kind(kind), _target_valid(false), _address(0), _verbose(true), _receiver(nullptr), _traffic(nullptr), _hub(hub) {}
         virtual ~BusConnection(void){};
-        virtual void write(const char* buf, size_t len) = 0;
-        virtual void read(char* buf, size_t len) = 0;
-        virtual void transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen) = 0;
+        virtual BusResult write(const char* buf, size_t len) = 0;
+        virtual BusResult read(char* buf, size_t len) = 0;
+        virtual BusResult transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen) = 0;
+        // Largest write that maps onto a single operation on this bus type
+        virtual size_t max_chunk_size(void) const = 0;
+        // True if write() returns before the target has received the data
+        virtual bool asynchronous_writes(void) const {return false;}
+        virtual bool is_valid_target(const std::string& target) const = 0;
+        virtual std::string invalid_target_message(const std::string& target) const = 0;
         void set_target(std::string target);
+        const std::string& target(void) const {return _target;}
+        // The source that replies from the target are reported under by the receive callback
+        virtual const std::string& reply_source(void) const {return _target;}
+        bool target_valid(void) const {return _target_valid;}
+        Kind kind(void) const {return _kind;}
+        const char* kind_name(void) const {static const char* names[] = {"BASE", "I2C", "CAN", "SPI", "UART"}; return names[_kind];}
+        void set_verbose(bool verbose) {_verbose = verbose;}
+        // Data received by base and UART connections goes to this terminal.  Connections start with none, so that
+        // one that is not a terminal's active connection drops what it receives, and one finished on a connect
+        // thread after its terminal is gone never calls into it.
+        void set_receiver(class SimTerminal* receiver) {_receiver = receiver;}
+        // Successful try_* operations are counted in this monitor, whichever command or worker issues them; like the
+        // receiver, it is set only while its owner is using the connection
+        void set_traffic(TrafficMonitor* traffic) {_traffic = traffic;}
+
+        static const unsigned DEFAULT_TIMEOUT_MS = 5000;
     protected:
+        // Targets follow parse_bus_number: decimal, or hex with a 0x prefix
+        static bool parse_number(const std::string& target, long min, long max, int& value) {return parse_bus_number(target, min, max, value);}
+        void throw_if_invalid_target(void) const;
+        virtual int parse_target(const std::string& target) const {(void)target; return 0;}
+        void count(const std::string& source, size_t bytes, bool outbound){
+            TrafficMonitor* traffic = _traffic;
+            if (traffic) traffic->record(kind_name(), source, bytes, outbound);
+        }
+        // For operations addressed per call rather than by the target
+        void count(uint32_t address, size_t bytes, bool outbound);
+
+        const Kind _kind;
         std::string _target;
+        bool _target_valid;
+        int _address;
+        bool _verbose;
+        std::atomic<class SimTerminal*> _receiver;
+        std::atomic<TrafficMonitor*> _traffic;
+        std::shared_ptr<NosEngine::Transport::TransportHub> _hub;
     };
 
-    class I2CConnection : public BusConnection {
+    inline BusResult to_bus_result(NosEngine::I2C::Result result){
+        switch (result) {
+        case NosEngine::I2C::Result::I2C_SUCCESS: return BUS_SUCCESS;
+        case NosEngine::I2C::Result::I2C_BUSY: return BUS_BUSY;
+        default: return BUS_ERROR;
+        }
+    }
+
+    inline BusResult to_bus_result(NosEngine::Can::Result result){
+        switch (result) {
+        case NosEngine::Can::Result::CAN_SUCCESS: return BUS_SUCCESS;
+        case NosEngine::Can::Result::CAN_BUSY: return BUS_BUSY;
+        default: return BUS_ERROR;
+        }
+    }
+
+    class I2CConnection final : public BusConnection {
     public:
-        I2CConnection(int master_address, std::string connection_string, std::string bus_name);
+        I2CConnection(int master_address, std::string connection_string, std::string bus_name, std::shared_ptr<NosEngine::Transport::TransportHub> hub);
         ~I2CConnection();
-        void write(const char* buf, size_t len);
-        void read(char* buf, size_t len);
-        void transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen);
+        BusResult write(const char* buf, size_t len);
+        BusResult read(char* buf, size_t len);
+        BusResult transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen);
+        size_t max_chunk_size(void) const {return 255;}
+        bool is_valid_target(const std::string& target) const {int a; return parse_number(target, 0, 127, a);}
+        std::string invalid_target_message(const std::string& target) const;
+        // Addresses given to STRESS follow the same rules as targets
+        static bool parse_address(const std::string& text, int& address) {return parse_number(text, 0, 127, address);}
+
+        BusResult try_write(const char* buf, size_t len){
+            if (!_target_valid) return BUS_INVALID_TARGET;
+            NOS3_TRACE_SPAN("I2C write");
+            BusResult result = to_bus_result(_i2c->i2c_write(_address, reinterpret_cast<const uint8_t*>(buf), len));
+            if (result == BUS_SUCCESS) count(_target, len, true);
+            return result;
+        }
+        BusResult try_read(char* buf, size_t len){
+            if (!_target_valid) return BUS_INVALID_TARGET;
+            NOS3_TRACE_SPAN("I2C read");
+            BusResult result = to_bus_result(_i2c->i2c_read(_address, reinterpret_cast<uint8_t*>(buf), len));
+            if (result == BUS_SUCCESS) count(_target, len, false);
+            return result;
+        }
+        BusResult try_transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen, unsigned = DEFAULT_TIMEOUT_MS){
+            if (!_target_valid) return BUS_INVALID_TARGET;
+            NOS3_TRACE_SPAN("I2C transaction");
+            BusResult result = to_bus_result(_i2c->i2c_transaction(_address, reinterpret_cast<const uint8_t*>(wbuf), wlen, reinterpret_cast<uint8_t*>(rbuf), rlen));
+            if (result == BUS_SUCCESS) {
+                count(_target, wlen, true);
+                count(_target, rlen, false);
+            }
+            return result;
+        }
+        // Register access for RegisterMap, addressed per call rather than by the selected target
+        BusResult try_write_device(int address, const uint8_t* buf, size_t len){
+            NOS3_TRACE_SPAN("I2C register write");
+            BusResult result = to_bus_result(_i2c->i2c_write(address, buf, len));
+            if (result == BUS_SUCCESS) count(address, len, true);
+            return result;
+        }
+        BusResult try_transact_device(int address, const uint8_t* wbuf, size_t wlen, uint8_t* rbuf, size_t rlen){
+            NOS3_TRACE_SPAN("I2C register read");
+            BusResult result = to_bus_result(_i2c->i2c_transaction(address, wbuf, wlen, rbuf, rlen));
+            if (result == BUS_SUCCESS) {
+                count(address, wlen, true);
+                count(address, rlen, false);
+            }
+            return result;
+        }
     private:
+        int parse_target(const std::string& target) const {int a = -1; parse_number(target, 0, 127, a); return a;}
         std::unique_ptr<NosEngine::I2C::I2CMaster> _i2c;
     };
 
-    class CANConnection : public BusConnection {
+    class CANConnection final : public BusConnection {
     public:
-        CANConnection(int master_identifier, std::string connection_string, std::string bus_name);
+        CANConnection(int master_identifier, std::string connection_string, std::string bus_name, std::shared_ptr<NosEngine::Transport::TransportHub> hub);
         ~CANConnection();
-        void write(const char* buf, size_t len);
-        void read(char* buf, size_t len);
-        void transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen);
+        BusResult write(const char* buf, size_t len);
+        BusResult read(char* buf, size_t len);
+        BusResult transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen);
+        size_t max_chunk_size(void) const {return 8;}
+        bool is_valid_target(const std::string& target) const {int a; return parse_number(target, 0, 0x1FFFFFFF, a);}
+        std::string invalid_target_message(const std::string& target) const;
+        // Identifiers given to the CAN commands follow the same rules as targets
+        static bool parse_identifier(const std::string& text, uint32_t& id) {int a; if (!parse_number(text, 0, 0x1FFFFFFF, a)) return false; id = a; return true;}
+
+        BusResult try_write(const char* buf, size_t len){
+            if (!_target_valid) return BUS_INVALID_TARGET;
+            NOS3_TRACE_SPAN("CAN write");
+            BusResult result = to_bus_result(_can->can_write(_address, reinterpret_cast<const uint8_t*>(buf), len));
+            if (result == BUS_SUCCESS) count(_target, len, true);
+            return result;
+        }
+        BusResult try_read(char* buf, size_t len){
+            if (!_target_valid) return BUS_INVALID_TARGET;
+            NOS3_TRACE_SPAN("CAN read");
+            BusResult result = to_bus_result(_can->can_read(_address, reinterpret_cast<uint8_t*>(buf), len));
+            if (result == BUS_SUCCESS) count(_target, len, false);
+            return result;
+        }
+        BusResult try_transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen, unsigned = DEFAULT_TIMEOUT_MS){
+            if (!_target_valid) return BUS_INVALID_TARGET;
+            NOS3_TRACE_SPAN("CAN transaction");
+            BusResult result = to_bus_result(_can->can_transaction(_address, reinterpret_cast<const uint8_t*>(wbuf), wlen, reinterpret_cast<uint8_t*>(rbuf), rlen));
+            if (result == BUS_SUCCESS) {
+                count(_target, wlen, true);
+                count(_target, rlen, false);
+            }
+            return result;
+        }
+        // Frame access for CanEngine, addressed per frame rather than by the selected target
+        BusResult try_write_frame(uint32_t id, const uint8_t* data, size_t len){
+            NOS3_TRACE_SPAN("CAN frame write");
+            BusResult result = to_bus_result(_can->can_write(id, data, len));
+            if (result == BUS_SUCCESS) count(id, len, true);
+            return result;
+        }
+        BusResult try_read_frame(uint32_t id, uint8_t* data, size_t len){
+            NOS3_TRACE_SPAN("CAN frame read");
+            BusResult result = to_bus_result(_can->can_read(id, data, len));
+            if (result == BUS_SUCCESS) count(id, len, false);
+            return result;
+        }
     private:
+        int parse_target(const std::string& target) const {int a = -1; parse_number(target, 0, 0x1FFFFFFF, a); return a;}
         std::unique_ptr<NosEngine::Can::CanMaster> _can;
     };
 
-    class SPIConnection : public BusConnection {
+    class SPIConnection final : public BusConnection {
     public:
-        SPIConnection(std::string connection_string, std::string bus_name);
+        SPIConnection(std::string connection_string, std::string bus_name, std::shared_ptr<NosEngine::Transport::TransportHub> hub);
         ~SPIConnection();
-        void write(const char* buf, size_t len);
-        void read(char* buf, size_t len);
-        void transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen);
+        BusResult write(const char* buf, size_t len);
+        BusResult read(char* buf, size_t len);
+        BusResult transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen);
+        size_t max_chunk_size(void) const {return 256;}
+        bool is_valid_target(const std::string& target) const {int a; return parse_number(target, 0, 0x7FFFFFFF, a);}
+        std::string invalid_target_message(const std::string& target) const;
+
+        BusResult try_write(const char* buf, size_t len){
+            if (!_target_valid) return BUS_INVALID_TARGET;
+            NOS3_TRACE_SPAN("SPI write");
+            _spi->select_chip(_address);
+            _spi->spi_write(reinterpret_cast<const uint8_t*>(buf), len);
+            _spi->unselect_chip();
+            count(_target, len, true);
+            return BUS_SUCCESS;
+        }
+        BusResult try_read(char* buf, size_t len){
+            if (!_target_valid) return BUS_INVALID_TARGET;
+            NOS3_TRACE_SPAN("SPI read");
+            _spi->select_chip(_address);
+            _spi->spi_read(reinterpret_cast<uint8_t*>(buf), len);
+            _spi->unselect_chip();
+            count(_target, len, false);
+            return BUS_SUCCESS;
+        }
+        BusResult try_transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen, unsigned = DEFAULT_TIMEOUT_MS){
+            if (!_target_valid) return BUS_INVALID_TARGET;
+            NOS3_TRACE_SPAN("SPI transaction");
+            _spi->select_chip(_address);
+            _spi->spi_transaction(reinterpret_cast<const uint8_t*>(wbuf), wlen, reinterpret_cast<uint8_t*>(rbuf), rlen);
+            _spi->unselect_chip();
+            count(_target, wlen, true);
+            count(_target, rlen, false);
+            return BUS_SUCCESS;
+        }
     private:
+        int parse_target(const std::string& target) const {int a = -1; parse_number(target, 0, 0x7FFFFFFF, a); return a;}
         std::unique_ptr<NosEngine::Spi::SpiMaster> _spi;
     };
 
-    class UartConnection : public BusConnection {
+    class UartConnection final : public BusConnection {
     public:
-        UartConnection(class SimTerminal* terminal, std::string node_name, std::string connection_string, std::string bus_name);
+        UartConnection(std::string node_name, std::string connection_string, std::string bus_name,
+            std::shared_ptr<NosEngine::Transport::TransportHub> hub);
         ~UartConnection();
-        void write(const char* buf, size_t len);
-        void read(char* buf, size_t len);
-        void transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen);
+        BusResult write(const char* buf, size_t len);
+        BusResult read(char* buf, size_t len);
+        BusResult transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen);
+        size_t max_chunk_size(void) const {return 256;}
+        bool is_valid_target(const std::string& target) const {int a; return parse_number(target, 0, 0x7FFFFFFF, a);}
+        std::string invalid_target_message(const std::string& target) const;
+
+        BusResult try_write(const char* buf, size_t len){
+            if (!_target_valid) return BUS_INVALID_TARGET;
+            NOS3_TRACE_SPAN("UART write");
+            _uart->open(_address);
+            _uart->write(reinterpret_cast<const uint8_t*>(buf), len);
+            _uart->close();
+            count(_target, len, true);
+            return BUS_SUCCESS;
+        }
+        BusResult try_read(char*, size_t){return BUS_UNSUPPORTED;}
+        BusResult try_transact(const char*, size_t, char*, size_t, unsigned = DEFAULT_TIMEOUT_MS){return BUS_UNSUPPORTED;}
+        const std::string& reply_source(void) const {return _bus_name;}
     private:
+        int parse_target(const std::string& target) const {int a = -1; parse_number(target, 0, 0x7FFFFFFF, a); return a;}
         std::unique_ptr<NosEngine::Uart::Uart> _uart;
-        class SimTerminal* _terminal;
+        const std::string _bus_name;
     };
 
-    class BaseConnection : public BusConnection {
+    class BaseConnection final : public BusConnection {
     public:
-        BaseConnection(class SimTerminal* terminal, std::string node_name, std::string connection_string, std::string bus_name);
+        BaseConnection(std::string node_name, std::string connection_string, std::string bus_name,
+            std::shared_ptr<NosEngine::Transport::TransportHub> hub);
         ~BaseConnection();
-        void write(const char* buf, size_t len);
-        void read(char* buf, size_t len);
-        void transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen);
+        BusResult write(const char* buf, size_t len);
+        BusResult read(char* buf, size_t len);
+        BusResult transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen);
+        size_t max_chunk_size(void) const {return 4096;}
+        bool asynchronous_writes(void) const {return true;}
+        bool is_valid_target(const std::string& target) const {return target.size() > 0;}
+        std::string invalid_target_message(const std::string& target) const;
+
+        BusResult try_write(const char* buf, size_t len){
+            if (!_target_valid) return BUS_INVALID_TARGET;
+            NOS3_TRACE_SPAN("BASE write");
+            _node->send_non_confirmed_message_async(_target, len, buf);
+            count(_target, len, true);
+            return BUS_SUCCESS;
+        }
+        BusResult try_read(char*, size_t){return BUS_UNSUPPORTED;}
+        BusResult try_transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen, unsigned timeout_ms = DEFAULT_TIMEOUT_MS);
     private:
         std::unique_ptr<NosEngine::Client::Bus> _bus;
         NosEngine::Client::DataNode* _node;
-        class SimTerminal* _terminal;
     };
 
+    // Calls visitor with bus cast to its concrete type, so that try_* calls made by the visitor bind statically
+    template <typename Visitor>
+    auto visit_bus_connection(BusConnection& bus, Visitor&& visitor) -> decltype(visitor(std::declval<BaseConnection&>()))
+    {
+        switch (bus.kind()) {
+        case BusConnection::I2C_KIND: return visitor(static_cast<I2CConnection&>(bus));
+        case BusConnection::CAN_KIND: return visitor(static_cast<CANConnection&>(bus));
+        case BusConnection::SPI_KIND: return visitor(static_cast<SPIConnection&>(bus));
+        case BusConnection::UART_KIND: return visitor(static_cast<UartConnection&>(bus));
+        default: return visitor(static_cast<BaseConnection&>(bus));
+        }
+    }
+
 }
 
 #endif
@@ -0,0 +1,16 @@
+#ifndef NOS3_BUS_RESULT_HPP
+#define NOS3_BUS_RESULT_HPP
+
+#include <string>
+
+namespace Nos3 {
+
+    enum BusResult {BUS_SUCCESS, BUS_ERROR, BUS_BUSY, BUS_TIMEOUT, BUS_INVALID_TARGET, BUS_UNSUPPORTED};
+    const char* bus_result_as_string(BusResult result);
+
+    // Parses a bus number (address, identifier, register, option) in [min, max]: decimal, or hex only with a 0x prefix
+    bool parse_bus_number(const std::string& text, long min, long max, int& value);
+
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef NOS3_CAN_ENGINE_HPP
+#define NOS3_CAN_ENGINE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <bus_result.hpp>
+
+namespace Nos3 {
+
+    class CANConnection;
+
+    struct CanFrame {
+        uint32_t id;
+        uint8_t len;
+        uint8_t data[8];
+    };
+
+    // Frame-level CAN on top of a CANConnection: batched transmission, acceptance filtering of the identifiers read,
+    // ISO-TP (ISO 15765-2) segmentation and reassembly, and per-identifier statistics.
+    //
+    // The NOS Engine CAN master has no receive callback; a frame is "received" by reading from the identifier that
+    // sends it, and it does not report the frame's DLC, so a read returns as many bytes as were asked for.  As every
+    // read names its identifier, the acceptance filters decide which identifiers may be read rather than being applied
+    // to the frames.  ISO-TP flow control frames are read from the responder's identifier in the same way, polling
+    // until the flow control timeout; polls that find no frame of the kind awaited are not counted as traffic.
+    class CanEngine {
+    public:
+        struct Filter {
+            uint32_t id;
+            uint32_t mask;     // an identifier is accepted if (identifier & mask) == (id & mask)
+        };
+
+        struct IsoTpOptions {
+            uint8_t block_size;   // frames between flow control frames we send when receiving; 0 for no limit
+            uint8_t st_min;       // separation time we ask for when receiving, in ISO-TP encoding
+            unsigned timeout_ms;  // how long to wait for a flow control or consecutive frame
+            uint8_t padding;      // value for unused bytes of the last frame
+        };
+
+        struct IdStats {
+            uint64_t tx_frames;
+            uint64_t rx_frames;
+            uint64_t errors;
+            uint64_t tx_bytes;
+            uint64_t rx_bytes;
+            uint64_t gaps;        // inter-frame gaps measured on this identifier, in either direction
+            double gap_total_us;
+            double gap_min_us;
+            double gap_max_us;
+            std::chrono::steady_clock::time_point last_frame;
+        };
+
+        CanEngine();
+
+        void add_filter(const Filter& filter) {_filters.push_back(filter);}
+        void clear_filters(void) {_filters.clear();}
+        const std::vector<Filter>& filters(void) const {return _filters;}
+        bool accepts(uint32_t id) const;
+
+        // Sends frames in order and stops at the first failure; sent is the number that went out
+        BusResult send(CANConnection& bus, const CanFrame* frames, size_t count, size_t& sent);
+        // Reads one frame of len (up to 8) bytes from id
+        BusResult receive(CANConnection& bus, uint32_t id, uint8_t len, CanFrame& frame);
+
+        // Sends data (up to 4095 bytes) from tx_id, reading flow control from rx_id
+        BusResult isotp_send(CANConnection& bus, uint32_t tx_id, uint32_t rx_id, const char* data, size_t len, std::string& error);
+        // Reads a message sent from rx_id, sending flow control from tx_id
+        BusResult isotp_receive(CANConnection& bus, uint32_t tx_id, uint32_t rx_id, std::vector<char>& data, std::string& error);
+        void set_isotp_options(const IsoTpOptions& options) {_isotp = options;}
+        const IsoTpOptions& isotp_options(void) const {return _isotp;}
+
+        void set_bitrate(unsigned bitrate) {_bitrate = bitrate;}
+        unsigned bitrate(void) const {return _bitrate;}
+        void reset_stats(void);
+        std::string stats_as_string(void) const;
+
+        // "<id>#<hex data>", as in can-utils
+        static bool parse_frame(const std::string& text, CanFrame& frame);
+        static std::string frame_as_string(const CanFrame& frame);
+        // Nominal length on the wire, without stuff bits
+        static unsigned frame_bits(const CanFrame& frame) {return ((frame.id > 0x7FF) ? 67 : 47) + 8 * frame.len;}
+
+    private:
+        BusResult write_frame(CANConnection& bus, const CanFrame& frame);
+        BusResult read_frame(CANConnection& bus, uint32_t id, uint8_t len, CanFrame& frame);
+        BusResult wait_for_flow_control(CANConnection& bus, uint32_t rx_id, uint8_t& block_size, uint8_t& st_min, std::string& error);
+        void record(uint32_t id, const CanFrame* frame, bool tx, bool failed);
+        static void separate(uint8_t st_min);
+
+        std::vector<Filter> _filters;
+        IsoTpOptions _isotp;
+        unsigned _bitrate;
+        std::map<uint32_t, IdStats> _stats;
+        uint64_t _bits;
+        std::chrono::steady_clock::time_point _first_frame;
+        std::chrono::steady_clock::time_point _last_frame;
+    };
+
+}
+
+#endif
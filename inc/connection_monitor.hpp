@@ -0,0 +1,71 @@
+#ifndef NOS3_CONNECTION_MONITOR_HPP
+#define NOS3_CONNECTION_MONITOR_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace Nos3 {
+
+    // Times a TCP connect to the host and port of a NOS Engine connection string ("tcp://host:port").  Returns false
+    // with error set if the endpoint cannot be reached within timeout_ms.  Other transports cannot be probed this way;
+    // they are reported reachable with an RTT of -1.
+    bool probe_endpoint(const std::string& connection_string, int timeout_ms, double& rtt_ms, std::string& error);
+
+    // Background heartbeat for the known NOS Engine endpoints.  Watched connection strings that are due are probed in
+    // parallel and their reachability and round trip times recorded.  An endpoint is probed every heartbeat period
+    // until its state settles; while it stays the same the period doubles, up to max_heartbeat_ms, and a change sets
+    // it back, so that a steady server is not sent a TCP connect every second.  The tick callbacks run on the
+    // monitor thread about every 100 ms so the owners can drive connect timeouts and reconnects from the same thread.
+    // Several terminals may share one monitor, each with its own tick; an endpoint they share is probed once.
+    class ConnectionMonitor {
+    public:
+        struct EndpointStatus {
+            bool probed;
+            bool reachable;
+            double rtt_ms;
+            std::string error;
+            std::chrono::steady_clock::time_point last_probe;
+        };
+
+        ConnectionMonitor(int heartbeat_ms, int probe_timeout_ms, int max_heartbeat_ms);
+        ~ConnectionMonitor();
+
+        void start(void); // does nothing if already started
+        void stop(void);
+        unsigned add_tick(std::function<void(void)> tick);
+        // Returns once the tick is not running and never will again, waiting only if it is the one running now; must
+        // not be called from the monitor thread, that is from any tick
+        void remove_tick(unsigned id);
+        void watch(const std::string& connection_string);
+        EndpointStatus status(const std::string& connection_string);
+
+    private:
+        struct Schedule {
+            std::chrono::steady_clock::time_point next_probe;
+            std::chrono::milliseconds period;
+        };
+
+        void run(void);
+
+        const std::chrono::milliseconds _heartbeat;
+        const std::chrono::milliseconds _max_heartbeat;
+        const int _probe_timeout_ms;
+        std::map<unsigned, std::function<void(void)>> _ticks;
+        unsigned _next_tick;
+        unsigned _running_tick;     // id of the tick being called, 0 if none
+        std::map<std::string, EndpointStatus> _endpoints;
+        std::map<std::string, Schedule> _schedules;
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        bool _stopping;
+        std::thread _thread;
+    };
+
+}
+
+#endif
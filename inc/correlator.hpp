@@ -0,0 +1,82 @@
+#ifndef NOS3_CORRELATOR_HPP
+#define NOS3_CORRELATOR_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace Nos3 {
+
+    // Matches replies arriving through the receive callbacks to the asynchronous writes (base bus, UART) that caused
+    // them, and keeps round trip latency histograms per node.  A reply matches a pending request from the same node:
+    //   ORDER  - the oldest pending request
+    //   OFFSET - the pending request with the same big endian sequence number, read at one offset in requests and
+    //            another in replies
+    //   CCSDS  - the pending request with the same 14 bit sequence count in the space packet primary header; the
+    //            responder has to echo the request's count
+    // Requests that see no reply within the timeout are counted as timed out and dropped.
+    class Correlator {
+    public:
+        enum MatchBy {ORDER, OFFSET, CCSDS};
+
+        struct Matcher {
+            MatchBy by;
+            size_t request_offset;
+            size_t response_offset;
+            size_t width;             // 1 to 4 bytes
+        };
+
+        static const size_t BUCKETS = 32; // bucket k holds latencies in [2^k, 2^(k+1)) us; bucket 0 also holds < 1 us
+
+        Correlator();
+
+        void enable(const Matcher& matcher, std::chrono::milliseconds timeout);
+        void disable(void) {_enabled = false;}
+        bool enabled(void) const {return _enabled.load(std::memory_order_relaxed);}
+        void reset(void);
+
+        // node is the source name replies from the target arrive under.  Requests are registered before they are
+        // written, since a fast reply can arrive before the write returns; a write that then fails is withdrawn.
+        void sent(const std::string& node, const char* data, size_t len, std::chrono::steady_clock::time_point when);
+        void withdraw(const std::string& node, std::chrono::steady_clock::time_point when);
+        void received(const std::string& node, const char* data, size_t len);
+
+        std::string report(void);
+
+    private:
+        struct Pending {
+            uint32_t key;
+            std::chrono::steady_clock::time_point sent;
+        };
+        struct Node {
+            std::deque<Pending> pending;
+            uint64_t sent;
+            uint64_t matched;
+            uint64_t timed_out;
+            uint64_t unmatched;        // replies that matched no pending request
+            uint64_t buckets[BUCKETS];
+            double min_us;
+            double max_us;
+            double total_us;
+        };
+
+        bool key(const char* data, size_t len, size_t offset, uint32_t& key) const;
+        void expire(Node& node, std::chrono::steady_clock::time_point now);
+        static size_t bucket(double us);
+
+        static const size_t _MAX_PENDING = 4096; // per node; the oldest are dropped as timed out beyond this
+
+        std::atomic<bool> _enabled;
+        Matcher _matcher;
+        std::chrono::milliseconds _timeout;
+        std::mutex _mutex;
+        std::map<std::string, Node> _nodes;
+    };
+
+}
+
+#endif
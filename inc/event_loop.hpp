@@ -0,0 +1,85 @@
+#ifndef NOS3_EVENT_LOOP_HPP
+#define NOS3_EVENT_LOOP_HPP
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace Nos3 {
+
+    // The STDIO front end.  Readline runs in callback mode inside a poll loop that also wakes for output posted from
+    // other threads and for timers, so bus traffic received while the user is typing is drawn above the prompt and the
+    // partly typed line is redrawn underneath it.  Only one loop may run at a time, because readline's callbacks carry
+    // no context.
+    //
+    // Output posted faster than the terminal drains it is coalesced into one write per wakeup; beyond max_pending bytes
+    // further output is dropped and the number of dropped bytes reported.
+    //
+    // Other descriptors (the UDP sockets of a multi-terminal host) can be watched in the same loop, and the loop can run
+    // without a console when no terminal uses stdin.
+    class EventLoop {
+    public:
+        typedef std::function<bool(const std::string&)> LineHandler; // return false to stop the loop
+        typedef std::function<std::string(void)> PromptSource;
+        typedef std::function<void(void)> TimerCallback;
+        typedef std::function<void(void)> ReadableCallback;
+
+        EventLoop(size_t max_pending = 1 << 20);
+        ~EventLoop();
+
+        // Reads lines until the handler returns false, stdin ends or stop() is called
+        void run(PromptSource prompt, LineHandler handler);
+        // Serves timers and watched descriptors only, until stop() is called
+        void run(void);
+        // Callable from any thread
+        void stop(void);
+        // Writes text above the prompt if the loop is running, otherwise straight to stdout; callable from any thread
+        void print(const std::string& text);
+        // Timer callbacks run on the loop thread, first after one period and then every period until cancelled
+        unsigned add_timer(std::chrono::milliseconds period, TimerCallback callback);
+        void cancel_timer(unsigned id);
+        // The callback runs on the loop thread whenever fd is readable; both are callable from any thread
+        void watch_fd(int fd, ReadableCallback callback);
+        void unwatch_fd(int fd);
+        bool running(void) const {return _running;}
+
+        // Async-signal-safe: clears the line being typed, as a shell does on Ctrl-C.  Returns false if no loop is running.
+        static bool interrupt(void);
+
+    private:
+        struct Timer {
+            std::chrono::milliseconds period;
+            std::chrono::steady_clock::time_point next;
+            TimerCallback callback;
+        };
+
+        static void line_callback(char* line);
+        void poll_until_stopped(bool console);
+        void finish(void);
+        void wake(void);
+        int run_timers(void);
+        void drain_output(void);
+        void draw_above_prompt(const std::string& text);
+
+        const size_t _max_pending;
+        int _wake_fd;
+        std::atomic<bool> _running;
+        bool _console;
+        bool _in_handler;
+        PromptSource _prompt;
+        LineHandler _handler;
+
+        std::mutex _mutex; // guards the pending output, the timers and the watched descriptors
+        std::string _pending;
+        size_t _dropped;
+        std::map<unsigned, Timer> _timers;
+        unsigned _next_timer;
+        std::map<int, ReadableCallback> _watched;
+    };
+
+}
+
+#endif
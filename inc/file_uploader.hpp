@@ -0,0 +1,62 @@
+#ifndef NOS3_FILE_UPLOADER_HPP
+#define NOS3_FILE_UPLOADER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+
+#include <bus_connections.hpp>
+
+namespace Nos3 {
+
+    // Sends a memory-mapped file to the current target in chunks no larger than the bus allows.
+    //
+    // On buses whose writes complete synchronously (I2C, CAN, SPI, UART) each chunk is already confirmed when write()
+    // returns, so the window has no effect.  On the base bus writes are fire-and-forget; there every <window>th chunk
+    // is sent as a request instead and the upload waits up to ack_timeout_ms for the reply, bounding how many chunks
+    // are unacknowledged.  A target that lets an acknowledgement time out is taken not to send them, and the rest of
+    // the file goes without waiting.  A window of 0 never waits.
+    //
+    // The cancellation check is made between chunks and again before the verify; a cancelled upload reports what was
+    // sent and skips the verify.  A verify read that fails or times out is reported as such, not as a CRC mismatch.
+    class FileUploader {
+    public:
+        struct Options {
+            size_t chunk_size;          // 0 selects the bus maximum
+            size_t window;
+            unsigned ack_timeout_ms;
+            std::string verify_request; // if not empty, sent as a transaction after the upload; the reply is the target's CRC-32
+            unsigned verify_timeout_ms;
+        };
+
+        struct Result {
+            size_t bytes;
+            size_t chunks;
+            double seconds;
+            uint32_t crc;
+            bool unacknowledged;        // an acknowledgement timed out, so the window was given up
+            bool cancelled;
+            bool verified;
+            BusResult verify_result;    // how the verify read completed; readback_crc is only set on BUS_SUCCESS
+            bool verify_passed;
+            uint32_t readback_crc;
+        };
+
+        FileUploader(BusConnection& bus, std::ostream& progress) : _bus(bus), _progress(progress) {}
+        Result upload(const std::string& path, const Options& options, std::function<bool(void)> cancelled);
+
+        static uint32_t crc32(uint32_t crc, const uint8_t* buf, size_t len);
+        static std::string result_as_string(const Result& result);
+
+    private:
+        template <typename Connection> BusResult send_chunk(Connection& bus, const char* chunk, size_t len, unsigned wait_ms, size_t offset);
+        template <typename Connection> BusResult read_verify(Connection& bus, const std::string& request, uint8_t* readback, size_t len, unsigned timeout_ms);
+
+        BusConnection& _bus;
+        std::ostream& _progress;
+    };
+
+}
+
+#endif
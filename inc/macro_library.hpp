@@ -0,0 +1,46 @@
+#ifndef NOS3_MACRO_LIBRARY_HPP
+#define NOS3_MACRO_LIBRARY_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Nos3 {
+
+    // Named command sequences for MACRO DEFINE and RUN.  A macro is kept as the lines it was defined with; $<param>
+    // (or ${<param>}) in a line is replaced by the value the RUN gives for that parameter.  Turning the substituted
+    // lines into bus operations is the terminal's job, since it depends on the terminal's modes and payloads.
+    class MacroLibrary {
+    public:
+        struct Macro {
+            std::vector<std::string> params;
+            std::vector<std::string> lines;
+        };
+
+        // Recording: lines given to record() between begin() and end() become the macro's body
+        void begin(const std::string& name, const std::vector<std::string>& params);
+        bool recording(void) const {return _recording;}
+        const std::string& recording_name(void) const {return _name;}
+        void record(const std::string& line);
+        const Macro& end(void);
+
+        const Macro* find(const std::string& name) const;
+        bool remove(const std::string& name);
+        const std::map<std::string, Macro>& macros(void) const {return _macros;}
+
+        // The macro's lines with every parameter replaced; throws if a parameter has no value or a value names no
+        // parameter
+        std::vector<std::string> expand(const std::string& name, const std::map<std::string, std::string>& values) const;
+
+    private:
+        static bool valid_name(const std::string& name);
+
+        std::map<std::string, Macro> _macros;
+        bool _recording = false;
+        std::string _name;
+        Macro _pending;
+    };
+
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef NOS3_PAYLOAD_LIBRARY_HPP
+#define NOS3_PAYLOAD_LIBRARY_HPP
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Nos3 {
+
+    // Named payloads, stored already decoded.  The bytes live in an arena of fixed blocks that never move, so a
+    // Payload can be handed straight to BusConnection::write without copying.  Redefining a name points it at new
+    // arena space; the old bytes are only reclaimed by clear().
+    class PayloadLibrary {
+    public:
+        struct Payload {
+            const char* data;
+            size_t len;
+        };
+
+        const Payload& define(const std::string& name, const char* data, size_t len);
+        const Payload& load(const std::string& name, const std::string& path, bool hex);
+        const Payload* find(const std::string& name) const;
+        void clear(void);
+        const std::map<std::string, Payload>& payloads(void) const {return _payloads;}
+
+        static std::string decode_hex(const std::string& in);
+        // Commands take "@<name>" in place of their data to use a payload; data that starts with '@' is written with
+        // it doubled, and unescape turns a leading "@@" back into "@"
+        static bool is_reference(const std::string& token) {return (token.size() > 1) && (token[0] == '@') && (token[1] != '@');}
+        static std::string unescape(const std::string& data);
+
+    private:
+        static const size_t _BLOCK_SIZE = 64 * 1024;
+
+        char* allocate(size_t len);
+
+        std::vector<std::unique_ptr<char[]>> _blocks;
+        size_t _block_used = _BLOCK_SIZE;
+        std::map<std::string, Payload> _payloads;
+    };
+
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef NOS3_REGISTER_MAP_HPP
+#define NOS3_REGISTER_MAP_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <bus_result.hpp>
+
+namespace Nos3 {
+
+    class I2CConnection;
+
+    // Register-mapped I2C devices with 8 bit registers and an auto-incrementing register pointer.  A range is read with
+    // one transaction (write the start register, read count bytes) instead of one per register.
+    //
+    // A register map file names registers and marks those that never change:
+    //   # <device address> <register> <name> [STATIC]
+    //   0x40 0x0F WHO_AM_I STATIC
+    // With the cache on, STATIC registers are kept in a shadow after the first read, and a range whose ends are
+    // cached is narrowed to the uncached middle.  Writing a register drops it from the shadow.
+    class RegisterMap {
+    public:
+        struct Register {
+            std::string name;
+            bool is_static;
+        };
+
+        RegisterMap() : _cache_enabled(false) {}
+
+        void load(const std::string& path);
+        const Register* find(int device, int reg) const;
+        size_t size(void) const {return _registers.size();}
+
+        void set_cache_enabled(bool enabled) {_cache_enabled = enabled; if (!enabled) _shadow.clear();}
+        bool cache_enabled(void) const {return _cache_enabled;}
+        void clear_cache(void) {_shadow.clear();}
+        size_t cached(void) const {return _shadow.size();}
+
+        // transactions is the number of bus transactions used; 0 if everything came from the shadow
+        BusResult read(I2CConnection& bus, int device, int start, size_t count, uint8_t* values, bool use_cache, unsigned& transactions);
+        BusResult write(I2CConnection& bus, int device, int start, const uint8_t* values, size_t count);
+
+        // Throws unless start..start+count-1 are valid register numbers
+        static void check_range(unsigned long device, unsigned long start, size_t count);
+
+    private:
+        static int key(int device, int reg) {return (device << 8) | reg;}
+
+        std::map<int, Register> _registers;
+        std::map<int, uint8_t> _shadow;
+        bool _cache_enabled;
+    };
+
+    // Polls register ranges on a background thread and reports the registers whose values changed
+    class RegisterWatcher {
+    public:
+        struct Change {
+            int reg;
+            uint8_t old_value;
+            uint8_t new_value;
+        };
+        struct Watch {
+            int device;
+            int start;
+            size_t count;
+            std::chrono::milliseconds period;
+        };
+        typedef std::function<BusResult(int device, int start, size_t count, uint8_t* values)> Reader;
+        // Called on the watcher thread with the changes, or with a failed result (once, until reads succeed again)
+        typedef std::function<void(unsigned id, const Watch& watch, const std::vector<Change>& changes, BusResult result)> Reporter;
+
+        RegisterWatcher(Reader reader, Reporter reporter);
+        ~RegisterWatcher();
+
+        // initial holds the current values, so only later changes are reported
+        unsigned add(const Watch& watch, const std::vector<uint8_t>& initial);
+        bool remove(unsigned id);
+        void clear(void);
+        std::map<unsigned, Watch> watches(void);
+
+    private:
+        struct Entry {
+            Watch watch;
+            std::vector<uint8_t> values;
+            std::chrono::steady_clock::time_point next;
+            bool failing;
+        };
+
+        void run(void);
+
+        Reader _reader;
+        Reporter _reporter;
+        std::map<unsigned, Entry> _entries;
+        unsigned _next_id;
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        bool _stopping;
+        std::thread _thread;
+    };
+
+}
+
+#endif
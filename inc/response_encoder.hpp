@@ -0,0 +1,67 @@
+#ifndef NOS3_RESPONSE_ENCODER_HPP
+#define NOS3_RESPONSE_ENCODER_HPP
+
+#include <cstdint>
+#include <string>
+
+#include <bus_result.hpp>
+
+namespace Nos3 {
+
+    // Encodes command responses and asynchronous receive events for automation clients, as JSON Lines or as binary
+    // frames.  Records are appended to a caller-owned buffer; callers keep one buffer per thread and clear it between
+    // records, so once it has grown to the largest record no encode allocates.
+    //
+    // JSONL:
+    //   {"type":"response","seq":N,"status":"ok|error","result":"SUCCESS|...|null","latency_us":N,"payload":"<base64>","message":"..."}
+    //   {"type":"event","source":"...","bus":"...","timestamp_us":N,"payload":"<base64>"}
+    //   {"type":"watch","id":N,"device":N,"timestamp_us":N,"status":"ok|error","result":"SUCCESS|...","changes":[[register,old,new],...]}
+    // BINARY (little endian):
+    //   response: u8 1, u8 status (0 ok, 1 error), u8 result (0xff none), u8 0, u32 seq, u64 latency_us,
+    //             u32 payload length, u32 message length, payload, message
+    //   event:    u8 2, u8 0, u16 bus length, u32 source length, u64 timestamp_us, u32 payload length, bus, source, payload
+    //   watch:    u8 3, u8 status, u8 result, u8 device, u32 id, u64 timestamp_us, u32 change count,
+    //             then u8 register, u8 old value, u8 new value for each change
+    class ResponseEncoder {
+    public:
+        enum Format {TEXT, JSONL, BINARY};
+
+        struct Response {
+            uint32_t seq;
+            bool error;
+            bool has_result;
+            BusResult result;
+            uint64_t latency_us;
+            const char* payload;
+            size_t payload_len;
+            const char* message;
+            size_t message_len;
+        };
+
+        struct Event {
+            const char* bus;
+            const std::string* source;
+            uint64_t timestamp_us;
+            const char* payload;
+            size_t payload_len;
+        };
+
+        // A REG WATCH report: the registers that changed, or a failed read (with no changes)
+        struct WatchEvent {
+            unsigned id;
+            uint8_t device;
+            uint64_t timestamp_us;
+            BusResult result;
+            const uint8_t* changes;  // (register, old value, new value) triples
+            size_t change_count;
+        };
+
+        static void encode_response(Format format, const Response& response, std::string& out);
+        static void encode_event(Format format, const Event& event, std::string& out);
+        static void encode_watch(Format format, const WatchEvent& event, std::string& out);
+        static const char* result_name(BusResult result);
+    };
+
+}
+
+#endif
@@ -22,6 +22,18 @@
 #include <thread>
 #include <memory>
 #include <stdexcept>
+#include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include <netinet/in.h>
 
 #include <ItcLogger/Logger.hpp>
 #include <Client/Bus.hpp>
@@ -38,38 +50,205 @@
 #include <sim_config.hpp>
 
 #include <bus_connections.hpp>
+#include <can_engine.hpp>
+#include <macro_library.hpp>
+#include <payload_library.hpp>
+#include <register_map.hpp>
+#include <stress_generator.hpp>
+#include <traffic_monitor.hpp>
+#include <connection_monitor.hpp>
+#include <correlator.hpp>
+#include <event_loop.hpp>
+#include <response_encoder.hpp>
+#include <transaction_engine.hpp>
 
 namespace Nos3
 {
+    // The terminal can also be embedded: construct it with a configuration tree (every setting has a default) and drive
+    // it through the typed calls below instead of run().  These do what the corresponding commands do, without
+    // formatting or parsing text.  The STDIO and UDP front ends are themselves built on execute() and subscribe().
+    //
+    // Bus operations and their _async forms may be called from any thread; they are serialized on the current
+    // connection, along with the commands that use the bus (UPLOAD, VECTORS and STRESS hold it for their whole run,
+    // so an operation called meanwhile waits for them).  The configuration calls (use_connection, select_bus, select_target, execute) must come from one
+    // thread at a time.
     class SimTerminal : public SimIHardwareModel
     {
     public:
+        enum BusType {BASE, I2C, CAN, SPI, UART, COMMAND};
+
+        // Caller-owned bytes; only valid for the duration of the call (the _async calls copy them)
+        struct ByteSpan {
+            const char* data;
+            size_t len;
+            ByteSpan(const char* d, size_t l) : data(d), len(l) {}
+            ByteSpan(const std::string& s) : data(s.data()), len(s.size()) {}
+            ByteSpan(const std::vector<char>& v) : data(v.data()), len(v.size()) {}
+        };
+
+        struct OperationResult {
+            bool ok;
+            BusResult result;
+            std::vector<char> data;  // bytes read; empty for writes
+            double latency_ms;
+            unsigned attempts;       // more than 1 if a transaction was retried
+            std::string error;       // why the operation failed, empty if ok
+        };
+
+        struct CommandResult {
+            bool quit;
+            bool error;
+            bool has_result;         // result is only meaningful for commands that went to the bus
+            BusResult result;
+            uint64_t latency_us;
+            std::vector<char> payload;
+            std::string message;     // text the command would print, without any payload
+        };
+
+        struct ReceiveEvent {
+            const char* bus;         // "BASE", "UART", ...
+            const std::string& source;
+            ByteSpan data;
+            uint64_t timestamp_us;   // since the epoch
+        };
+        // Runs on the NOS Engine thread that received the data
+        typedef std::function<void(const ReceiveEvent&)> ReceiveCallback;
+
         // Constructors
         SimTerminal(const boost::property_tree::ptree& config);
+        // For hosts running several terminals: connection heartbeats come from the shared monitor
+        SimTerminal(const boost::property_tree::ptree& config, std::shared_ptr<ConnectionMonitor> monitor);
+        ~SimTerminal();
 
         // Mutators
         void run(void);
 
+        void add_connection(const std::string& name, const std::string& connection_string);
+        bool use_connection(const std::string& name); // false if name is unknown; connects in the background
+        bool wait_connected(std::chrono::milliseconds timeout);
+        void select_bus(BusType type, const std::string& bus_name);
+        bool select_target(const std::string& target, std::string& error);
+
+        OperationResult write(ByteSpan data);
+        OperationResult read(size_t len);
+        OperationResult transact(ByteSpan data, size_t rlen); // uses the session timeout and retry policy
+        OperationResult transact(ByteSpan data, size_t rlen, const TransactionEngine::Policy& policy);
+        std::future<OperationResult> write_async(ByteSpan data);
+        std::future<OperationResult> read_async(size_t len);
+        std::future<OperationResult> transact_async(ByteSpan data, size_t rlen);
+
+        unsigned subscribe(ReceiveCallback callback);
+        void unsubscribe(unsigned id);
+
+        // Runs one terminal command; the result is overwritten by the next call
+        const CommandResult& execute(const std::string& command);
+
+        // The UDP front end in pieces, for hosts that read the sockets of several terminals in one loop.  open_udp binds
+        // the configured port and returns the socket, or -1; handle_datagram runs one command from a client, replies to
+        // it and returns false if the command was QUIT.
+        int open_udp(void);
+        void close_udp(void);
+        bool handle_datagram(const char* data, size_t len, const struct sockaddr_in& client);
+        // Cancels the transaction in progress, as a CANCEL datagram or Ctrl-C does; callable from any thread
+        void cancel(void);
+        static bool is_cancel_datagram(const char* data, size_t len);
+
         // Accessors
-        void write_message_to_cout(const char* buf, size_t len);
-        void write_message_to_cout(const NosEngine::Common::Message& msg);
+        // Called from the bus threads when data arrives for this terminal
+        void post_receive_event(const char* bus, const std::string& source, const char* buf, size_t len);
+        bool is_console(void) const {return _terminal_type == STDIO;}
+        EventLoop& event_loop(void) {return _event_loop;}
 
     private:
         // private types
         enum SimTerminalMode {HEX, ASCII};
-        enum BusType {BASE, I2C, CAN, SPI, UART, COMMAND};
         const std::string _bus_type_string[6] = {"BASE", "I2C", "CAN", "SPI", "UART", "COMMAND"};
         enum PromptType {LONG, SHORT, NONE};
         enum TerminalType {STDIO, UDP};
         const std::string _terminal_type_string[2] = {"STDIO", "UDP"};
+        enum ConnectionState {CONNECTING, CONNECTED, FAILED};
+        const std::string _connection_state_string[3] = {"CONNECTING", "CONNECTED", "FAILED"};
+        struct ConnectParameters {
+            BusType bus_type;
+            int master_address;
+            std::string node_name;
+            std::string connection_string;
+            std::string bus_name;
+            std::string target;
+            bool verbose;
+        };
+        struct Subscriber {
+            unsigned id;
+            ReceiveCallback callback;
+        };
+        // A macro line compiled for RUN
+        struct MacroOp {
+            enum Type {SELECT_BUS, SELECT_TARGET, WRITE, READ, TRANSACT, COMMAND} type;
+            BusType bus_type;        // SELECT_BUS
+            std::string text;        // the bus name, target or command line
+            std::string data;        // WRITE and TRANSACT, already decoded
+            size_t len;              // READ and TRANSACT
+            size_t line;             // in the macro, for reporting failures
+        };
+        // Shared with the connect and warm threads, which may outlive the terminal
+        struct Lifeline {
+            std::mutex mutex;
+            SimTerminal* terminal; // null once the terminal is gone
+        };
+        struct WarmConnection {
+            std::string params_key;
+            std::shared_ptr<class BusConnection> connection;
+            std::chrono::steady_clock::time_point warmed_at;
+            double connect_ms;
+        };
 
         // private helper methods
+        static void handle_sigint(int signum);
         void handle_input(void);
         void handle_udp(void);
         std::string string_prompt(void);
-        bool getline(const std::string& prompt, std::string& input);
         std::string process_command(std::string input);
+        const std::string& respond(const std::string& input, bool& quit);
+        std::stringstream& command_error(std::stringstream& ss);
+        void command_result(BusResult result);
+        void command_payload(std::stringstream& ss, const char* buf, size_t len);
+        void apply_bus_messages(void);
+        void report_operation(std::stringstream& ss, const OperationResult& result);
+        void print_receive_event(const ReceiveEvent& event);
+        void deliver_unsolicited(const std::string& record);
         void reset_bus_connection();
+        void start_connect(void);
+        static void connect(std::shared_ptr<Lifeline> lifeline, unsigned generation, ConnectParameters params, std::shared_ptr<class BusConnection> old, int timeout_ms);
+        void connected(unsigned generation, const ConnectParameters& params, const std::shared_ptr<class BusConnection>& connection, const std::string& error);
+        void connection_failed(const std::string& error);
+        std::string params_key(const ConnectParameters& params);
+        void prewarm_connections(void);
+        static void warm_connection(std::shared_ptr<Lifeline> lifeline, ConnectParameters params, int timeout_ms);
+        void warmed(const ConnectParameters& params, const std::shared_ptr<class BusConnection>& connection, const std::string& error,
+                    std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+        void service_connection(void);
+        static void release_in_background(std::shared_ptr<class BusConnection> connection);
+        static bool open_bus_connection(const ConnectParameters& params, int timeout_ms, std::shared_ptr<class BusConnection>& connection, std::string& error);
+        static std::shared_ptr<class BusConnection> make_bus_connection(const ConnectParameters& params);
+        std::shared_ptr<class BusConnection> acquire_bus_connection(std::string& error);
+        std::shared_ptr<class BusConnection> acquire_bus_connection(std::stringstream& ss);
+        std::shared_ptr<class BusConnection> current_bus_connection(void);
+        void retire_bus_connection(const std::shared_ptr<class BusConnection>& bus);
+        std::string connection_status(void);
+        std::string list_connections(void);
+        const PayloadLibrary::Payload& find_payload(const std::string& reference);
+        bool command_cancelled(void);
+        void can_command(const std::vector<std::string>& tokens, const std::vector<std::string>& tokens_upper, std::stringstream& ss);
+        void register_command(const std::vector<std::string>& tokens, const std::vector<std::string>& tokens_upper, std::stringstream& ss);
+        void correlate_command(const std::vector<std::string>& tokens, const std::vector<std::string>& tokens_upper, std::stringstream& ss);
+        void monitor_command(const std::vector<std::string>& tokens, const std::vector<std::string>& tokens_upper, std::stringstream& ss);
+        void macro_command(const std::vector<std::string>& tokens, const std::vector<std::string>& tokens_upper, std::stringstream& ss);
+        void run_command(const std::vector<std::string>& tokens, std::stringstream& ss);
+        void stress_command(const std::vector<std::string>& tokens, std::stringstream& ss);
+        std::vector<MacroOp> compile_macro(const std::vector<std::string>& lines);
+        bool run_macro_op(const MacroOp& op, bool show, std::stringstream& ss);
+        BusResult read_watched_registers(int device, int start, size_t count, uint8_t* values);
+        void report_register_changes(unsigned id, const RegisterWatcher::Watch& watch, const std::vector<RegisterWatcher::Change>& changes, BusResult result);
         
         // private helper helpers
         std::stringstream write_message_to_stream(const char* buf, size_t len);
@@ -80,22 +259,86 @@ namespace Nos3
         uint8_t convert_asciihexcharpair_to_hexhexchar(char in1, char in2);
         uint8_t convert_asciihexchar_to_hexhexchar(char in);
         bool set_bus_type(std::string type);
+        static bool parse_bus_type(std::string type, BusType& bus_type);
 
         // private data
         static const int _MAXLINE = 1024;
+        static const unsigned _MAX_MACRO_DEPTH = 8; // macros running macros
+        static const unsigned long _MAX_MACRO_RUNS = 1000000; // runs of one RUN
+        static const unsigned long _MAX_CAN_BURST = 100000; // frames in one CAN BURST
+        static const unsigned _MAX_CONNECTS_RUNNING = 2; // automatic reconnects are not started past this many
+        static std::atomic<SimTerminal*> _console_terminal; // the one reading stdin, which Ctrl-C cancels
+        EventLoop _event_loop; // declared early so that it outlives the connections whose callbacks print through it
         std::map<std::string, std::string> _connection_strings;
         std::string _nos_connection_string;
         std::string _active_connection_name;
         std::string _bus_name;
         BusType _bus_type;
         std::string _other_node_name;
-        std::unique_ptr<class BusConnection> _bus_connection;
+        std::shared_ptr<class BusConnection> _bus_connection; // guarded by _connection_mutex
         enum SimTerminalMode _current_in_mode;
         enum SimTerminalMode _current_out_mode;
         enum PromptType _prompt;
         enum TerminalType _terminal_type;
         int _udp_port;
-        bool _suppress_output;
+        int _udp_sockfd;
+        std::mutex _udp_client_mutex;
+        struct sockaddr_in _udp_client; // where structured events go; the sender of the last command
+        bool _udp_client_known;
+        unsigned _udp_printer;
+        std::atomic<bool> _cancel_requested;
+        std::atomic<bool> _transaction_in_progress; // a cancellable command is running; Ctrl-C cancels it
+        std::atomic<bool> _interrupted;             // set by Ctrl-C, from the signal handler
+        std::atomic<bool> _suppress_output; // read by the receive callbacks
+        bool _bus_messages;
+        std::atomic<ResponseEncoder::Format> _response_format;
+        CommandResult _command_result;
+        uint32_t _response_seq;
+        std::string _response_buffer;
+
+        // connection state, shared with the connect and monitor threads
+        std::mutex _connection_mutex;
+        std::condition_variable _connection_cv;
+        ConnectionState _connection_state;
+        std::string _connection_error;
+        ConnectParameters _connect_params;
+        unsigned _connect_generation;
+        unsigned _connects_running; // connect threads that have not reported back, counting any stuck in the bus
+        std::chrono::steady_clock::time_point _connect_started;
+        std::chrono::steady_clock::time_point _connected_at;
+        std::chrono::steady_clock::time_point _retry_at;
+        std::string _bus_connection_string;
+        std::string _bus_params_key;
+        int _connect_timeout_ms;
+        int _reconnect_initial_ms;
+        int _reconnect_max_ms;
+        int _reconnect_delay_ms;
+        int _command_deadline_ms;
+        bool _prewarm;
+        std::shared_ptr<Lifeline> _lifeline;
+        std::set<std::string> _prewarm_targets;
+        std::map<std::string, WarmConnection> _warm_connections; // by connection string
+        std::set<std::string> _warming;
+        std::map<std::string, std::chrono::steady_clock::time_point> _warm_retry_at;
+        std::shared_ptr<ConnectionMonitor> _monitor;
+        unsigned _monitor_tick;
+        PayloadLibrary _payloads;
+        MacroLibrary _macros;
+        unsigned _macro_depth;
+        TransactionEngine _transactions;
+        TransactionEngine::Policy _transaction_policy;
+        std::mutex _bus_op_mutex;
+        CanEngine _can_engine; // filters, ISO-TP options and statistics for the CAN commands
+        std::mutex _subscriber_mutex;
+        std::shared_ptr<const std::vector<Subscriber>> _subscribers; // replaced, never modified, so readers need no lock
+        unsigned _next_subscriber;
+        TrafficMonitor _traffic;
+        TrafficMonitor::Baseline _traffic_live;     // for the refresh timer
+        TrafficMonitor::Baseline _traffic_snapshot; // for MONITOR SNAPSHOT, which shows the traffic since the last one
+        Correlator _correlator;
+        unsigned _traffic_timer; // the MONITOR view's refresh timer, 0 when it is not shown
+        RegisterMap _registers; // used under _bus_op_mutex
+        RegisterWatcher _register_watcher; // last, so that it stops before anything it reads through goes away
     };
 }
 
@@ -0,0 +1,64 @@
+#ifndef NOS3_SIMULATOR_TERMINAL_HOST_HPP
+#define NOS3_SIMULATOR_TERMINAL_HOST_HPP
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include <sim_i_hardware_model.hpp>
+
+#include <connection_monitor.hpp>
+#include <event_loop.hpp>
+#include <simulator_terminal.hpp>
+#include <worker_pool.hpp>
+
+namespace Nos3
+{
+    // Runs several terminals in one process.  Each <instance> under <instances> is configured exactly like a SimTerminal
+    // hardware model.  The terminals share one connection monitor thread, and their bus connections share one NOS
+    // Engine transport hub per server.  The UDP terminals' sockets are all read by one event loop (the console's, if one
+    // terminal uses STDIO) and their commands run on a fixed pool of worker threads, one command at a time per terminal,
+    // so that a slow transaction on one terminal does not hold up the others.  A CANCEL datagram for a terminal that is
+    // running a command cancels it at once instead of waiting its turn.
+    //
+    // The host runs until every UDP terminal has quit, or until the console quits.
+    class SimTerminalHost : public SimIHardwareModel
+    {
+    public:
+        SimTerminalHost(const boost::property_tree::ptree& config);
+        ~SimTerminalHost();
+
+        void run(void);
+
+    private:
+        struct Instance {
+            std::unique_ptr<SimTerminal> terminal;
+            int sockfd;
+            std::mutex mutex;   // guards the rest
+            std::deque<std::pair<std::string, struct sockaddr_in>> datagrams;
+            bool busy;          // a drain job is posted or running; it is the only one, so commands run in order
+            bool done;          // the terminal has quit
+        };
+
+        void readable(Instance& instance);
+        void drain(Instance& instance);
+        void finished(Instance& instance);
+
+        static const int _MAXLINE = 1024;
+        std::shared_ptr<ConnectionMonitor> _monitor;
+        std::vector<std::unique_ptr<Instance>> _instances; // destroyed after the workers, which use them
+        Instance* _console;
+        std::atomic<size_t> _open;  // UDP terminals that have not quit
+        std::atomic<bool> _stopping;
+        WorkerPool _workers;
+        EventLoop _loop;            // serves the sockets when no terminal has the console
+    };
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef NOS3_STRESS_GENERATOR_HPP
+#define NOS3_STRESS_GENERATOR_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <bus_result.hpp>
+
+namespace Nos3 {
+
+    // xorshift64*, seeded through splitmix64 so that neighbouring seeds give unrelated streams
+    class StressRandom {
+    public:
+        explicit StressRandom(uint64_t seed) {
+            uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            _state = z ^ (z >> 31);
+            if (_state == 0) _state = 1;
+        }
+        uint64_t next(void) {
+            _state ^= _state >> 12;
+            _state ^= _state << 25;
+            _state ^= _state >> 27;
+            return _state * 0x2545F4914F6CDD1DULL;
+        }
+        double uniform(void) {return (next() >> 11) * (1.0 / 9007199254740992.0);} // [0, 1)
+        uint64_t below(uint64_t n) {return static_cast<uint64_t>(uniform() * n);}
+
+    private:
+        uint64_t _state;
+    };
+
+    // Randomized operation streams for the STRESS command.  Worker w's stream depends only on the seed and w, so a
+    // failure can be replayed from the seed, the worker and the operation number however the workers interleaved.
+    // The bus side lives in the terminal, which runs each stream on a connection of its own and hands the outcomes
+    // to a Tally.
+    class StressGenerator {
+    public:
+        enum OpKind {WRITE, READ, TRANSACT};
+
+        struct SizeRange {
+            size_t min;
+            size_t max;
+        };
+
+        struct Options {
+            uint64_t seed;
+            size_t operations;              // in total, shared out among the workers
+            size_t workers;
+            unsigned mix[3];                // relative weights of writes, reads and transactions
+            std::vector<SizeRange> sizes;   // a range is picked uniformly, then a size uniformly within it
+            std::vector<std::string> targets;
+            std::vector<long> masters;      // I2C and CAN master address of each worker; empty elsewhere
+            double gap_us;                  // mean of the exponentially distributed pause before each operation
+            std::string repro_path;
+        };
+
+        struct Op {
+            size_t index;                   // within the worker's stream
+            OpKind kind;
+            const std::string* target;
+            std::vector<char> data;         // written
+            size_t rlen;                    // read
+            double gap_us;
+        };
+
+        // Parses "<operations> [SEED=<n>] [WORKERS=<n>] [MIX=<w>:<r>:<t>] [SIZES=<a>[-<b>],...] [TARGETS=<t>,...]
+        // [MASTERS=<a>,...] [GAP=<duration>] [REPRO=<file>]" over the defaults already in options; throws
+        // std::runtime_error
+        static void parse(const std::vector<std::string>& tokens, size_t first, Options& options);
+        static std::string command_line(const Options& options); // a STRESS command that repeats the run
+
+        StressGenerator(const Options& options, size_t worker);
+        size_t remaining(void) const {return _count - _next;}
+        void next(Op& op); // reuses op's storage
+
+        static const char* kind_as_string(OpKind kind);
+
+    private:
+        const Options& _options;
+        StressRandom _random;
+        size_t _count;
+        size_t _next;
+        unsigned _mix_total;
+    };
+
+    // Outcomes of one worker's operations, merged into a total once the workers are done.  Latencies go into a fixed
+    // histogram, so a tally stays the same size however long the run.
+    class StressTally {
+    public:
+        static const size_t BUCKETS = 32; // bucket k holds latencies in [2^k, 2^(k+1)) us; bucket 0 also holds < 1 us
+
+        StressTally();
+
+        // error is what the operation threw, if it threw
+        void record(size_t worker, const StressGenerator::Op& op, BusResult result, double latency_us, const std::string& error = std::string());
+        void merge(const StressTally& other);
+        bool failed(void) const {return _failed;}
+        uint64_t operations(void) const {return _counts[0] + _counts[1] + _counts[2];}
+        uint64_t errors(BusResult result) const {return _errors[result];}
+        const uint64_t* buckets(void) const {return _buckets;}
+        std::string report(const StressGenerator::Options& options, double elapsed_s) const;
+        // Writes the first failure as terminal commands that repeat it, run as the node (TERMNODE) of the worker it
+        // failed on; returns the error, or empty on success
+        std::string write_repro(const StressGenerator::Options& options, const std::string& bus_type, const std::string& bus_name,
+                                const std::vector<std::string>& worker_nodes) const;
+
+    private:
+        struct Failure {
+            std::chrono::steady_clock::time_point at;
+            size_t worker;
+            size_t index;
+            StressGenerator::OpKind kind;
+            std::string target;
+            std::vector<char> data;
+            size_t rlen;
+            BusResult result;
+            double latency_us;
+            std::string error;
+        };
+
+        static size_t bucket(double us);
+
+        uint64_t _buckets[BUCKETS];
+        double _min_us;
+        double _max_us;
+        double _total_us;
+        uint64_t _counts[3];
+        uint64_t _errors[BUS_UNSUPPORTED + 1];
+        uint64_t _bytes;
+        bool _failed;
+        Failure _first;
+    };
+
+}
+
+#endif
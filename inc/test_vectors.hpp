@@ -0,0 +1,70 @@
+#ifndef NOS3_TEST_VECTORS_HPP
+#define NOS3_TEST_VECTORS_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+#include <bus_connections.hpp>
+
+namespace Nos3 {
+
+    // A test vector file holds one vector per line:
+    //     <command hex> <expected hex | -> [<mask hex | -> [<timeout ms>]]
+    // Blank lines and lines starting with '#' are ignored.  An expected response of '-' means the command is only
+    // written; otherwise it is sent as a transaction reading back as many bytes as are expected.  The mask defaults
+    // to all ones and the timeout to 5000 ms.  The file is decoded once into a single byte arena so that running the
+    // set does no text handling at all.  The cancellation check is made between vectors; the vectors not run are
+    // counted as skipped and left out of the statistics.
+    class TestVectorSet {
+    public:
+        enum VectorStatus {PASS, MISMATCH, TIMEOUT, ERROR};
+
+        struct Summary {
+            size_t passed;
+            size_t mismatched;
+            size_t timed_out;
+            size_t errored;
+            size_t skipped;
+            double total_seconds;
+            double min_us, mean_us, p50_us, p95_us, p99_us, max_us;
+            std::vector<std::string> first_failures;
+        };
+
+        void load(const std::string& path);
+        size_t size(void) const {return _vectors.size();}
+        Summary run(BusConnection& bus, std::function<bool(void)> cancelled);
+        void write_report(const std::string& path, const Summary& summary) const;
+        static std::string summary_as_string(const Summary& summary);
+
+    private:
+        struct Vector {
+            uint32_t command_offset;
+            uint32_t command_length;
+            uint32_t expected_offset; // mask bytes directly follow the expected bytes in the arena
+            uint32_t expected_length;
+            uint32_t timeout_ms;
+            uint32_t line;
+        };
+
+        struct VectorResult {
+            VectorStatus status;
+            uint32_t latency_us;
+        };
+
+        static const size_t _MAX_REPORTED_FAILURES = 10;
+
+        template <typename Connection> Summary run_on(Connection& bus, const std::function<bool(void)>& cancelled);
+        uint32_t append_hex(const std::string& hex, uint32_t line);
+        std::string describe_failure(size_t index, const uint8_t* received, const std::string& error) const;
+
+        std::string _path;
+        std::vector<uint8_t> _arena;
+        std::vector<Vector> _vectors;
+        std::vector<VectorResult> _results;
+    };
+
+}
+
+#endif
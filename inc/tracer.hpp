@@ -0,0 +1,62 @@
+#ifndef NOS3_TRACER_HPP
+#define NOS3_TRACER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#define NOS3_UNLIKELY(x) __builtin_expect(!!(x), 0)
+
+// Times the enclosing scope as a span called name, which must be a string literal
+#define NOS3_TRACE_SPAN(name) ::Nos3::TraceSpan NOS3_TRACE_JOIN(nos3_trace_span_, __LINE__)(name)
+#define NOS3_TRACE_JOIN(a, b) NOS3_TRACE_JOIN2(a, b)
+#define NOS3_TRACE_JOIN2(a, b) a##b
+
+namespace Nos3 {
+
+    // Process-wide recorder of timed spans for TRACE START/STOP, written out in the Chrome trace event format that
+    // chrome://tracing and Perfetto load.  Each thread records into a fixed size buffer of its own with no locking
+    // (spans beyond the buffer's capacity are counted and dropped), and the buffers are only gathered when the trace
+    // stops.  While no trace is being recorded a span costs one well predicted test of a flag.
+    class Tracer {
+    public:
+        static bool start(const std::string& path, std::string& error);
+        // Writes the trace to the file given to start; events is how many spans were written and dropped how many did
+        // not fit
+        static bool stop(std::string& path, size_t& events, size_t& dropped, std::string& error);
+        static bool enabled(void) {return _enabled.load(std::memory_order_relaxed);}
+
+        static uint64_t now_ns(void) {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+        static void record(const char* name, uint64_t start_ns, uint64_t end_ns);
+
+    private:
+        static std::atomic<bool> _enabled;
+        static std::string _path;
+    };
+
+    class TraceSpan {
+    public:
+        // Whether tracing is on is decided once, here; the destructor only looks at the name
+        explicit TraceSpan(const char* name) : _name(nullptr), _start_ns(0) {
+            if (NOS3_UNLIKELY(Tracer::enabled())) {
+                _name = name;
+                _start_ns = Tracer::now_ns();
+            }
+        }
+        ~TraceSpan() {
+            if (NOS3_UNLIKELY(_name != nullptr)) Tracer::record(_name, _start_ns, Tracer::now_ns());
+        }
+        TraceSpan(const TraceSpan&) = delete;
+        TraceSpan& operator=(const TraceSpan&) = delete;
+
+    private:
+        const char* _name; // null if tracing was off when the span began
+        uint64_t _start_ns;
+    };
+
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef NOS3_TRAFFIC_MONITOR_HPP
+#define NOS3_TRAFFIC_MONITOR_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Nos3 {
+
+    // Per-source message and byte counts for the MONITOR view, kept apart by bus so that the same name on two buses is
+    // two rows.  Counting happens on whatever thread sees the traffic (NOS Engine receive threads, the command thread,
+    // async operations, stress workers) into a shard owned by that thread, so the only lock taken per message is the
+    // shard's own, which nothing else holds except while a snapshot is summed.  snapshot() aggregates the shards and
+    // turns the change since the caller's baseline into rates; each view keeps a baseline of its own, so taking one
+    // view does not shorten the interval of another.
+    class TrafficMonitor {
+    public:
+        struct Row {
+            std::string source;
+            const char* bus;
+            double rx_messages_per_s;
+            double rx_bytes_per_s;
+            double tx_messages_per_s;
+            double tx_bytes_per_s;
+            uint64_t messages;       // in both directions since the monitor started or was reset
+            uint64_t bytes;
+            double last_seen_s;      // seconds ago
+        };
+
+    private:
+        struct Counter {
+            const char* bus;
+            uint64_t rx_messages;
+            uint64_t rx_bytes;
+            uint64_t tx_messages;
+            uint64_t tx_bytes;
+            std::chrono::steady_clock::time_point last_seen;
+        };
+        struct BusLess {
+            bool operator()(const char* a, const char* b) const {return strcmp(a, b) < 0;}
+        };
+        typedef std::map<std::string, Counter> SourceCounters;
+        typedef std::map<const char*, SourceCounters, BusLess> Counters; // by bus, then source
+
+    public:
+        // The counts a view last showed, and when
+        struct Baseline {
+            Baseline() : at(std::chrono::steady_clock::now()), resets(0) {}
+            Counters counters;
+            std::chrono::steady_clock::time_point at;
+            uint64_t resets;
+        };
+
+        TrafficMonitor();
+
+        // bus must be a string literal or otherwise outlive the monitor
+        void record(const char* bus, const std::string& source, size_t bytes, bool outbound);
+
+        // Rows ordered busiest first, with rates since baseline, which is then moved up to now; interval_s is the time
+        // the rates are measured over
+        std::vector<Row> snapshot(Baseline& baseline, double& interval_s);
+        void reset(void);
+
+        static std::string table_as_string(const std::vector<Row>& rows, double interval_s);
+
+    private:
+        struct Shard {
+            std::mutex mutex;
+            Counters counters;
+        };
+
+        Shard& shard(void);
+
+        const uint64_t _instance; // identifies this monitor in the per-thread shard cache
+        std::mutex _mutex;
+        std::map<std::thread::id, std::unique_ptr<Shard>> _shards;
+        uint64_t _resets; // a baseline taken before the last reset is out of date
+        std::chrono::steady_clock::time_point _reset_at;
+    };
+
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef NOS3_TRANSACTION_ENGINE_HPP
+#define NOS3_TRANSACTION_ENGINE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <bus_result.hpp>
+
+namespace Nos3 {
+
+    class BusConnection;
+
+    // Runs transactions against a deadline.  The bus call itself happens on a worker thread, because the I2C, CAN and
+    // SPI masters have no timeout of their own; the caller waits for it in short slices so that it can give up when
+    // the deadline passes or the cancel check fires.  A call given up on while still in the bus is reported as
+    // abandoned: it keeps its worker until the bus returns, later transactions get a new worker, and the caller must
+    // not use that connection again, so that a master is never driven from two threads at once.  The cancel check
+    // runs on the calling thread and calls to transact must not overlap.
+    //
+    // BUSY and ERROR results are retried with a doubling backoff, capped at max_backoff and never past the deadline.
+    class TransactionEngine {
+    public:
+        struct Policy {
+            std::chrono::milliseconds timeout;
+            unsigned retries;
+            std::chrono::milliseconds max_backoff;
+        };
+
+        enum Outcome {SUCCESS, TIMEOUT, CANCELLED, FAILED};
+
+        struct Result {
+            Outcome outcome;
+            BusResult last_result;
+            unsigned attempts;
+            double latency_ms;
+            bool abandoned;       // the last attempt may still be running on the bus
+        };
+
+        struct Stats {
+            uint64_t successes;
+            uint64_t timeouts;
+            uint64_t cancelled;
+            uint64_t failures;
+            uint64_t retries;
+            double success_total_ms;
+            double success_max_ms;
+        };
+
+        TransactionEngine();
+        ~TransactionEngine();
+
+        Result transact(std::shared_ptr<BusConnection> bus, const char* wbuf, size_t wlen, char* rbuf, size_t rlen,
+                        const Policy& policy, std::function<bool(void)> cancelled);
+        Stats stats(void);
+
+        // Explains a failed transaction; empty on success
+        static std::string result_as_string(const Result& result, const BusConnection& bus);
+        static std::string stats_as_string(const Stats& stats);
+        // "50ms", "2s", "1500us"; a bare number is milliseconds.  Bus timeouts are whole milliseconds, so anything
+        // under 1 ms, or not finite, throws std::invalid_argument
+        static std::chrono::milliseconds parse_duration(const std::string& text);
+
+    private:
+        struct Job;
+        struct Worker;
+
+        void start_worker(void);
+        void retire_worker(void);
+
+        std::shared_ptr<Worker> _worker; // shared with the worker thread, which may outlive the engine if a call hangs
+        std::mutex _stats_mutex;
+        Stats _stats;
+    };
+
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef NOS3_TRANSPORT_REGISTRY_HPP
+#define NOS3_TRANSPORT_REGISTRY_HPP
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <Transport/TransportHub.hpp>
+
+namespace Nos3 {
+
+    // Process-wide NOS Engine transport hubs, one per connection string.  Every bus connection to the same server
+    // shares one hub, and with it one set of transports and I/O threads, no matter how many terminals or buses use it.
+    // A hub is closed when the last connection holding it goes away.
+    class TransportRegistry {
+    public:
+        static std::shared_ptr<NosEngine::Transport::TransportHub> acquire(const std::string& connection_string);
+
+    private:
+        static std::mutex _mutex;
+        static std::map<std::string, std::weak_ptr<NosEngine::Transport::TransportHub>> _hubs;
+    };
+
+}
+
+#endif
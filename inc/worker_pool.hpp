@@ -0,0 +1,36 @@
+#ifndef NOS3_WORKER_POOL_HPP
+#define NOS3_WORKER_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Nos3 {
+
+    // A fixed set of threads running posted jobs in the order they were posted.  Jobs must not throw or wait on other jobs; a
+    // caller that needs jobs for one owner to run one at a time chains them itself.  The destructor runs the jobs
+    // already posted and then joins the threads.
+    class WorkerPool {
+    public:
+        WorkerPool(size_t threads);
+        ~WorkerPool();
+
+        void post(std::function<void(void)> job);
+        size_t size(void) const {return _threads.size();}
+
+    private:
+        void run(void);
+
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        std::deque<std::function<void(void)>> _jobs;
+        bool _stopping;
+        std::vector<std::thread> _threads;
+    };
+
+}
+
+#endif
@@ -1,18 +1,36 @@
 #include <bus_connections.hpp>
 #include <sstream>
+#include <chrono>
 #include <cstring>
+#include <cstdio>
 
 namespace Nos3 {
 
     void BusConnection::set_target(std::string target){
         _target = target;
+        _target_valid = is_valid_target(target);
+        _address = _target_valid ? parse_target(target) : 0;
     }
 
-    I2CConnection::I2CConnection(int master_address, std::string connection_string, std::string bus_name){
+    void BusConnection::count(uint32_t address, size_t bytes, bool outbound){
+        if (!_traffic) return;
+        char source[16];
+        snprintf(source, sizeof(source), "0x%02X", address);
+        count(std::string(source), bytes, outbound);
+    }
+
+    void BusConnection::throw_if_invalid_target(void) const {
+        if (!_target_valid) {
+            throw std::runtime_error(invalid_target_message(_target));
+        }
+    }
+
+    I2CConnection::I2CConnection(int master_address, std::string connection_string, std::string bus_name, std::shared_ptr<NosEngine::Transport::TransportHub> hub) :
+        BusConnection(I2C_KIND, hub) {
         //set_target(target);
         //std::cout << "Master address: " << master_address << std::endl;
         //std::cout << "Connection string: " << connection_string << std::endl;
-        _i2c.reset(new NosEngine::I2C::I2CMaster(master_address, connection_string, bus_name));
+        _i2c.reset(new NosEngine::I2C::I2CMaster(master_address, *hub, connection_string, bus_name));
     }
 
     I2CConnection::~I2CConnection() {
@@ -21,68 +39,43 @@ namespace Nos3 {
         delete old;
     }
 
-    void I2CConnection::write(const char* buf, size_t len){
-        try{
-            int address = stoi(_target);
-            _i2c->i2c_write(address, reinterpret_cast<const uint8_t*>(buf), len);
-            std::cout << "Wrote " << len << " bytes to I2C address " << address << std::endl;
-        }catch(std::invalid_argument &e){
-            std::stringstream ss;
-            ss << "Error: \"" << _target << "\" is not a valid I2C address. To select an address, use SET SIMNODE.";
-            throw std::runtime_error(ss.str());
-        }
+    std::string I2CConnection::invalid_target_message(const std::string& target) const {
+        std::stringstream ss;
+        ss << "Error: \"" << target << "\" is not a valid I2C address. To select an address, use SET SIMNODE.";
+        return ss.str();
+    }
+
+    BusResult I2CConnection::write(const char* buf, size_t len){
+        throw_if_invalid_target();
+        BusResult result = try_write(buf, len);
+        if (_verbose) std::cout << "Wrote " << len << " bytes to I2C address " << _address << std::endl;
+        return result;
     }
 
-    void I2CConnection::read(char* buf, size_t len){
+    BusResult I2CConnection::read(char* buf, size_t len){
         if(len <= 0){
             throw std::runtime_error("Error: Length must be greater than zero.");
         }
-        try {
-            int address = stoi(_target);
-            NosEngine::I2C::Result result = _i2c->i2c_read(address, reinterpret_cast<uint8_t*>(buf), len);
-            std::cout << "Result: ";
-            switch (result)
-            {
-            case NosEngine::I2C::Result::I2C_SUCCESS:
-                std::cout << "I2C Success";
-                break;
-            case NosEngine::I2C::Result::I2C_ERROR:
-                std::cout << "I2C Error";
-                break;
-            case NosEngine::I2C::Result::I2C_BUSY:
-                std::cout << "I2C Busy";
-                break;
-            default:
-                std::cout << "Unknown";
-                break;
-            }
-            std::cout << std::endl;
-        }catch (std::invalid_argument &e){
-            std::stringstream ss;
-            ss << "Error: \"" << _target << "\" is not a valid I2C address. To select an address, use SET SIMNODE.";
-            throw std::runtime_error(ss.str());
-        }
+        throw_if_invalid_target();
+        BusResult result = try_read(buf, len);
+        if (_verbose) std::cout << "Result: I2C " << bus_result_as_string(result) << std::endl;
+        return result;
     }
 
-    void I2CConnection::transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen){
+    BusResult I2CConnection::transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen){
         if(rlen <= 0){
             throw std::runtime_error("Error: Length must be greater than zero.");
         }
-        try {
-            int address = stoi(_target);
-            _i2c->i2c_transaction(address, reinterpret_cast<const uint8_t*>(wbuf), wlen, reinterpret_cast<uint8_t*>(rbuf), rlen);
-        }catch (std::invalid_argument &e){
-            std::stringstream ss;
-            ss << "Error: \"" << _target << "\" is not a valid I2C address. To select an address, use SET SIMNODE.";
-            throw std::runtime_error(ss.str());
-        }
+        throw_if_invalid_target();
+        return try_transact(wbuf, wlen, rbuf, rlen);
     }
 
-    CANConnection::CANConnection(int master_identifier, std::string connection_string, std::string bus_name){
+    CANConnection::CANConnection(int master_identifier, std::string connection_string, std::string bus_name, std::shared_ptr<NosEngine::Transport::TransportHub> hub) :
+        BusConnection(CAN_KIND, hub) {
         //set_target(target);
         //std::cout << "Master address: " << master_identifier << std::endl;
         //std::cout << "Connection string: " << connection_string << std::endl;
-        _can.reset(new NosEngine::Can::CanMaster(master_identifier, connection_string, bus_name));
+        _can.reset(new NosEngine::Can::CanMaster(master_identifier, *hub, connection_string, bus_name));
     }
 
     CANConnection::~CANConnection() {
@@ -91,119 +84,78 @@ namespace Nos3 {
         delete old;
     }
 
-    void CANConnection::write(const char* buf, size_t len){
-        try{
-            int address = stoi(_target);
-            _can->can_write(address, reinterpret_cast<const uint8_t*>(buf), len);
-            std::cout << "Wrote " << len << " bytes to CAN address " << address << std::endl;
-        }catch(std::invalid_argument &e){
-            std::stringstream ss;
-            ss << "Error: \"" << _target << "\" is not a valid CAN identifier. To select an identifier, use SET SIMNODE.";
-            throw std::runtime_error(ss.str());
-        }
+    std::string CANConnection::invalid_target_message(const std::string& target) const {
+        std::stringstream ss;
+        ss << "Error: \"" << target << "\" is not a valid CAN identifier. To select an identifier, use SET SIMNODE.";
+        return ss.str();
+    }
+
+    BusResult CANConnection::write(const char* buf, size_t len){
+        throw_if_invalid_target();
+        BusResult result = try_write(buf, len);
+        if (_verbose) std::cout << "Wrote " << len << " bytes to CAN address " << _address << std::endl;
+        return result;
     }
 
-    void CANConnection::read(char* buf, size_t len){
+    BusResult CANConnection::read(char* buf, size_t len){
         if(len <= 0){
             throw std::runtime_error("Error: Length must be greater than zero.");
         }
-        try {
-            int address = stoi(_target);
-            NosEngine::Can::Result result = _can->can_read(address, reinterpret_cast<uint8_t*>(buf), len);
-            std::cout << "Result: ";
-            switch (result)
-            {
-            case NosEngine::Can::Result::CAN_SUCCESS:
-                std::cout << "Can Success";
-                break;
-            case NosEngine::Can::Result::CAN_ERROR:
-                std::cout << "Can Error";
-                break;
-            case NosEngine::Can::Result::CAN_BUSY:
-                std::cout << "Can Busy";
-                break;
-            default:
-                std::cout << "Unknown";
-                break;
-            }
-            std::cout << std::endl;
-        }catch (std::invalid_argument &e){
-            std::stringstream ss;
-            ss << "Error: \"" << _target << "\" is not a valid CAN identifier. To select an identifier, use SET SIMNODE.";
-            throw std::runtime_error(ss.str());
-        }
+        throw_if_invalid_target();
+        BusResult result = try_read(buf, len);
+        if (_verbose) std::cout << "Result: Can " << bus_result_as_string(result) << std::endl;
+        return result;
     }
 
-    void CANConnection::transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen){
+    BusResult CANConnection::transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen){
         if(rlen <= 0){
             throw std::runtime_error("Error: Length must be greater than zero.");
         }
-        try {
-            int address = stoi(_target);
-            _can->can_transaction(address, reinterpret_cast<const uint8_t*>(wbuf), wlen, reinterpret_cast<uint8_t*>(rbuf), rlen);
-        }catch (std::invalid_argument &e){
-            std::stringstream ss;
-            ss << "Error: \"" << _target << "\" is not a valid CAN identifier. To select an identifier, use SET SIMNODE.";
-            throw std::runtime_error(ss.str());
-        }
+        throw_if_invalid_target();
+        return try_transact(wbuf, wlen, rbuf, rlen);
     }
 
-    SPIConnection::SPIConnection(std::string connection_string, std::string bus_name){
-        _spi.reset(new NosEngine::Spi::SpiMaster(connection_string, bus_name));
+    SPIConnection::SPIConnection(std::string connection_string, std::string bus_name, std::shared_ptr<NosEngine::Transport::TransportHub> hub) :
+        BusConnection(SPI_KIND, hub) {
+        _spi.reset(new NosEngine::Spi::SpiMaster(*hub, connection_string, bus_name));
     }
-    
+
     SPIConnection::~SPIConnection() {
         Nos3::sim_logger->debug("SPIConnection: deleting old spi Handle");
         NosEngine::Spi::SpiMaster* old = _spi.release();
         delete old;
     }
 
-    void SPIConnection::write(const char* buf, size_t len){
-        try {
-            int select = stoi(_target);
-            _spi->select_chip(select);
-            _spi->spi_write(reinterpret_cast<const uint8_t*>(buf), len);
-            _spi->unselect_chip();
-            std::cout << "Wrote " << len << " bytes to SPI device " << select << std::endl;
-        }catch (std::invalid_argument &e){
-            std::stringstream ss;
-            ss << "Error: \"" << _target << "\" is not a valid select line. Must be a number.";
-            throw std::runtime_error(ss.str());
-        }
+    std::string SPIConnection::invalid_target_message(const std::string& target) const {
+        std::stringstream ss;
+        ss << "Error: \"" << target << "\" is not a valid select line. Must be a number.";
+        return ss.str();
     }
 
-    void SPIConnection::read(char* buf, size_t len){
-        try {
-            int select = stoi(_target);
-            _spi->select_chip(select);
-            _spi->spi_read(reinterpret_cast<uint8_t*>(buf), len);
-            _spi->unselect_chip();
-        }catch (std::invalid_argument &e){
-            std::stringstream ss;
-            ss << "Error: \"" << _target << "\" is not a valid select line. Must be a number.";
-            throw std::runtime_error(ss.str());
-        }
+    BusResult SPIConnection::write(const char* buf, size_t len){
+        throw_if_invalid_target();
+        BusResult result = try_write(buf, len);
+        if (_verbose) std::cout << "Wrote " << len << " bytes to SPI device " << _address << std::endl;
+        return result;
     }
 
-    void SPIConnection::transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen){
-        try {
-            int select = stoi(_target);
-            _spi->select_chip(select);
-            _spi->spi_transaction(reinterpret_cast<const uint8_t*>(wbuf), wlen, reinterpret_cast<uint8_t*>(rbuf), rlen);
-            _spi->unselect_chip();
-        }catch (std::invalid_argument &e){
-            std::stringstream ss;
-            ss << "Error: \"" << _target << "\" is not a valid select line. Must be a number.";
-            throw std::runtime_error(ss.str());
-        }
+    BusResult SPIConnection::read(char* buf, size_t len){
+        throw_if_invalid_target();
+        return try_read(buf, len);
+    }
+
+    BusResult SPIConnection::transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen){
+        throw_if_invalid_target();
+        return try_transact(wbuf, wlen, rbuf, rlen);
     }
 
-    UartConnection::UartConnection(SimTerminal* terminal, std::string node_name, std::string connection_string, std::string bus_name){
-        _uart.reset(new NosEngine::Uart::Uart(node_name, connection_string, bus_name));
-        _terminal = terminal;
-        _uart->set_read_callback([this, bus_name](const uint8_t* const buf, size_t len, void* user){
-            std::cout << std::endl << "Received a UART message on bus " << bus_name << " (user " << user << "): " << std::endl;
-            _terminal->write_message_to_cout(reinterpret_cast<const char*>(buf), len);
+    UartConnection::UartConnection(std::string node_name, std::string connection_string, std::string bus_name, std::shared_ptr<NosEngine::Transport::TransportHub> hub) :
+        BusConnection(UART_KIND, hub), _bus_name(bus_name) {
+        _uart.reset(new NosEngine::Uart::Uart(*hub, node_name, connection_string, bus_name));
+        _uart->set_read_callback([this, bus_name](const uint8_t* const buf, size_t len, void*){
+            NOS3_TRACE_SPAN("UART receive callback");
+            SimTerminal* receiver = _receiver;
+            if (receiver) receiver->post_receive_event("UART", bus_name, reinterpret_cast<const char*>(buf), len);
         });
     }
 
@@ -213,20 +165,18 @@ namespace Nos3 {
         delete old;
     }
 
-    void UartConnection::write(const char* buf, size_t len){
-        try {
-            int port = stoi(_target);
-            _uart->open(port);
-            _uart->write(reinterpret_cast<const uint8_t*>(buf), len);
-            _uart->close();
-        }catch (std::invalid_argument &e){
-            std::stringstream ss;
-            ss << "Error: \"" << _target << "\" is not a valid UART port. Must be a number.";
-            throw std::runtime_error(ss.str());
-        }
+    std::string UartConnection::invalid_target_message(const std::string& target) const {
+        std::stringstream ss;
+        ss << "Error: \"" << target << "\" is not a valid UART port. Must be a number.";
+        return ss.str();
+    }
+
+    BusResult UartConnection::write(const char* buf, size_t len){
+        throw_if_invalid_target();
+        return try_write(buf, len);
     }
 
-    void UartConnection::read(__attribute__((unused)) char* buf, __attribute__((unused)) size_t len){
+    BusResult UartConnection::read(__attribute__((unused)) char* buf, __attribute__((unused)) size_t len){
         if(_uart->available() > 0){
             throw std::runtime_error("I haven't implemented this yet.");
         }else{
@@ -234,20 +184,23 @@ namespace Nos3 {
         }
     }
 
-    void UartConnection::transact(__attribute__((unused)) const char* wbuf, __attribute__((unused)) size_t wlen, 
+    BusResult UartConnection::transact(__attribute__((unused)) const char* wbuf, __attribute__((unused)) size_t wlen,
         __attribute__((unused)) char* rbuf, __attribute__((unused)) size_t rlen){
         throw std::runtime_error("Error: Cannot perform transactions on UART bus.");
     }
 
-    BaseConnection::BaseConnection(SimTerminal* terminal, std::string node_name, std::string connection_string, std::string bus_name){
-        _bus.reset(new NosEngine::Client::Bus(connection_string, bus_name));
+    BaseConnection::BaseConnection(std::string node_name, std::string connection_string, std::string bus_name, std::shared_ptr<NosEngine::Transport::TransportHub> hub) :
+        BusConnection(BASE_KIND, hub) {
+        _bus.reset(new NosEngine::Client::Bus(*hub, connection_string, bus_name));
         _node = _bus->get_or_create_data_node(node_name);
-        _terminal = terminal;
         _node->set_message_received_callback([this](NosEngine::Common::Message message) {
-            std::cout << std::endl << "Received a message from " << message.source << ": " << std::endl; 
-            _terminal->write_message_to_cout(message);
+            NOS3_TRACE_SPAN("BASE receive callback");
+            SimTerminal* receiver = _receiver;
+            if (!receiver) return;
+            NosEngine::Common::DataBufferOverlay dbf(message.buffer);
+            receiver->post_receive_event("BASE", message.source, dbf.data, dbf.len);
         });
-        std::cout << "Connected to standard bus." << std::endl;
+        Nos3::sim_logger->info("BaseConnection: connected to standard bus %s", bus_name.c_str());
     }
 
     BaseConnection::~BaseConnection() {
@@ -256,17 +209,25 @@ namespace Nos3 {
         delete old;
     }
 
-    void BaseConnection::write(const char* buf, size_t len){
-        _node->send_non_confirmed_message_async(_target, len, buf);
+    std::string BaseConnection::invalid_target_message(__attribute__((unused)) const std::string& target) const {
+        return "Error: No node selected. To select a node, use SET SIMNODE.";
+    }
+
+    BusResult BaseConnection::write(const char* buf, size_t len){
+        throw_if_invalid_target();
+        return try_write(buf, len);
     }
 
-    void BaseConnection::read(__attribute__((unused)) char* buf, __attribute__((unused)) size_t len){
+    BusResult BaseConnection::read(__attribute__((unused)) char* buf, __attribute__((unused)) size_t len){
         throw std::runtime_error("Error: Cannot read from a normal bus.");
     }
 
-    void BaseConnection::transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen){
+    BusResult BaseConnection::try_transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen, unsigned timeout_ms){
+        if (!_target_valid) return BUS_INVALID_TARGET;
+        NOS3_TRACE_SPAN("BASE transaction");
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
         try{
-            NosEngine::Common::Message msg = _node->send_request_message_blocking(_target, wlen, wbuf, 5000);
+            NosEngine::Common::Message msg = _node->send_request_message_blocking(_target, wlen, wbuf, timeout_ms);
             NosEngine::Common::DataBufferOverlay dbf(msg.buffer);
             if(dbf.len < rlen){
                 std::memcpy(rbuf, dbf.data, dbf.len);
@@ -274,9 +235,21 @@ namespace Nos3 {
             }else{
                 std::memcpy(rbuf, dbf.data, rlen);
             }
+            count(_target, wlen, true);
+            count(_target, dbf.len, false);
         }catch(...){
+            // the node throws both when the request times out and when it fails outright
+            bool expired = std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(timeout_ms);
+            return expired ? BUS_TIMEOUT : BUS_ERROR;
+        }
+        return BUS_SUCCESS;
+    }
+
+    BusResult BaseConnection::transact(const char* wbuf, size_t wlen, char* rbuf, size_t rlen){
+        throw_if_invalid_target();
+        if (try_transact(wbuf, wlen, rbuf, rlen) != BUS_SUCCESS) {
             throw std::runtime_error("Error while sending request message. The transaction may have timed out before a response was received.");
         }
-        
+        return BUS_SUCCESS;
     }
 }
@@ -0,0 +1,34 @@
+#include <bus_result.hpp>
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+
+namespace Nos3 {
+
+    const char* bus_result_as_string(BusResult result){
+        switch (result) {
+        case BUS_SUCCESS: return "Success";
+        case BUS_ERROR: return "Error";
+        case BUS_BUSY: return "Busy";
+        case BUS_TIMEOUT: return "Timeout";
+        case BUS_INVALID_TARGET: return "Invalid target";
+        case BUS_UNSUPPORTED: return "Unsupported";
+        default: return "Unknown";
+        }
+    }
+
+    // A leading zero never means octal; unlike stoi, signs, whitespace and trailing garbage make the whole text invalid
+    bool parse_bus_number(const std::string& text, long min, long max, int& value){
+        bool hex = (text.size() > 2) && (text[0] == '0') && ((text[1] == 'x') || (text[1] == 'X'));
+        const char* digits = text.c_str() + (hex ? 2 : 0);
+        if (!(hex ? isxdigit(static_cast<unsigned char>(digits[0])) : isdigit(static_cast<unsigned char>(digits[0])))) return false;
+        char* end;
+        errno = 0;
+        long parsed = strtol(digits, &end, hex ? 16 : 10);
+        if ((errno != 0) || (*end != '\0') || (parsed < min) || (parsed > max)) return false;
+        value = parsed;
+        return true;
+    }
+
+}
@@ -0,0 +1,321 @@
+#include <can_engine.hpp>
+#include <bus_connections.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+namespace Nos3 {
+
+    CanEngine::CanEngine() : _bitrate(500000), _bits(0)
+    {
+        _isotp.block_size = 0;
+        _isotp.st_min = 0;
+        _isotp.timeout_ms = 1000;
+        _isotp.padding = 0xCC;
+    }
+
+    bool CanEngine::accepts(uint32_t id) const
+    {
+        if (_filters.empty()) return true;
+        for (const Filter& filter : _filters) {
+            if ((id & filter.mask) == (filter.id & filter.mask)) return true;
+        }
+        return false;
+    }
+
+    BusResult CanEngine::write_frame(CANConnection& bus, const CanFrame& frame)
+    {
+        BusResult result = bus.try_write_frame(frame.id, frame.data, frame.len);
+        record(frame.id, &frame, true, result != BUS_SUCCESS);
+        return result;
+    }
+
+    BusResult CanEngine::read_frame(CANConnection& bus, uint32_t id, uint8_t len, CanFrame& frame)
+    {
+        frame.id = id;
+        frame.len = std::min<uint8_t>(len, sizeof(frame.data));
+        return bus.try_read_frame(id, frame.data, frame.len);
+    }
+
+    BusResult CanEngine::send(CANConnection& bus, const CanFrame* frames, size_t count, size_t& sent)
+    {
+        for (sent = 0; sent < count; sent++) {
+            BusResult result = write_frame(bus, frames[sent]);
+            if (result != BUS_SUCCESS) return result;
+        }
+        return BUS_SUCCESS;
+    }
+
+    BusResult CanEngine::receive(CANConnection& bus, uint32_t id, uint8_t len, CanFrame& frame)
+    {
+        BusResult result = read_frame(bus, id, len, frame);
+        record(id, &frame, false, result != BUS_SUCCESS);
+        return result;
+    }
+
+    void CanEngine::separate(uint8_t st_min)
+    {
+        if ((st_min >= 0xF1) && (st_min <= 0xF9)) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100 * (st_min - 0xF0)));
+        } else if (st_min > 0x7F) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(0x7F)); // reserved values mean the maximum
+        } else if (st_min > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(st_min));
+        }
+    }
+
+    BusResult CanEngine::wait_for_flow_control(CANConnection& bus, uint32_t rx_id, uint8_t& block_size, uint8_t& st_min, std::string& error)
+    {
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_isotp.timeout_ms);
+        while (std::chrono::steady_clock::now() < deadline) {
+            CanFrame frame;
+            BusResult result = read_frame(bus, rx_id, 8, frame);
+            if (result != BUS_SUCCESS) {
+                record(rx_id, &frame, false, true);
+                error = "reading flow control failed";
+                return result;
+            }
+            if ((frame.data[0] >> 4) == 3) {
+                record(rx_id, &frame, false, false);
+                switch (frame.data[0] & 0xf) {
+                case 0: // continue to send
+                    block_size = frame.data[1];
+                    st_min = frame.data[2];
+                    return BUS_SUCCESS;
+                case 1: // wait; the receiver gets another timeout period
+                    deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_isotp.timeout_ms);
+                    break;
+                default:
+                    error = "receiver reported overflow";
+                    return BUS_ERROR;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::stringstream ss;
+        ss << "no flow control from 0x" << std::hex << rx_id << " within " << std::dec << _isotp.timeout_ms << " ms";
+        error = ss.str();
+        return BUS_TIMEOUT;
+    }
+
+    BusResult CanEngine::isotp_send(CANConnection& bus, uint32_t tx_id, uint32_t rx_id, const char* data, size_t len, std::string& error)
+    {
+        if (len > 4095) {
+            error = "ISO-TP messages are limited to 4095 bytes";
+            return BUS_ERROR;
+        }
+        CanFrame frame;
+        frame.id = tx_id;
+        frame.len = 8;
+        memset(frame.data, _isotp.padding, sizeof(frame.data));
+        if (len <= 7) { // single frame
+            frame.data[0] = len;
+            memcpy(frame.data + 1, data, len);
+            return write_frame(bus, frame);
+        }
+
+        frame.data[0] = 0x10 | (len >> 8); // first frame
+        frame.data[1] = len & 0xff;
+        memcpy(frame.data + 2, data, 6);
+        BusResult result = write_frame(bus, frame);
+        if (result != BUS_SUCCESS) return result;
+
+        uint8_t block_size, st_min;
+        result = wait_for_flow_control(bus, rx_id, block_size, st_min, error);
+        size_t offset = 6;
+        uint8_t sequence = 1;
+        unsigned in_block = 0;
+        while ((result == BUS_SUCCESS) && (offset < len)) {
+            if ((block_size != 0) && (in_block == block_size)) {
+                result = wait_for_flow_control(bus, rx_id, block_size, st_min, error);
+                if (result != BUS_SUCCESS) break;
+                in_block = 0;
+            }
+            separate(st_min);
+            size_t n = std::min<size_t>(7, len - offset);
+            frame.data[0] = 0x20 | sequence; // consecutive frame
+            memset(frame.data + 1, _isotp.padding, 7);
+            memcpy(frame.data + 1, data + offset, n);
+            result = write_frame(bus, frame);
+            offset += n;
+            sequence = (sequence + 1) & 0xf;
+            in_block++;
+        }
+        return result;
+    }
+
+    BusResult CanEngine::isotp_receive(CANConnection& bus, uint32_t tx_id, uint32_t rx_id, std::vector<char>& data, std::string& error)
+    {
+        data.clear();
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_isotp.timeout_ms);
+        CanFrame frame;
+        uint8_t pci = 0xf;
+        while (std::chrono::steady_clock::now() < deadline) {
+            BusResult result = read_frame(bus, rx_id, 8, frame);
+            if (result != BUS_SUCCESS) {
+                record(rx_id, &frame, false, true);
+                return result;
+            }
+            pci = frame.data[0] >> 4;
+            if ((pci == 0) || (pci == 1)) {
+                record(rx_id, &frame, false, false);
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (pci == 0) { // single frame
+            size_t len = std::min<size_t>(frame.data[0] & 0xf, 7);
+            data.assign(frame.data + 1, frame.data + 1 + len);
+            return BUS_SUCCESS;
+        }
+        if (pci != 1) {
+            error = "no single or first frame received";
+            return BUS_TIMEOUT;
+        }
+
+        size_t total = ((frame.data[0] & 0xf) << 8) | frame.data[1];
+        data.assign(frame.data + 2, frame.data + 2 + std::min<size_t>(6, total));
+        CanFrame flow_control;
+        flow_control.id = tx_id;
+        flow_control.len = 8;
+        memset(flow_control.data, _isotp.padding, sizeof(flow_control.data));
+        flow_control.data[0] = 0x30;
+        flow_control.data[1] = _isotp.block_size;
+        flow_control.data[2] = _isotp.st_min;
+        BusResult result = write_frame(bus, flow_control);
+
+        uint8_t sequence = 1;
+        unsigned in_block = 0;
+        while ((result == BUS_SUCCESS) && (data.size() < total)) {
+            deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_isotp.timeout_ms);
+            pci = 0xf;
+            while (std::chrono::steady_clock::now() < deadline) {
+                result = read_frame(bus, rx_id, 8, frame);
+                if (result != BUS_SUCCESS) {
+                    record(rx_id, &frame, false, true);
+                    return result;
+                }
+                pci = frame.data[0] >> 4;
+                if (pci == 2) {
+                    record(rx_id, &frame, false, false);
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            if (pci != 2) {
+                error = "timed out waiting for a consecutive frame";
+                return BUS_TIMEOUT;
+            }
+            if ((frame.data[0] & 0xf) != sequence) {
+                std::stringstream ss;
+                ss << "expected sequence number " << unsigned(sequence) << ", received " << unsigned(frame.data[0] & 0xf);
+                error = ss.str();
+                return BUS_ERROR;
+            }
+            size_t n = std::min<size_t>(7, total - data.size());
+            data.insert(data.end(), frame.data + 1, frame.data + 1 + n);
+            sequence = (sequence + 1) & 0xf;
+            if ((_isotp.block_size != 0) && (++in_block == _isotp.block_size) && (data.size() < total)) {
+                result = write_frame(bus, flow_control);
+                in_block = 0;
+            }
+        }
+        return result;
+    }
+
+    void CanEngine::record(uint32_t id, const CanFrame* frame, bool tx, bool failed)
+    {
+        IdStats& stats = _stats[id];
+        if (failed) {
+            stats.errors++;
+            return;
+        }
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (stats.last_frame != std::chrono::steady_clock::time_point()) {
+            double gap = std::chrono::duration<double, std::micro>(now - stats.last_frame).count();
+            if ((stats.gaps == 0) || (gap < stats.gap_min_us)) stats.gap_min_us = gap;
+            if (gap > stats.gap_max_us) stats.gap_max_us = gap;
+            stats.gap_total_us += gap;
+            stats.gaps++;
+        }
+        stats.last_frame = now;
+        if (tx) {
+            stats.tx_frames++;
+            stats.tx_bytes += frame->len;
+        } else {
+            stats.rx_frames++;
+            stats.rx_bytes += frame->len;
+        }
+        if (_bits == 0) _first_frame = now;
+        _last_frame = now;
+        _bits += frame_bits(*frame);
+    }
+
+    void CanEngine::reset_stats(void)
+    {
+        _stats.clear();
+        _bits = 0;
+    }
+
+    std::string CanEngine::stats_as_string(void) const
+    {
+        std::stringstream ss;
+        uint64_t frames = 0;
+        for (std::map<uint32_t, IdStats>::const_iterator it = _stats.begin(); it != _stats.end(); it++) {
+            frames += it->second.tx_frames + it->second.rx_frames;
+        }
+        double seconds = std::chrono::duration<double>(_last_frame - _first_frame).count();
+        ss << "CAN: " << frames << " frames, " << _bits << " bits";
+        if ((_bits > 0) && (seconds > 0)) {
+            ss << " in " << seconds << " s: " << (frames / seconds) << " frames/s, "
+               << (100.0 * _bits / (seconds * _bitrate)) << "% of " << _bitrate << " bit/s (nominal, without stuff bits)";
+        }
+        ss << std::endl;
+        for (std::map<uint32_t, IdStats>::const_iterator it = _stats.begin(); it != _stats.end(); it++) {
+            const IdStats& stats = it->second;
+            ss << "    0x" << std::hex << std::uppercase << it->first << std::dec << std::nouppercase
+               << ": tx " << stats.tx_frames << " (" << stats.tx_bytes << " bytes), rx " << stats.rx_frames << " (" << stats.rx_bytes
+               << " bytes), errors " << stats.errors;
+            if (stats.gaps > 0) {
+                ss << ", gap avg " << (stats.gap_total_us / stats.gaps) << " us, min " << stats.gap_min_us << " us, max " << stats.gap_max_us << " us";
+            }
+            ss << std::endl;
+        }
+        return ss.str();
+    }
+
+    bool CanEngine::parse_frame(const std::string& text, CanFrame& frame)
+    {
+        size_t hash = text.find('#');
+        if ((hash == std::string::npos) || (hash == 0)) return false;
+        std::string id = text.substr(0, hash);
+        char* end;
+        unsigned long value = strtoul(id.c_str(), &end, 16);
+        if ((*end != '\0') || (value > 0x1FFFFFFF)) return false;
+        frame.id = value;
+
+        std::string hex = text.substr(hash + 1);
+        if ((hex.size() % 2 != 0) || (hex.size() > 16)) return false;
+        frame.len = hex.size() / 2;
+        for (size_t i = 0; i < frame.len; i++) {
+            std::string pair = hex.substr(2 * i, 2);
+            frame.data[i] = strtoul(pair.c_str(), &end, 16);
+            if (*end != '\0') return false;
+        }
+        return true;
+    }
+
+    std::string CanEngine::frame_as_string(const CanFrame& frame)
+    {
+        char buf[32];
+        int n = snprintf(buf, sizeof(buf), (frame.id > 0x7FF) ? "%08X#" : "%03X#", frame.id);
+        for (size_t i = 0; i < frame.len; i++) n += snprintf(buf + n, sizeof(buf) - n, "%02X", frame.data[i]);
+        return std::string(buf, n);
+    }
+
+}
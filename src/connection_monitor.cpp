@@ -0,0 +1,191 @@
+#include <connection_monitor.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <future>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace Nos3 {
+
+    bool probe_endpoint(const std::string& connection_string, int timeout_ms, double& rtt_ms, std::string& error){
+        rtt_ms = -1.0;
+        const std::string scheme = "tcp://";
+        if (connection_string.compare(0, scheme.size(), scheme) != 0) return true;
+
+        std::string hostport = connection_string.substr(scheme.size());
+        size_t colon = hostport.rfind(':');
+        if (colon == std::string::npos) {
+            error = "no port in connection string";
+            return false;
+        }
+        std::string host = hostport.substr(0, colon);
+        std::string port = hostport.substr(colon + 1);
+
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo* addresses = nullptr;
+        int status = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+        if (status != 0) {
+            error = gai_strerror(status);
+            return false;
+        }
+
+        bool reachable = false;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int sockfd = socket(addresses->ai_family, addresses->ai_socktype, addresses->ai_protocol);
+        if (sockfd < 0) {
+            error = strerror(errno);
+        } else {
+            fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+            if ((connect(sockfd, addresses->ai_addr, addresses->ai_addrlen) == 0) || (errno == EINPROGRESS)) {
+                struct pollfd pfd = {sockfd, POLLOUT, 0};
+                int ready = poll(&pfd, 1, timeout_ms);
+                if (ready == 0) {
+                    error = "timed out";
+                } else if (ready < 0) {
+                    error = strerror(errno);
+                } else {
+                    int so_error = 0;
+                    socklen_t len = sizeof(so_error);
+                    getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+                    if (so_error == 0) {
+                        reachable = true;
+                        rtt_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                    } else {
+                        error = strerror(so_error);
+                    }
+                }
+            } else {
+                error = strerror(errno);
+            }
+            close(sockfd);
+        }
+        freeaddrinfo(addresses);
+        return reachable;
+    }
+
+    ConnectionMonitor::ConnectionMonitor(int heartbeat_ms, int probe_timeout_ms, int max_heartbeat_ms) :
+        _heartbeat(heartbeat_ms), _max_heartbeat(std::max(heartbeat_ms, max_heartbeat_ms)), _probe_timeout_ms(probe_timeout_ms),
+        _next_tick(1), _running_tick(0), _stopping(false)
+    {
+    }
+
+    ConnectionMonitor::~ConnectionMonitor()
+    {
+        stop();
+    }
+
+    void ConnectionMonitor::start(void)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_thread.joinable()) _thread = std::thread(&ConnectionMonitor::run, this);
+    }
+
+    unsigned ConnectionMonitor::add_tick(std::function<void(void)> tick)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        unsigned id = _next_tick++;
+        _ticks[id] = tick;
+        return id;
+    }
+
+    void ConnectionMonitor::remove_tick(unsigned id)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        assert(std::this_thread::get_id() != _thread.get_id());
+        _ticks.erase(id);
+        _cv.wait(lock, [this, id]{return _running_tick != id;});
+    }
+
+    void ConnectionMonitor::stop(void)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _cv.notify_all();
+        if (_thread.joinable()) _thread.join();
+    }
+
+    void ConnectionMonitor::watch(const std::string& connection_string)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_endpoints.find(connection_string) == _endpoints.end()) {
+            _endpoints[connection_string] = EndpointStatus();
+            Schedule schedule = {std::chrono::steady_clock::now(), _heartbeat};
+            _schedules[connection_string] = schedule;
+        }
+    }
+
+    ConnectionMonitor::EndpointStatus ConnectionMonitor::status(const std::string& connection_string)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::map<std::string, EndpointStatus>::const_iterator it = _endpoints.find(connection_string);
+        return (it == _endpoints.end()) ? EndpointStatus() : it->second;
+    }
+
+    void ConnectionMonitor::run(void)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_stopping) {
+            std::vector<std::string> connection_strings;
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            for (std::map<std::string, Schedule>::const_iterator it = _schedules.begin(); it != _schedules.end(); it++) {
+                if (now >= it->second.next_probe) connection_strings.push_back(it->first);
+            }
+            if (connection_strings.size() > 0) {
+                lock.unlock();
+                // probe concurrently so one unreachable host costs one timeout per round, not one per endpoint
+                std::vector<std::future<EndpointStatus>> probes;
+                for (const std::string& connection_string : connection_strings) {
+                    probes.push_back(std::async(std::launch::async, [this, connection_string]() {
+                        EndpointStatus status;
+                        status.probed = true;
+                        status.reachable = probe_endpoint(connection_string, _probe_timeout_ms, status.rtt_ms, status.error);
+                        status.last_probe = std::chrono::steady_clock::now();
+                        return status;
+                    }));
+                }
+                std::vector<EndpointStatus> statuses;
+                for (std::future<EndpointStatus>& probe : probes) statuses.push_back(probe.get());
+                lock.lock();
+                for (size_t i = 0; i < statuses.size(); i++) {
+                    EndpointStatus& status = _endpoints[connection_strings[i]];
+                    Schedule& schedule = _schedules[connection_strings[i]];
+                    bool settled = status.probed && (status.reachable == statuses[i].reachable);
+                    schedule.period = settled ? std::min(schedule.period * 2, _max_heartbeat) : _heartbeat;
+                    schedule.next_probe = statuses[i].last_probe + schedule.period;
+                    status = statuses[i];
+                }
+            }
+
+            // one tick at a time, looked up afresh each step, so that a tick removed during the round is not called and
+            // remove_tick waits for nothing but its own tick
+            std::map<unsigned, std::function<void(void)>>::const_iterator it = _ticks.begin();
+            while (it != _ticks.end()) {
+                unsigned id = it->first;
+                std::function<void(void)> tick = it->second;
+                _running_tick = id;
+                lock.unlock();
+                tick();
+                lock.lock();
+                _running_tick = 0;
+                _cv.notify_all();
+                it = _ticks.upper_bound(id);
+            }
+            _cv.wait_for(lock, std::chrono::milliseconds(100), [this]{return _stopping;});
+        }
+    }
+
+}
@@ -0,0 +1,173 @@
+#include <correlator.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+namespace Nos3 {
+
+    Correlator::Correlator() : _enabled(false), _timeout(5000)
+    {
+        _matcher.by = ORDER;
+        _matcher.request_offset = 0;
+        _matcher.response_offset = 0;
+        _matcher.width = 1;
+    }
+
+    void Correlator::enable(const Matcher& matcher, std::chrono::milliseconds timeout)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _matcher = matcher;
+        _timeout = timeout;
+        for (std::map<std::string, Node>::iterator it = _nodes.begin(); it != _nodes.end(); it++) it->second.pending.clear();
+        _enabled = true;
+    }
+
+    void Correlator::reset(void)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _nodes.clear();
+    }
+
+    bool Correlator::key(const char* data, size_t len, size_t offset, uint32_t& key) const
+    {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+        switch (_matcher.by) {
+        case ORDER:
+            key = 0;
+            return true;
+        case CCSDS:
+            if (len < 6) return false; // not a whole primary header
+            key = ((bytes[2] & 0x3f) << 8) | bytes[3];
+            return true;
+        default:
+            if (offset + _matcher.width > len) return false;
+            key = 0;
+            for (size_t i = 0; i < _matcher.width; i++) key = (key << 8) | bytes[offset + i];
+            return true;
+        }
+    }
+
+    void Correlator::expire(Node& node, std::chrono::steady_clock::time_point now)
+    {
+        while (!node.pending.empty() && (now - node.pending.front().sent > _timeout)) {
+            node.pending.pop_front();
+            node.timed_out++;
+        }
+    }
+
+    size_t Correlator::bucket(double us)
+    {
+        size_t b = 0;
+        for (uint64_t v = static_cast<uint64_t>(us); (v > 1) && (b < BUCKETS - 1); v >>= 1) b++;
+        return b;
+    }
+
+    void Correlator::sent(const std::string& node, const char* data, size_t len, std::chrono::steady_clock::time_point when)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Node& n = _nodes[node];
+        n.sent++;
+        expire(n, when);
+        Pending pending;
+        if (!key(data, len, _matcher.request_offset, pending.key)) return; // too short to carry a sequence number
+        pending.sent = when;
+        if (n.pending.size() == _MAX_PENDING) {
+            n.pending.pop_front();
+            n.timed_out++;
+        }
+        n.pending.push_back(pending);
+    }
+
+    void Correlator::withdraw(const std::string& node, std::chrono::steady_clock::time_point when)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::map<std::string, Node>::iterator it = _nodes.find(node);
+        if (it == _nodes.end()) return;
+        Node& n = it->second;
+        if (n.sent > 0) n.sent--;
+        for (std::deque<Pending>::iterator p = n.pending.end(); p != n.pending.begin(); ) {
+            if ((--p)->sent == when) {
+                n.pending.erase(p);
+                return;
+            }
+        }
+    }
+
+    void Correlator::received(const std::string& node, const char* data, size_t len)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::map<std::string, Node>::iterator it = _nodes.find(node);
+        if (it == _nodes.end()) return; // nothing was ever sent there
+        Node& n = it->second;
+        expire(n, now);
+        uint32_t k;
+        std::deque<Pending>::iterator match = n.pending.end();
+        if (key(data, len, _matcher.response_offset, k)) {
+            for (match = n.pending.begin(); (match != n.pending.end()) && (match->key != k); match++);
+        }
+        if (match == n.pending.end()) {
+            n.unmatched++;
+            return;
+        }
+        double us = std::chrono::duration<double, std::micro>(now - match->sent).count();
+        n.pending.erase(match);
+        if ((n.matched == 0) || (us < n.min_us)) n.min_us = us;
+        if ((n.matched == 0) || (us > n.max_us)) n.max_us = us;
+        n.total_us += us;
+        n.matched++;
+        n.buckets[bucket(us)]++;
+    }
+
+    std::string Correlator::report(void)
+    {
+        static const char* names[] = {"ORDER", "OFFSET", "CCSDS"};
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::stringstream ss;
+        ss << "Correlation " << (_enabled ? "by " : "(off) by ") << names[_matcher.by];
+        if (_matcher.by == OFFSET) {
+            ss << " (request offset " << _matcher.request_offset << ", reply offset " << _matcher.response_offset << ", " << _matcher.width << " bytes)";
+        }
+        ss << ", timeout " << _timeout.count() << " ms" << std::endl;
+        if (_nodes.empty()) ss << "Nothing sent yet." << std::endl;
+
+        char line[128];
+        for (std::map<std::string, Node>::iterator it = _nodes.begin(); it != _nodes.end(); it++) {
+            Node& n = it->second;
+            expire(n, now);
+            ss << "  " << it->first << ": sent " << n.sent << ", matched " << n.matched << ", timed out " << n.timed_out
+               << ", unmatched replies " << n.unmatched << ", pending " << n.pending.size() << std::endl;
+            if (n.matched == 0) continue;
+
+            // percentiles are the upper edge of the bucket they fall in
+            const double fractions[] = {0.5, 0.9, 0.99};
+            double percentiles[3] = {0, 0, 0};
+            for (size_t p = 0; p < 3; p++) {
+                uint64_t seen = 0, wanted = static_cast<uint64_t>(fractions[p] * n.matched + 0.5);
+                for (size_t b = 0; b < BUCKETS; b++) {
+                    seen += n.buckets[b];
+                    if (seen >= wanted) {
+                        percentiles[p] = static_cast<double>(2ULL << b);
+                        break;
+                    }
+                }
+            }
+            snprintf(line, sizeof(line), "    latency us: min %.1f, mean %.1f, max %.1f; p50 < %.0f, p90 < %.0f, p99 < %.0f\n",
+                     n.min_us, n.total_us / n.matched, n.max_us, percentiles[0], percentiles[1], percentiles[2]);
+            ss << line;
+            uint64_t largest = 0;
+            for (size_t b = 0; b < BUCKETS; b++) largest = std::max(largest, n.buckets[b]);
+            for (size_t b = 0; b < BUCKETS; b++) {
+                if (n.buckets[b] == 0) continue;
+                snprintf(line, sizeof(line), "    [%10llu, %10llu) us %10llu ", (b == 0) ? 0ULL : (1ULL << b), 2ULL << b,
+                         static_cast<unsigned long long>(n.buckets[b]));
+                ss << line << std::string(1 + 39 * n.buckets[b] / largest, '#') << std::endl;
+            }
+        }
+        return ss.str();
+    }
+
+}
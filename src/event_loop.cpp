@@ -0,0 +1,284 @@
+#include <event_loop.hpp>
+
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <readline/readline.h>
+#include <readline/history.h>
+
+namespace Nos3 {
+
+    static EventLoop* active_loop = nullptr;
+    static std::atomic<int> active_wake_fd(-1);
+    static volatile std::sig_atomic_t interrupt_pending = 0;
+
+    EventLoop::EventLoop(size_t max_pending) : _max_pending(max_pending), _running(false), _console(false), _in_handler(false),
+        _dropped(0), _next_timer(1)
+    {
+        _wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    EventLoop::~EventLoop()
+    {
+        if (_wake_fd >= 0) close(_wake_fd);
+    }
+
+    void EventLoop::run(PromptSource prompt, LineHandler handler)
+    {
+        _prompt = prompt;
+        _handler = handler;
+        active_loop = this;
+        active_wake_fd = _wake_fd;
+        _running = true;
+
+        rl_catch_signals = 0; // Ctrl-C is delivered through interrupt()
+        rl_callback_handler_install(_prompt().c_str(), line_callback);
+        poll_until_stopped(true);
+        rl_callback_handler_remove();
+
+        active_wake_fd = -1;
+        active_loop = nullptr;
+        finish();
+    }
+
+    void EventLoop::run(void)
+    {
+        _running = true;
+        poll_until_stopped(false);
+        finish();
+    }
+
+    void EventLoop::stop(void)
+    {
+        _running = false;
+        wake();
+    }
+
+    void EventLoop::poll_until_stopped(bool console)
+    {
+        std::vector<struct pollfd> fds;
+        std::vector<ReadableCallback> callbacks;
+        const size_t first_watched = console ? 2 : 1;
+        _console = console;
+        while (_running) {
+            int timeout = run_timers();
+            fds.clear();
+            callbacks.clear();
+            struct pollfd wake_fd = {_wake_fd, POLLIN, 0};
+            fds.push_back(wake_fd);
+            if (console) {
+                struct pollfd stdin_fd = {STDIN_FILENO, POLLIN, 0};
+                fds.push_back(stdin_fd);
+            }
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                for (std::map<int, ReadableCallback>::const_iterator it = _watched.begin(); it != _watched.end(); it++) {
+                    struct pollfd watched = {it->first, POLLIN, 0};
+                    fds.push_back(watched);
+                    callbacks.push_back(it->second);
+                }
+            }
+            if (poll(fds.data(), fds.size(), timeout) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (fds[0].revents & POLLIN) {
+                uint64_t count;
+                ssize_t rc = read(_wake_fd, &count, sizeof(count));
+                (void)rc;
+                if (console && interrupt_pending) {
+                    interrupt_pending = 0;
+                    rl_free_line_state();
+                    rl_callback_sigcleanup();
+                    std::cout << "^C" << std::endl;
+                    rl_replace_line("", 0);
+                    rl_on_new_line();
+                    rl_redisplay();
+                }
+                drain_output();
+            }
+            if (console && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+                rl_callback_read_char();
+            }
+            for (size_t i = first_watched; _running && (i < fds.size()); i++) {
+                if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) callbacks[i - first_watched]();
+            }
+        }
+    }
+
+    void EventLoop::finish(void)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _running = false;
+        }
+        drain_output();
+    }
+
+    void EventLoop::line_callback(char* line)
+    {
+        EventLoop* loop = active_loop;
+        if (line == nullptr) { // end of input
+            std::cout << std::endl;
+            rl_callback_handler_remove();
+            loop->_running = false;
+            return;
+        }
+        std::string input(line);
+        if (*line) add_history(line); // don't add blank lines
+        free(line);
+
+        loop->_in_handler = true;
+        bool keep_running = loop->_handler(input);
+        loop->drain_output(); // anything received while the command ran, before the next prompt appears
+        loop->_in_handler = false;
+        if (keep_running) {
+            rl_set_prompt(loop->_prompt().c_str());
+        } else {
+            rl_callback_handler_remove(); // otherwise readline shows one more prompt
+            loop->_running = false;
+        }
+    }
+
+    void EventLoop::print(const std::string& text)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_running) {
+                std::cout << text << std::flush;
+                return;
+            }
+            if (_pending.size() + text.size() > _max_pending) {
+                _dropped += text.size();
+            } else {
+                _pending.append(text);
+            }
+        }
+        wake();
+    }
+
+    unsigned EventLoop::add_timer(std::chrono::milliseconds period, TimerCallback callback)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Timer timer = {period, std::chrono::steady_clock::now() + period, callback};
+        unsigned id = _next_timer++;
+        _timers[id] = timer;
+        wake(); // recompute the poll timeout
+        return id;
+    }
+
+    void EventLoop::cancel_timer(unsigned id)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _timers.erase(id);
+    }
+
+    void EventLoop::watch_fd(int fd, ReadableCallback callback)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _watched[fd] = callback;
+        wake(); // poll again with the new descriptor
+    }
+
+    void EventLoop::unwatch_fd(int fd)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _watched.erase(fd);
+        wake();
+    }
+
+    bool EventLoop::interrupt(void)
+    {
+        int fd = active_wake_fd;
+        if (fd < 0) return false;
+        interrupt_pending = 1;
+        uint64_t one = 1;
+        ssize_t rc = write(fd, &one, sizeof(one));
+        (void)rc;
+        return true;
+    }
+
+    void EventLoop::wake(void)
+    {
+        uint64_t one = 1;
+        ssize_t rc = write(_wake_fd, &one, sizeof(one));
+        (void)rc;
+    }
+
+    int EventLoop::run_timers(void)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::vector<TimerCallback> due;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (std::map<unsigned, Timer>::iterator it = _timers.begin(); it != _timers.end(); it++) {
+                if (it->second.next <= now) {
+                    due.push_back(it->second.callback);
+                    it->second.next += it->second.period;
+                    if (it->second.next <= now) it->second.next = now + it->second.period; // don't try to catch up
+                }
+            }
+        }
+        for (TimerCallback& callback : due) callback();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_timers.empty()) return -1;
+        std::chrono::steady_clock::time_point next = std::chrono::steady_clock::time_point::max();
+        for (std::map<unsigned, Timer>::const_iterator it = _timers.begin(); it != _timers.end(); it++) {
+            next = std::min(next, it->second.next);
+        }
+        now = std::chrono::steady_clock::now();
+        if (next <= now) return 0;
+        return std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+    }
+
+    void EventLoop::drain_output(void)
+    {
+        std::string text;
+        size_t dropped;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            text.swap(_pending);
+            dropped = _dropped;
+            _dropped = 0;
+        }
+        if (dropped > 0) text += "[" + std::to_string(dropped) + " bytes of output dropped]\n";
+        if (text.empty()) return;
+
+        if (_running && _console && !_in_handler) {
+            draw_above_prompt(text);
+        } else {
+            std::cout << text << std::flush;
+        }
+    }
+
+    void EventLoop::draw_above_prompt(const std::string& text)
+    {
+        char* saved_line = rl_copy_text(0, rl_end);
+        int saved_point = rl_point;
+        rl_save_prompt();
+        rl_replace_line("", 0);
+        rl_redisplay();
+
+        std::cout << text;
+        if (text[text.size() - 1] != '\n') std::cout << std::endl;
+        std::cout << std::flush;
+
+        rl_restore_prompt();
+        rl_replace_line(saved_line, 0);
+        rl_point = saved_point;
+        rl_redisplay();
+        free(saved_line);
+    }
+
+}
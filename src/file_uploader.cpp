@@ -0,0 +1,167 @@
+#include <file_uploader.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Nos3 {
+
+    namespace {
+        class MappedFile {
+        public:
+            MappedFile(const std::string& path) : _data(nullptr), _len(0) {
+                int fd = open(path.c_str(), O_RDONLY);
+                if (fd < 0) {
+                    throw std::runtime_error("Error: Could not open upload file \"" + path + "\".");
+                }
+                struct stat st;
+                if (fstat(fd, &st) < 0) {
+                    close(fd);
+                    throw std::runtime_error("Error: Could not stat upload file \"" + path + "\".");
+                }
+                _len = st.st_size;
+                if (_len > 0) {
+                    void* data = mmap(nullptr, _len, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (data == MAP_FAILED) {
+                        close(fd);
+                        throw std::runtime_error("Error: Could not map upload file \"" + path + "\".");
+                    }
+                    madvise(data, _len, MADV_SEQUENTIAL);
+                    _data = static_cast<const uint8_t*>(data);
+                }
+                close(fd);
+            }
+            ~MappedFile() {
+                if (_data != nullptr) munmap(const_cast<uint8_t*>(_data), _len);
+            }
+            const uint8_t* data(void) const {return _data;}
+            size_t len(void) const {return _len;}
+        private:
+            MappedFile(const MappedFile&);
+            MappedFile& operator=(const MappedFile&);
+            const uint8_t* _data;
+            size_t _len;
+        };
+
+        struct Crc32Table {
+            uint32_t entries[256];
+            Crc32Table() {
+                for (uint32_t i = 0; i < 256; i++) {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; k++) c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+                    entries[i] = c;
+                }
+            }
+        };
+    }
+
+    uint32_t FileUploader::crc32(uint32_t crc, const uint8_t* buf, size_t len){
+        static const Crc32Table table;
+        crc = ~crc;
+        for (size_t i = 0; i < len; i++) crc = table.entries[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    // Waits up to wait_ms for an acknowledgement, or not at all if it is 0; a timed out acknowledgement is returned
+    template <typename Connection>
+    BusResult FileUploader::send_chunk(Connection& bus, const char* chunk, size_t len, unsigned wait_ms, size_t offset){
+        char ack;
+        BusResult result = (wait_ms > 0) ? bus.try_transact(chunk, len, &ack, 0, wait_ms) : bus.try_write(chunk, len);
+        if ((result != BUS_SUCCESS) && !((wait_ms > 0) && (result == BUS_TIMEOUT))) {
+            std::stringstream ss;
+            ss << "Error: Upload failed writing " << len << " bytes at offset " << offset << ": " << bus_result_as_string(result) << ".";
+            throw std::runtime_error(ss.str());
+        }
+        return result;
+    }
+
+    template <typename Connection>
+    BusResult FileUploader::read_verify(Connection& bus, const std::string& request, uint8_t* readback, size_t len, unsigned timeout_ms){
+        return bus.try_transact(request.data(), request.size(), reinterpret_cast<char*>(readback), len, timeout_ms);
+    }
+
+    FileUploader::Result FileUploader::upload(const std::string& path, const Options& options, std::function<bool(void)> cancelled){
+        MappedFile file(path);
+        Result result = Result();
+
+        size_t chunk_size = _bus.max_chunk_size();
+        if ((options.chunk_size > 0) && (options.chunk_size < chunk_size)) chunk_size = options.chunk_size;
+        size_t window = _bus.asynchronous_writes() ? options.window : 0;
+        if (!_bus.target_valid()) {
+            throw std::runtime_error(_bus.invalid_target_message(_bus.target()));
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point last_report = start;
+        const uint8_t* data = file.data();
+        for (size_t offset = 0; offset < file.len(); offset += chunk_size) {
+            if (cancelled()) {
+                result.cancelled = true;
+                break;
+            }
+            size_t len = std::min(chunk_size, file.len() - offset);
+            const char* chunk = reinterpret_cast<const char*>(data + offset);
+            result.chunks++;
+            unsigned wait_ms = ((window > 0) && ((result.chunks % window) == 0)) ? std::max(1u, options.ack_timeout_ms) : 0;
+            BusResult sent = visit_bus_connection(_bus, [&](auto& connection) {return send_chunk(connection, chunk, len, wait_ms, offset);});
+            if (sent == BUS_TIMEOUT) {
+                // the chunk was sent; only its acknowledgement is missing
+                result.unacknowledged = true;
+                window = 0;
+            }
+            result.crc = crc32(result.crc, data + offset, len);
+            result.bytes += len;
+
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (now - last_report >= std::chrono::seconds(1)) {
+                double seconds = std::chrono::duration<double>(now - start).count();
+                _progress << "Uploaded " << result.bytes << "/" << file.len() << " bytes ("
+                          << (100 * result.bytes / file.len()) << "%), "
+                          << std::fixed << std::setprecision(1) << (result.bytes / seconds / 1024.0) << " KiB/s" << std::endl;
+                _progress.unsetf(std::ios::floatfield);
+                last_report = now;
+            }
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if ((options.verify_request.size() > 0) && !result.cancelled && cancelled()) {
+            result.cancelled = true;
+        } else if ((options.verify_request.size() > 0) && !result.cancelled) {
+            uint8_t readback[4];
+            unsigned timeout_ms = std::max(1u, options.verify_timeout_ms);
+            result.verified = true;
+            result.verify_result = visit_bus_connection(_bus, [&](auto& connection) {
+                return read_verify(connection, options.verify_request, readback, sizeof(readback), timeout_ms);
+            });
+            if (result.verify_result == BUS_SUCCESS) {
+                result.readback_crc = (uint32_t(readback[0]) << 24) | (uint32_t(readback[1]) << 16) | (uint32_t(readback[2]) << 8) | readback[3];
+                result.verify_passed = (result.readback_crc == result.crc);
+            }
+        }
+        return result;
+    }
+
+    std::string FileUploader::result_as_string(const Result& result){
+        std::stringstream ss;
+        if (result.cancelled) ss << "Cancelled. ";
+        ss << "Uploaded " << result.bytes << " bytes in " << result.chunks << " chunks in " << result.seconds << " s";
+        if (result.seconds > 0) ss << " (" << (result.bytes / result.seconds / 1024.0) << " KiB/s)";
+        ss << ", CRC-32 0x" << std::hex << std::uppercase << std::setw(8) << std::setfill('0') << result.crc << "." << std::endl;
+        if (result.unacknowledged) ss << "The target did not acknowledge chunks, so the rest were sent without waiting." << std::endl;
+        if (result.verified && (result.verify_result != BUS_SUCCESS)) {
+            ss << "Verify read failed: " << bus_result_as_string(result.verify_result) << "." << std::endl;
+        } else if (result.verified) {
+            ss << "Readback CRC-32 0x" << std::setw(8) << result.readback_crc
+               << (result.verify_passed ? " matches." : " DOES NOT MATCH.") << std::endl;
+        }
+        return ss.str();
+    }
+
+}
@@ -0,0 +1,98 @@
+#include <macro_library.hpp>
+
+#include <cctype>
+#include <stdexcept>
+
+namespace Nos3 {
+
+    bool MacroLibrary::valid_name(const std::string& name){
+        if (name.empty()) return false;
+        for (char c : name) {
+            if (!isalnum(static_cast<unsigned char>(c)) && (c != '_')) return false;
+        }
+        return true;
+    }
+
+    void MacroLibrary::begin(const std::string& name, const std::vector<std::string>& params){
+        if (!valid_name(name)) {
+            throw std::runtime_error("Error: \"" + name + "\" is not a valid macro name. Use letters, digits and underscores.");
+        }
+        for (size_t i = 0; i < params.size(); i++) {
+            if (!valid_name(params[i])) {
+                throw std::runtime_error("Error: \"" + params[i] + "\" is not a valid parameter name. Use letters, digits and underscores.");
+            }
+            for (size_t j = 0; j < i; j++) {
+                if (params[i].compare(params[j]) == 0) throw std::runtime_error("Error: Parameter \"" + params[i] + "\" is given twice.");
+            }
+        }
+        _name = name;
+        _pending.params = params;
+        _pending.lines.clear();
+        _recording = true;
+    }
+
+    void MacroLibrary::record(const std::string& line){
+        _pending.lines.push_back(line);
+    }
+
+    const MacroLibrary::Macro& MacroLibrary::end(void){
+        _recording = false;
+        Macro& macro = _macros[_name];
+        macro = _pending;
+        _pending.lines.clear();
+        return macro;
+    }
+
+    const MacroLibrary::Macro* MacroLibrary::find(const std::string& name) const {
+        std::map<std::string, Macro>::const_iterator it = _macros.find(name);
+        return (it == _macros.end()) ? nullptr : &it->second;
+    }
+
+    bool MacroLibrary::remove(const std::string& name){
+        return _macros.erase(name) > 0;
+    }
+
+    std::vector<std::string> MacroLibrary::expand(const std::string& name, const std::map<std::string, std::string>& values) const {
+        const Macro* macro = find(name);
+        if (!macro) {
+            throw std::runtime_error("Error: No macro named \"" + name + "\". Define one with MACRO DEFINE.");
+        }
+        for (std::map<std::string, std::string>::const_iterator it = values.begin(); it != values.end(); it++) {
+            bool known = false;
+            for (const std::string& param : macro->params) known = known || (param.compare(it->first) == 0);
+            if (!known) throw std::runtime_error("Error: Macro \"" + name + "\" has no parameter \"" + it->first + "\".");
+        }
+
+        std::vector<std::string> lines;
+        for (const std::string& line : macro->lines) {
+            std::string out;
+            size_t i = 0;
+            while (i < line.size()) {
+                if (line[i] != '$') {
+                    out.push_back(line[i++]);
+                    continue;
+                }
+                bool braced = (i + 1 < line.size()) && (line[i + 1] == '{');
+                size_t start = i + (braced ? 2 : 1), end = start;
+                while ((end < line.size()) && (isalnum(static_cast<unsigned char>(line[end])) || (line[end] == '_'))) end++;
+                if ((end == start) || (braced && ((end == line.size()) || (line[end] != '}')))) {
+                    out.push_back(line[i++]); // a lone $ is kept as it is
+                    continue;
+                }
+                std::string param = line.substr(start, end - start);
+                std::map<std::string, std::string>::const_iterator value = values.find(param);
+                if (value == values.end()) {
+                    bool declared = false;
+                    for (const std::string& p : macro->params) declared = declared || (p.compare(param) == 0);
+                    if (declared) throw std::runtime_error("Error: RUN " + name + " needs a value for " + param + " (" + param + "=<value>).");
+                    throw std::runtime_error("Error: Macro \"" + name + "\" uses $" + param + ", which is not one of its parameters.");
+                }
+                out += value->second;
+                i = end + (braced ? 1 : 0);
+            }
+            lines.push_back(out);
+        }
+        return lines;
+    }
+
+}
@@ -0,0 +1,88 @@
+#include <payload_library.hpp>
+
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace Nos3 {
+
+    char* PayloadLibrary::allocate(size_t len){
+        if (len > _BLOCK_SIZE) {
+            // large payloads get a block of their own, slotted in ahead of the partially used current block
+            std::unique_ptr<char[]> block(new char[len]);
+            char* data = block.get();
+            _blocks.insert(_blocks.empty() ? _blocks.end() : _blocks.end() - 1, std::move(block));
+            return data;
+        }
+        if (_BLOCK_SIZE - _block_used < len) {
+            _blocks.emplace_back(new char[_BLOCK_SIZE]);
+            _block_used = 0;
+        }
+        char* data = _blocks.back().get() + _block_used;
+        _block_used += len;
+        return data;
+    }
+
+    const PayloadLibrary::Payload& PayloadLibrary::define(const std::string& name, const char* data, size_t len){
+        if (len == 0) {
+            throw std::runtime_error("Error: Payload \"" + name + "\" is empty.");
+        }
+        Payload payload;
+        char* storage = allocate(len);
+        std::memcpy(storage, data, len);
+        payload.data = storage;
+        payload.len = len;
+        return _payloads[name] = payload;
+    }
+
+    const PayloadLibrary::Payload& PayloadLibrary::load(const std::string& name, const std::string& path, bool hex){
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Error: Could not open payload file \"" + path + "\".");
+        }
+        std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (hex) contents = decode_hex(contents);
+        return define(name, contents.data(), contents.size());
+    }
+
+    const PayloadLibrary::Payload* PayloadLibrary::find(const std::string& name) const {
+        std::map<std::string, Payload>::const_iterator it = _payloads.find(name);
+        return (it == _payloads.end()) ? nullptr : &it->second;
+    }
+
+    void PayloadLibrary::clear(void){
+        _payloads.clear();
+        _blocks.clear();
+        _block_used = _BLOCK_SIZE;
+    }
+
+    std::string PayloadLibrary::unescape(const std::string& data){
+        return (data.compare(0, 2, "@@") == 0) ? data.substr(1) : data;
+    }
+
+    // Whitespace is ignored so that hex dumps split across lines can be loaded as they are
+    std::string PayloadLibrary::decode_hex(const std::string& in){
+        std::string out;
+        out.reserve(in.size() / 2);
+        int upper = -1;
+        for (char c : in) {
+            if (isspace(static_cast<unsigned char>(c))) continue;
+            int nibble;
+            if (('0' <= c) && (c <= '9')) nibble = c - '0';
+            else if (('A' <= c) && (c <= 'F')) nibble = c - 'A' + 10;
+            else if (('a' <= c) && (c <= 'f')) nibble = c - 'a' + 10;
+            else throw std::runtime_error(std::string("Error: '") + c + "' is not a hex digit.");
+            if (upper < 0) {
+                upper = nibble;
+            } else {
+                out.push_back(static_cast<char>((upper << 4) | nibble));
+                upper = -1;
+            }
+        }
+        if (upper >= 0) out.push_back(static_cast<char>(upper << 4)); // odd digit count pads with 0, like WRITE does
+        return out;
+    }
+
+}
@@ -0,0 +1,189 @@
+#include <register_map.hpp>
+#include <bus_connections.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace Nos3 {
+
+    void RegisterMap::load(const std::string& path){
+        std::ifstream in(path);
+        if (!in) {
+            throw std::runtime_error("Error: Could not open register map file \"" + path + "\".");
+        }
+        std::map<int, Register> registers;
+        std::string line;
+        uint32_t line_number = 0;
+        while (std::getline(in, line)) {
+            line_number++;
+            std::stringstream tokenizer(line);
+            std::string device, reg, name, flag;
+            tokenizer >> device;
+            if ((device.size() == 0) || (device[0] == '#')) continue;
+            tokenizer >> reg >> name >> flag;
+
+            int d, r;
+            if (!parse_bus_number(device, 0, 127, d) || !parse_bus_number(reg, 0, 255, r) || (name.size() == 0) ||
+                ((flag.size() > 0) && (flag.compare("STATIC") != 0) && (flag[0] != '#'))) {
+                std::stringstream ss;
+                ss << "Error: line " << line_number << " of " << path << ": expected <device address> <register> <name> [STATIC].";
+                throw std::runtime_error(ss.str());
+            }
+            Register entry = {name, flag.compare("STATIC") == 0};
+            registers[key(d, r)] = entry;
+        }
+        _registers.swap(registers);
+        _shadow.clear();
+    }
+
+    const RegisterMap::Register* RegisterMap::find(int device, int reg) const {
+        std::map<int, Register>::const_iterator it = _registers.find(key(device, reg));
+        return (it == _registers.end()) ? nullptr : &it->second;
+    }
+
+    void RegisterMap::check_range(unsigned long device, unsigned long start, size_t count){
+        if (device > 127) {
+            throw std::runtime_error("Error: Device address must be 0 to 127.");
+        }
+        if ((start > 255) || (count == 0) || (count > 256 - start)) {
+            throw std::runtime_error("Error: Registers must be in the range 0 to 255.");
+        }
+    }
+
+    BusResult RegisterMap::read(I2CConnection& bus, int device, int start, size_t count, uint8_t* values, bool use_cache, unsigned& transactions){
+        transactions = 0;
+        // Only cached registers at the ends are skipped; a cached register in the middle costs a byte, a split costs
+        // another round trip
+        size_t first = 0, last = count;
+        if (use_cache && _cache_enabled) {
+            std::map<int, uint8_t>::const_iterator it;
+            while ((first < last) && ((it = _shadow.find(key(device, start + first))) != _shadow.end())) values[first++] = it->second;
+            while ((last > first) && ((it = _shadow.find(key(device, start + last - 1))) != _shadow.end())) values[--last] = it->second;
+        }
+
+        size_t chunk = bus.max_chunk_size();
+        for (size_t offset = first; offset < last; offset += chunk) {
+            uint8_t reg = start + offset;
+            BusResult result = bus.try_transact_device(device, &reg, 1, values + offset, std::min(chunk, last - offset));
+            transactions++;
+            if (result != BUS_SUCCESS) return result;
+        }
+
+        if (_cache_enabled) {
+            for (size_t i = first; i < last; i++) {
+                const Register* r = find(device, start + i);
+                if ((r != nullptr) && r->is_static) _shadow[key(device, start + i)] = values[i];
+            }
+        }
+        return BUS_SUCCESS;
+    }
+
+    BusResult RegisterMap::write(I2CConnection& bus, int device, int start, const uint8_t* values, size_t count){
+        std::vector<uint8_t> buf(count + 1);
+        buf[0] = start;
+        std::copy(values, values + count, buf.begin() + 1);
+        for (size_t i = 0; i < count; i++) _shadow.erase(key(device, start + i));
+        return bus.try_write_device(device, buf.data(), buf.size());
+    }
+
+    RegisterWatcher::RegisterWatcher(Reader reader, Reporter reporter) :
+        _reader(reader), _reporter(reporter), _next_id(1), _stopping(false)
+    {
+    }
+
+    RegisterWatcher::~RegisterWatcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _cv.notify_all();
+        if (_thread.joinable()) _thread.join();
+    }
+
+    unsigned RegisterWatcher::add(const Watch& watch, const std::vector<uint8_t>& initial)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Entry entry = {watch, initial, std::chrono::steady_clock::now() + watch.period, false};
+        unsigned id = _next_id++;
+        _entries[id] = entry;
+        if (!_thread.joinable()) _thread = std::thread(&RegisterWatcher::run, this); // started on first use
+        _cv.notify_all();
+        return id;
+    }
+
+    bool RegisterWatcher::remove(unsigned id)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _entries.erase(id) > 0;
+    }
+
+    void RegisterWatcher::clear(void)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _entries.clear();
+    }
+
+    std::map<unsigned, RegisterWatcher::Watch> RegisterWatcher::watches(void)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::map<unsigned, Watch> watches;
+        for (std::map<unsigned, Entry>::const_iterator it = _entries.begin(); it != _entries.end(); it++) watches[it->first] = it->second.watch;
+        return watches;
+    }
+
+    void RegisterWatcher::run(void)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_stopping) {
+            if (_entries.empty()) {
+                _cv.wait(lock);
+                continue;
+            }
+            std::map<unsigned, Entry>::iterator due = _entries.begin();
+            for (std::map<unsigned, Entry>::iterator it = _entries.begin(); it != _entries.end(); it++) {
+                if (it->second.next < due->second.next) due = it;
+            }
+            if (std::chrono::steady_clock::now() < due->second.next) {
+                _cv.wait_until(lock, due->second.next);
+                continue;
+            }
+
+            unsigned id = due->first;
+            Watch watch = due->second.watch;
+            std::vector<uint8_t> values(watch.count);
+            lock.unlock();
+            BusResult result = _reader(watch.device, watch.start, watch.count, values.data());
+            lock.lock();
+
+            std::map<unsigned, Entry>::iterator it = _entries.find(id);
+            if (it == _entries.end()) continue; // removed while reading
+            Entry& entry = it->second;
+            entry.next = std::chrono::steady_clock::now() + watch.period;
+            std::vector<Change> changes;
+            bool report = false;
+            if (result == BUS_SUCCESS) {
+                for (size_t i = 0; i < watch.count; i++) {
+                    if (values[i] != entry.values[i]) {
+                        Change change = {static_cast<int>(watch.start + i), entry.values[i], values[i]};
+                        changes.push_back(change);
+                    }
+                }
+                entry.values.swap(values);
+                entry.failing = false;
+                report = !changes.empty();
+            } else {
+                report = !entry.failing;
+                entry.failing = true;
+            }
+            if (report) {
+                lock.unlock();
+                _reporter(id, watch, changes, result);
+                lock.lock();
+            }
+        }
+    }
+
+}
@@ -0,0 +1,189 @@
+#include <response_encoder.hpp>
+
+#include <cstring>
+
+namespace Nos3 {
+
+    namespace {
+
+        void append_u64(std::string& out, uint64_t value)
+        {
+            char digits[20];
+            size_t n = 0;
+            do {
+                digits[n++] = '0' + (value % 10);
+                value /= 10;
+            } while (value > 0);
+            while (n > 0) out.push_back(digits[--n]);
+        }
+
+        void append_base64(std::string& out, const char* data, size_t len)
+        {
+            static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+            const uint8_t* in = reinterpret_cast<const uint8_t*>(data);
+            size_t start = out.size();
+            out.resize(start + 4 * ((len + 2) / 3));
+            char* p = &out[start];
+            size_t i = 0;
+            for (; i + 2 < len; i += 3) {
+                uint32_t v = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+                *p++ = alphabet[(v >> 18) & 0x3f];
+                *p++ = alphabet[(v >> 12) & 0x3f];
+                *p++ = alphabet[(v >> 6) & 0x3f];
+                *p++ = alphabet[v & 0x3f];
+            }
+            if (i < len) {
+                uint32_t v = in[i] << 16;
+                if (i + 1 < len) v |= in[i + 1] << 8;
+                *p++ = alphabet[(v >> 18) & 0x3f];
+                *p++ = alphabet[(v >> 12) & 0x3f];
+                *p++ = (i + 1 < len) ? alphabet[(v >> 6) & 0x3f] : '=';
+                *p++ = '=';
+            }
+        }
+
+        void append_json_string(std::string& out, const char* data, size_t len)
+        {
+            static const char hex[] = "0123456789abcdef";
+            out.push_back('"');
+            for (size_t i = 0; i < len; i++) {
+                unsigned char c = data[i];
+                switch (c) {
+                case '"': out.append("\\\"", 2); break;
+                case '\\': out.append("\\\\", 2); break;
+                case '\n': out.append("\\n", 2); break;
+                case '\r': out.append("\\r", 2); break;
+                case '\t': out.append("\\t", 2); break;
+                default:
+                    if (c < 0x20) {
+                        out.append("\\u00", 4);
+                        out.push_back(hex[c >> 4]);
+                        out.push_back(hex[c & 0xf]);
+                    } else {
+                        out.push_back(c);
+                    }
+                }
+            }
+            out.push_back('"');
+        }
+
+        void append_le(std::string& out, uint64_t value, size_t bytes)
+        {
+            for (size_t i = 0; i < bytes; i++) out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+
+    }
+
+    const char* ResponseEncoder::result_name(BusResult result)
+    {
+        switch (result) {
+        case BUS_SUCCESS: return "SUCCESS";
+        case BUS_ERROR: return "ERROR";
+        case BUS_BUSY: return "BUSY";
+        case BUS_TIMEOUT: return "TIMEOUT";
+        case BUS_INVALID_TARGET: return "INVALID_TARGET";
+        case BUS_UNSUPPORTED: return "UNSUPPORTED";
+        default: return "UNKNOWN";
+        }
+    }
+
+    void ResponseEncoder::encode_response(Format format, const Response& response, std::string& out)
+    {
+        if (format == BINARY) {
+            out.push_back(1);
+            out.push_back(response.error ? 1 : 0);
+            out.push_back(response.has_result ? static_cast<char>(response.result) : static_cast<char>(0xff));
+            out.push_back(0);
+            append_le(out, response.seq, 4);
+            append_le(out, response.latency_us, 8);
+            append_le(out, response.payload_len, 4);
+            append_le(out, response.message_len, 4);
+            out.append(response.payload, response.payload_len);
+            out.append(response.message, response.message_len);
+        } else if (format == JSONL) {
+            out.append("{\"type\":\"response\",\"seq\":");
+            append_u64(out, response.seq);
+            out.append(response.error ? ",\"status\":\"error\",\"result\":" : ",\"status\":\"ok\",\"result\":");
+            if (response.has_result) {
+                out.push_back('"');
+                out.append(result_name(response.result));
+                out.push_back('"');
+            } else {
+                out.append("null");
+            }
+            out.append(",\"latency_us\":");
+            append_u64(out, response.latency_us);
+            out.append(",\"payload\":\"");
+            append_base64(out, response.payload, response.payload_len);
+            out.append("\",\"message\":");
+            append_json_string(out, response.message, response.message_len);
+            out.append("}\n");
+        } else {
+            out.append(response.message, response.message_len);
+        }
+    }
+
+    void ResponseEncoder::encode_event(Format format, const Event& event, std::string& out)
+    {
+        size_t bus_len = strlen(event.bus);
+        if (format == BINARY) {
+            out.push_back(2);
+            out.push_back(0);
+            append_le(out, bus_len, 2);
+            append_le(out, event.source->size(), 4);
+            append_le(out, event.timestamp_us, 8);
+            append_le(out, event.payload_len, 4);
+            out.append(event.bus, bus_len);
+            out.append(*event.source);
+            out.append(event.payload, event.payload_len);
+        } else if (format == JSONL) {
+            out.append("{\"type\":\"event\",\"source\":");
+            append_json_string(out, event.source->data(), event.source->size());
+            out.append(",\"bus\":");
+            append_json_string(out, event.bus, bus_len);
+            out.append(",\"timestamp_us\":");
+            append_u64(out, event.timestamp_us);
+            out.append(",\"payload\":\"");
+            append_base64(out, event.payload, event.payload_len);
+            out.append("\"}\n");
+        }
+    }
+
+    void ResponseEncoder::encode_watch(Format format, const WatchEvent& event, std::string& out)
+    {
+        bool error = (event.result != BUS_SUCCESS);
+        if (format == BINARY) {
+            out.push_back(3);
+            out.push_back(error ? 1 : 0);
+            out.push_back(static_cast<char>(event.result));
+            out.push_back(static_cast<char>(event.device));
+            append_le(out, event.id, 4);
+            append_le(out, event.timestamp_us, 8);
+            append_le(out, event.change_count, 4);
+            out.append(reinterpret_cast<const char*>(event.changes), 3 * event.change_count);
+        } else if (format == JSONL) {
+            out.append("{\"type\":\"watch\",\"id\":");
+            append_u64(out, event.id);
+            out.append(",\"device\":");
+            append_u64(out, event.device);
+            out.append(",\"timestamp_us\":");
+            append_u64(out, event.timestamp_us);
+            out.append(error ? ",\"status\":\"error\",\"result\":\"" : ",\"status\":\"ok\",\"result\":\"");
+            out.append(result_name(event.result));
+            out.append("\",\"changes\":[");
+            for (size_t i = 0; i < event.change_count; i++) {
+                const uint8_t* change = event.changes + 3 * i;
+                if (i > 0) out.push_back(',');
+                out.push_back('[');
+                append_u64(out, change[0]);
+                out.push_back(',');
+                append_u64(out, change[1]);
+                out.push_back(',');
+                append_u64(out, change[2]);
+                out.push_back(']');
+            }
+            out.append("]}\n");
+        }
+    }
+
+}
@@ -21,14 +21,19 @@
 #include <thread>
 #include <memory>
 #include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
-
-#include <readline/readline.h>
-#include <readline/history.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include <ItcLogger/Logger.hpp>
 #include <Client/Bus.hpp>
@@ -47,6 +52,15 @@
 #include <boost/algorithm/string/find.hpp>
 
 #include <bus_connections.hpp>
+#include <test_vectors.hpp>
+#include <payload_library.hpp>
+#include <file_uploader.hpp>
+#include <connection_monitor.hpp>
+#include <transport_registry.hpp>
+#include <transaction_engine.hpp>
+#include <tracer.hpp>
+#include <event_loop.hpp>
+#include <response_encoder.hpp>
 
 namespace Nos3
 {
@@ -54,9 +68,90 @@ namespace Nos3
 
     ItcLogger::Logger *sim_logger;
 
+    // Ctrl-C goes to the terminal on the console, if any; see handle_sigint
+    std::atomic<SimTerminal*> SimTerminal::_console_terminal(nullptr);
+
+    static void tokenize(const std::string& input, std::vector<std::string>& tokens, std::vector<std::string>& tokens_upper)
+    {
+        std::string input_trimmed = input;
+        boost::trim(input_trimmed);
+        std::stringstream tokenizer(input_trimmed);
+        std::string token;
+        while (tokenizer.good()) {
+            tokenizer >> token;
+            tokens.push_back(token);
+            boost::to_upper(token);
+            tokens_upper.push_back(token);
+        }
+    }
+
+    // The text of a line after its first count tokens
+    static std::string text_after_tokens(const std::string& line, size_t count)
+    {
+        size_t pos = 0;
+        for (size_t i = 0; i < count; i++) {
+            pos = line.find_first_not_of(" \t", pos);
+            pos = (pos == std::string::npos) ? line.size() : line.find_first_of(" \t", pos);
+            if (pos == std::string::npos) pos = line.size();
+        }
+        return boost::trim_copy(line.substr(pos));
+    }
+
+    // One STRESS worker's operations on its own connection, bound statically to the connection's type
+    template <typename Connection>
+    static void run_stress_stream(Connection& bus, StressGenerator& generator, size_t worker, StressTally& tally, const std::atomic<bool>& stop)
+    {
+        StressGenerator::Op op;
+        std::vector<char> rbuf;
+        while (!stop && (generator.remaining() > 0)) {
+            generator.next(op);
+            if (op.gap_us > 0) std::this_thread::sleep_for(std::chrono::duration<double, std::micro>(op.gap_us));
+            if (op.target) bus.set_target(*op.target);
+            rbuf.resize(op.rlen);
+            BusResult result;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::string error;
+            try {
+                switch (op.kind) {
+                case StressGenerator::WRITE:
+                    result = bus.try_write(op.data.data(), op.data.size());
+                    break;
+                case StressGenerator::READ:
+                    result = bus.try_read(rbuf.data(), op.rlen);
+                    break;
+                default:
+                    result = bus.try_transact(op.data.data(), op.data.size(), rbuf.data(), op.rlen);
+                    break;
+                }
+            } catch (std::runtime_error &e) {
+                // as in SimTerminal::write; anything else stops the worker and is reported by the command
+                result = bus.target_valid() ? BUS_UNSUPPORTED : BUS_INVALID_TARGET;
+                error = e.what();
+            }
+            tally.record(worker, op, result, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count(), error);
+        }
+    }
+
+    // Ctrl-C cancels the console terminal's transaction in progress, or else clears the line being typed; without a
+    // console it keeps its default meaning.  Other terminals in the process are only cancelled by their own CANCEL.
+    void SimTerminal::handle_sigint(int signum)
+    {
+        SimTerminal* console = _console_terminal.load();
+        if (console && console->_transaction_in_progress) {
+            console->_interrupted = true;
+        } else if (!EventLoop::interrupt()) {
+            std::signal(signum, SIG_DFL);
+            std::raise(signum);
+        }
+    }
+
 
     // Constructors
-    SimTerminal::SimTerminal(const boost::property_tree::ptree& config) : SimIHardwareModel(config),
+    SimTerminal::SimTerminal(const boost::property_tree::ptree& config) : SimTerminal(config, nullptr)
+    {
+    }
+
+    SimTerminal::SimTerminal(const boost::property_tree::ptree& config, std::shared_ptr<ConnectionMonitor> monitor) : SimIHardwareModel(config),
         _bus_name(config.get("simulator.hardware-model.bus.name", "command")),
         _other_node_name(config.get("simulator.hardware-model.other-node-name", "time")),
         _current_in_mode((config.get("simulator.hardware-model.input-mode", "").compare("HEX") == 0) ? HEX : ASCII),
@@ -64,29 +159,107 @@ namespace Nos3
         _prompt(LONG),
         _terminal_type((config.get("simulator.hardware-model.terminal.type", "STDIO").compare("STDIO") == 0) ? STDIO : UDP),
         _udp_port(config.get("simulator.hardware-model.terminal.udp-port", 5555)),
-        _suppress_output(config.get("simulator.hardware-model.terminal.suppress-output", false))
+        _udp_sockfd(-1),
+        _udp_client_known(false),
+        _udp_printer(0),
+        _cancel_requested(false),
+        _transaction_in_progress(false),
+        _interrupted(false),
+        _suppress_output(config.get("simulator.hardware-model.terminal.suppress-output", false)),
+        _bus_messages(config.get("simulator.hardware-model.terminal.bus-messages", true)),
+        _response_format(ResponseEncoder::TEXT),
+        _response_seq(0),
+        _connection_state(CONNECTING),
+        _connect_generation(0),
+        _connects_running(0),
+        _connect_timeout_ms(config.get("simulator.hardware-model.connection.connect-timeout-ms", 5000)),
+        _reconnect_initial_ms(config.get("simulator.hardware-model.connection.reconnect-initial-ms", 250)),
+        _reconnect_max_ms(config.get("simulator.hardware-model.connection.reconnect-max-ms", 30000)),
+        _command_deadline_ms(config.get("simulator.hardware-model.connection.command-deadline-ms", 10000)),
+        _prewarm(config.get("simulator.hardware-model.prewarm", false)),
+        _lifeline(std::make_shared<Lifeline>()),
+        _monitor(monitor ? monitor : std::make_shared<ConnectionMonitor>(config.get("simulator.hardware-model.connection.heartbeat-ms", 1000),
+                                                                          config.get("simulator.hardware-model.connection.connect-timeout-ms", 5000),
+                                                                          config.get("simulator.hardware-model.connection.max-heartbeat-ms", 16000))),
+        _monitor_tick(0),
+        _macro_depth(0),
+        _subscribers(std::make_shared<const std::vector<Subscriber>>()),
+        _next_subscriber(1),
+        _traffic_timer(0),
+        _register_watcher([this](int device, int start, size_t count, uint8_t* values){return read_watched_registers(device, start, count, values);},
+                          [this](unsigned id, const RegisterWatcher::Watch& watch, const std::vector<RegisterWatcher::Change>& changes, BusResult result){
+                              report_register_changes(id, watch, changes, result);
+                          })
     {
+        _lifeline->terminal = this;
         std::string bus_type = config.get("simulator.hardware-model.bus.type", "command");
         if (!set_bus_type(bus_type)) {
             sim_logger->error("Invalid bus type setting %s.  Setting bus type to COMMAND.", bus_type.c_str());
         }
         _nos_connection_string = config.get("common.nos-connection-string", "tcp://127.0.0.1:12001");
         _command_node_name = config.get("simulator.hardware-model.terminal-node-name", "terminal");
+        std::string response_format = config.get("simulator.hardware-model.terminal.response-format", "TEXT");
+        if (response_format.compare("JSONL") == 0) _response_format = ResponseEncoder::JSONL;
+        else if (response_format.compare("BINARY") == 0) _response_format = ResponseEncoder::BINARY;
 
         _connection_strings["default"] = _nos_connection_string;
 
-        BOOST_FOREACH(const boost::property_tree::ptree::value_type &v, config.get_child("simulator.hardware-model.other-nos-connections")) 
+        if (config.get_child_optional("simulator.hardware-model.other-nos-connections"))
         {
-            std::string name = v.second.get("name", "");
-            std::string connection_string = v.second.get("connection-string", "");
-            if ((name.compare("") != 0) && (name.compare("default") != 0)) {
-                _connection_strings[name] = connection_string;
+            BOOST_FOREACH(const boost::property_tree::ptree::value_type &v, config.get_child("simulator.hardware-model.other-nos-connections")) 
+            {
+                std::string name = v.second.get("name", "");
+                std::string connection_string = v.second.get("connection-string", "");
+                if ((name.compare("") != 0) && (name.compare("default") != 0)) {
+                    _connection_strings[name] = connection_string;
+                }
             }
         }
 
         _active_connection_name = "default";
 
+        if (config.get_child_optional("simulator.hardware-model.payloads"))
+        {
+            BOOST_FOREACH(const boost::property_tree::ptree::value_type &v, config.get_child("simulator.hardware-model.payloads"))
+            {
+                std::string name = v.second.get("name", "");
+                try {
+                    if (v.second.get_child_optional("hex")) {
+                        std::string data = PayloadLibrary::decode_hex(v.second.get("hex", ""));
+                        _payloads.define(name, data.data(), data.size());
+                    } else if (v.second.get_child_optional("ascii")) {
+                        std::string data = v.second.get("ascii", "");
+                        _payloads.define(name, data.data(), data.size());
+                    } else {
+                        _payloads.load(name, v.second.get("file", ""), v.second.get("format", "BINARY").compare("HEX") == 0);
+                    }
+                } catch (std::runtime_error &e) {
+                    sim_logger->error("Could not define payload %s: %s", name.c_str(), e.what());
+                }
+            }
+        }
+
+        std::string register_map = config.get("simulator.hardware-model.registers.map", "");
+        if (register_map.size() > 0) {
+            try {
+                _registers.load(register_map);
+            } catch (std::runtime_error &e) {
+                sim_logger->error("Could not load register map: %s", e.what());
+            }
+        }
+        _registers.set_cache_enabled(config.get("simulator.hardware-model.registers.cache", false));
+
+        for (std::map<std::string, std::string>::const_iterator it = _connection_strings.begin(); it != _connection_strings.end(); it++) {
+            _monitor->watch(it->second);
+            _prewarm_targets.insert(it->second);
+        }
         reset_bus_connection();
+        _monitor_tick = _monitor->add_tick([this]{service_connection();});
+        _monitor->start();
+
+        _transaction_policy.timeout = std::chrono::milliseconds(config.get("simulator.hardware-model.transactions.timeout-ms", 5000));
+        _transaction_policy.retries = config.get("simulator.hardware-model.transactions.retries", 0);
+        _transaction_policy.max_backoff = std::chrono::milliseconds(config.get("simulator.hardware-model.transactions.max-backoff-ms", 100));
 
         if (config.get_child_optional("simulator.hardware-model.startup-commands")) 
         {
@@ -99,11 +272,24 @@ namespace Nos3
         }
     }
 
+    SimTerminal::~SimTerminal()
+    {
+        SimTerminal* self = this;
+        _console_terminal.compare_exchange_strong(self, nullptr);
+        close_udp();
+        _monitor->remove_tick(_monitor_tick);
+        // connect threads still in the bus are left to finish on their own; they find the terminal gone
+        std::lock_guard<std::mutex> lock(_lifeline->mutex);
+        _lifeline->terminal = nullptr;
+    }
+
     /// @name Mutating public worker methods
     //@{
     /// \brief Runs the server, creating the NOS Engine bus and the transports for the simulator and simulator client to connect to.
     void SimTerminal::run(void)
     {
+        // the UDP front end subscribes once its socket is open
+        unsigned printer = (_terminal_type == STDIO) ? subscribe([this](const ReceiveEvent& event){print_receive_event(event);}) : 0;
         try
         {
             // when handle_* returns... it is time to quit
@@ -123,21 +309,10 @@ namespace Nos3
         {
             Nos3::sim_logger->error("SimTerminal::run:  Exception caught!");
         }
+        if (printer != 0) unsubscribe(printer);
     }
     //@}
 
-    void SimTerminal::write_message_to_cout(const char* buf, size_t len){
-        for (unsigned int i = 0; i < len; i++) {
-            if (_current_out_mode == HEX) {
-                std::cout << " 0x" << convert_hexhexchar_to_asciihexchars(buf[i]);
-            } else {
-                std::cout << buf[i];
-            }
-        }
-
-        std::cout << std::endl;
-    }
-
     std::stringstream SimTerminal::write_message_to_stream(const char* buf, size_t len){
         std::stringstream ss;
         for (unsigned int i = 0; i < len; i++) {
@@ -150,73 +325,341 @@ namespace Nos3
         return ss;
     }
 
-    void SimTerminal::write_message_to_cout(const NosEngine::Common::Message& msg)
+    void SimTerminal::post_receive_event(const char* bus, const std::string& source, const char* buf, size_t len)
     {
-        NosEngine::Common::DataBufferOverlay dbf(const_cast<NosEngine::Utility::Buffer&>(msg.buffer));
-        write_message_to_cout(dbf.data, dbf.len);
+        _traffic.record(bus, source, len, false);
+        if (_correlator.enabled()) _correlator.received(source, buf, len);
+        std::shared_ptr<const std::vector<Subscriber>> subscribers = std::atomic_load(&_subscribers);
+        if (subscribers->empty()) return;
+        ReceiveEvent event = {bus, source, ByteSpan(buf, len),
+            static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count())};
+        for (const Subscriber& subscriber : *subscribers) subscriber.callback(event);
     }
 
-    void SimTerminal::handle_udp(void)
+    // The front ends' subscriber
+    void SimTerminal::print_receive_event(const ReceiveEvent& event)
+    {
+        NOS3_TRACE_SPAN("format receive event");
+        thread_local std::string record; // reused, so encoding does not allocate once it has grown
+        record.clear();
+        ResponseEncoder::Format format = _response_format;
+        if (format == ResponseEncoder::TEXT) {
+            std::stringstream ss;
+            ss << std::endl;
+            if (strcmp(event.bus, "UART") == 0) ss << "Received a UART message on bus " << event.source << ": " << std::endl;
+            else ss << "Received a message from " << event.source << ": " << std::endl;
+            ss << write_message_to_stream(event.data.data, event.data.len).str() << std::endl;
+            record = ss.str();
+        } else {
+            ResponseEncoder::Event encoded = {event.bus, &event.source, event.timestamp_us, event.data.data, event.data.len};
+            ResponseEncoder::encode_event(format, encoded, record);
+        }
+        deliver_unsolicited(record);
+    }
+
+    // Output that no command asked for goes to the UDP client in every format, since the UDP front end never runs the
+    // event loop, or else above the prompt
+    void SimTerminal::deliver_unsolicited(const std::string& record)
+    {
+        if (_terminal_type == UDP) {
+            std::lock_guard<std::mutex> lock(_udp_client_mutex);
+            if (_udp_client_known && !_suppress_output) {
+                sendto(_udp_sockfd, record.data(), record.size(), 0, (const struct sockaddr *)&_udp_client, sizeof(_udp_client));
+            }
+            return;
+        }
+        _event_loop.print(record);
+    }
+
+    unsigned SimTerminal::subscribe(ReceiveCallback callback)
+    {
+        std::lock_guard<std::mutex> lock(_subscriber_mutex);
+        std::shared_ptr<std::vector<Subscriber>> subscribers = std::make_shared<std::vector<Subscriber>>(*_subscribers);
+        Subscriber subscriber = {_next_subscriber++, callback};
+        subscribers->push_back(subscriber);
+        std::atomic_store(&_subscribers, std::shared_ptr<const std::vector<Subscriber>>(subscribers));
+        return subscriber.id;
+    }
+
+    void SimTerminal::unsubscribe(unsigned id)
+    {
+        std::lock_guard<std::mutex> lock(_subscriber_mutex);
+        std::shared_ptr<std::vector<Subscriber>> subscribers = std::make_shared<std::vector<Subscriber>>(*_subscribers);
+        subscribers->erase(std::remove_if(subscribers->begin(), subscribers->end(),
+                                          [id](const Subscriber& subscriber){return subscriber.id == id;}), subscribers->end());
+        std::atomic_store(&_subscribers, std::shared_ptr<const std::vector<Subscriber>>(subscribers));
+    }
+
+    void SimTerminal::add_connection(const std::string& name, const std::string& connection_string)
+    {
+        _connection_strings[name] = connection_string;
+        _monitor->watch(connection_string);
+        std::lock_guard<std::mutex> lock(_connection_mutex);
+        _prewarm_targets.insert(connection_string);
+    }
+
+    bool SimTerminal::use_connection(const std::string& name)
+    {
+        std::map<std::string, std::string>::const_iterator it = _connection_strings.find(name);
+        if (it == _connection_strings.end()) return false;
+        _active_connection_name = name;
+        if (it->second.compare(_nos_connection_string) != 0) {
+            _nos_connection_string = it->second;
+            reset_bus_connection();
+        }
+        return true;
+    }
+
+    bool SimTerminal::wait_connected(std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(_connection_mutex);
+        return _connection_cv.wait_for(lock, timeout, [this]{return _connection_state == CONNECTED;});
+    }
+
+    void SimTerminal::select_bus(BusType type, const std::string& bus_name)
+    {
+        _bus_type = type;
+        _bus_name = bus_name;
+        reset_bus_connection();
+    }
+
+    bool SimTerminal::select_target(const std::string& target, std::string& error)
+    {
+        std::shared_ptr<BusConnection> bus = current_bus_connection();
+        if (bus && !bus->is_valid_target(target)) {
+            error = bus->invalid_target_message(target);
+            return false;
+        }
+        _other_node_name = target;
+        std::lock_guard<std::mutex> lock(_connection_mutex);
+        _connect_params.target = _other_node_name;
+        if (bus) bus->set_target(_other_node_name);
+        return true;
+    }
+
+    SimTerminal::OperationResult SimTerminal::write(ByteSpan data)
+    {
+        OperationResult op = {false, BUS_ERROR, std::vector<char>(), 0.0, 0, std::string()};
+        std::shared_ptr<BusConnection> bus = acquire_bus_connection(op.error);
+        if (!bus) return op;
+        std::lock_guard<std::mutex> lock(_bus_op_mutex);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        // only base and UART replies come back through the receive callbacks
+        bool correlated = _correlator.enabled() && ((bus->kind() == BusConnection::BASE_KIND) || (bus->kind() == BusConnection::UART_KIND));
+        if (correlated) _correlator.sent(bus->reply_source(), data.data, data.len, start);
+        op.attempts = 1;
+        try {
+            op.result = bus->write(data.data, data.len);
+        } catch (std::runtime_error &e) {
+            op.result = bus->target_valid() ? BUS_UNSUPPORTED : BUS_INVALID_TARGET;
+            op.error = e.what();
+        }
+        op.latency_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        op.ok = (op.result == BUS_SUCCESS);
+        if (correlated && !op.ok) _correlator.withdraw(bus->reply_source(), start);
+        return op;
+    }
+
+    SimTerminal::OperationResult SimTerminal::read(size_t len)
+    {
+        OperationResult op = {false, BUS_ERROR, std::vector<char>(), 0.0, 0, std::string()};
+        std::shared_ptr<BusConnection> bus = acquire_bus_connection(op.error);
+        if (!bus) return op;
+        std::lock_guard<std::mutex> lock(_bus_op_mutex);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        op.attempts = 1;
+        op.data.resize(len);
+        try {
+            op.result = bus->read(op.data.data(), len);
+        } catch (std::runtime_error &e) {
+            op.result = bus->target_valid() ? BUS_UNSUPPORTED : BUS_INVALID_TARGET;
+            op.error = e.what();
+            op.data.clear();
+        }
+        op.latency_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        op.ok = (op.result == BUS_SUCCESS);
+        return op;
+    }
+
+    SimTerminal::OperationResult SimTerminal::transact(ByteSpan data, size_t rlen)
+    {
+        return transact(data, rlen, _transaction_policy);
+    }
+
+    SimTerminal::OperationResult SimTerminal::transact(ByteSpan data, size_t rlen, const TransactionEngine::Policy& policy)
+    {
+        OperationResult op = {false, BUS_ERROR, std::vector<char>(), 0.0, 0, std::string()};
+        if (rlen == 0) {
+            op.error = "Error: Length must be greater than zero.";
+            return op;
+        }
+        std::shared_ptr<BusConnection> bus = acquire_bus_connection(op.error);
+        if (!bus) return op;
+        std::lock_guard<std::mutex> lock(_bus_op_mutex);
+        op.data.resize(rlen);
+        TransactionEngine::Result result = _transactions.transact(bus, data.data, data.len, op.data.data(), rlen, policy,
+                                                                  [this]{return command_cancelled();});
+        if (result.abandoned) retire_bus_connection(bus);
+        op.ok = (result.outcome == TransactionEngine::SUCCESS);
+        op.result = result.last_result;
+        op.latency_ms = result.latency_ms;
+        op.attempts = result.attempts;
+        if (!op.ok) {
+            op.error = TransactionEngine::result_as_string(result, *bus);
+            boost::trim(op.error);
+            op.data.clear();
+        }
+        return op;
+    }
+
+    std::future<SimTerminal::OperationResult> SimTerminal::write_async(ByteSpan data)
+    {
+        std::vector<char> copy(data.data, data.data + data.len);
+        return std::async(std::launch::async, [this, copy]{return write(ByteSpan(copy));});
+    }
+
+    std::future<SimTerminal::OperationResult> SimTerminal::read_async(size_t len)
+    {
+        return std::async(std::launch::async, [this, len]{return read(len);});
+    }
+
+    std::future<SimTerminal::OperationResult> SimTerminal::transact_async(ByteSpan data, size_t rlen)
+    {
+        std::vector<char> copy(data.data, data.data + data.len);
+        return std::async(std::launch::async, [this, copy, rlen]{return transact(ByteSpan(copy), rlen);});
+    }
+
+    int SimTerminal::open_udp(void)
     {
         int sockfd;
-        char buffer[_MAXLINE];
-        struct sockaddr_in servaddr, cliaddr;
+        struct sockaddr_in servaddr;
         if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
             std::cout << "SimTerminal::handle_udp - Failed to create a socket";
-        } else {
-            memset(&servaddr, 0, sizeof(servaddr));
-            servaddr.sin_family = AF_INET;
-            servaddr.sin_addr.s_addr = INADDR_ANY;
-            servaddr.sin_port = htons(_udp_port);
-            if (bind(sockfd, (const struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
-                std::cout << "SimTerminal::handle_udp - Failed to bind to socket";
-            } else {
-                socklen_t len;
-                int n;
-                len = sizeof(cliaddr);
-                std::string input(buffer);
-                boost::to_upper(input);
-                boost::trim(input);
-                while(input.compare("QUIT") != 0) {
-                    n = recvfrom(sockfd, (char *)buffer, _MAXLINE, 0, (struct sockaddr *)&cliaddr, &len);
-                    buffer[n] = '\0';
-                    input = buffer;
-                    std::string result = process_command(input);
-                    if (!_suppress_output) {
-                        if (result.size() > 0) sendto(sockfd, result.c_str(), result.size(), 0, (const struct sockaddr *)&cliaddr, len);
-                    }
-                    std::string prompt = string_prompt();
-                    if (prompt.size() > 0) sendto(sockfd, prompt.c_str(), prompt.size(), 0, (const struct sockaddr *)&cliaddr, len);
+            return -1;
+        }
+        memset(&servaddr, 0, sizeof(servaddr));
+        servaddr.sin_family = AF_INET;
+        servaddr.sin_addr.s_addr = INADDR_ANY;
+        servaddr.sin_port = htons(_udp_port);
+        if (bind(sockfd, (const struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
+            std::cout << "SimTerminal::handle_udp - Failed to bind to socket";
+            close(sockfd);
+            return -1;
+        }
+        _udp_sockfd = sockfd;
+        _udp_printer = subscribe([this](const ReceiveEvent& event){print_receive_event(event);});
+        return sockfd;
+    }
+
+    void SimTerminal::close_udp(void)
+    {
+        if (_udp_sockfd < 0) return;
+        unsubscribe(_udp_printer);
+        _udp_printer = 0;
+        std::lock_guard<std::mutex> lock(_udp_client_mutex); // a receive event may be sending on the socket
+        close(_udp_sockfd);
+        _udp_sockfd = -1;
+        _udp_client_known = false;
+    }
+
+    bool SimTerminal::handle_datagram(const char* data, size_t len, const struct sockaddr_in& client)
+    {
+        NOS3_TRACE_SPAN("UDP command");
+        {
+            std::lock_guard<std::mutex> lock(_udp_client_mutex);
+            _udp_client = client;
+            _udp_client_known = true;
+        }
+        bool quit;
+        const std::string& result = respond(std::string(data, strnlen(data, len)), quit);
+        NOS3_TRACE_SPAN("sendto");
+        if (!_suppress_output) {
+            if (result.size() > 0) sendto(_udp_sockfd, result.data(), result.size(), 0, (const struct sockaddr *)&client, sizeof(client));
+        }
+        std::string prompt = string_prompt();
+        if (prompt.size() > 0) sendto(_udp_sockfd, prompt.c_str(), prompt.size(), 0, (const struct sockaddr *)&client, sizeof(client));
+        return !quit;
+    }
 
-                    boost::to_upper(input);
-                    boost::trim(input);
+    void SimTerminal::cancel(void)
+    {
+        _cancel_requested = true;
+    }
+
+    // Commands run on a thread of their own so that this one keeps reading the socket; a CANCEL that arrives while a
+    // command is running cancels it at once, however many datagrams are queued ahead of it
+    void SimTerminal::handle_udp(void)
+    {
+        if (open_udp() < 0) return;
+        std::mutex mutex;
+        std::condition_variable queued;
+        std::deque<std::pair<std::string, struct sockaddr_in>> datagrams;
+        std::atomic<bool> running(true);
+        std::atomic<bool> busy(false);
+        std::thread commands([&]{
+            while (running) {
+                std::pair<std::string, struct sockaddr_in> next;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    queued.wait(lock, [&]{return !datagrams.empty();});
+                    next = datagrams.front();
+                    datagrams.pop_front();
+                    busy = true;
                 }
+                running = handle_datagram(next.first.data(), next.first.size(), next.second);
+                busy = false;
+            }
+        });
+
+        char buffer[_MAXLINE];
+        struct sockaddr_in cliaddr;
+        struct pollfd pfd = {_udp_sockfd, POLLIN, 0};
+        while (running) {
+            if (poll(&pfd, 1, 100) <= 0) continue; // wakes up now and then to notice QUIT
+            socklen_t len = sizeof(cliaddr);
+            int n;
+            {
+                NOS3_TRACE_SPAN("recvfrom");
+                n = recvfrom(_udp_sockfd, (char *)buffer, _MAXLINE - 1, MSG_DONTWAIT, (struct sockaddr *)&cliaddr, &len);
+            }
+            if (n < 0) continue;
+            if (busy && is_cancel_datagram(buffer, n)) {
+                cancel();
+                continue;
             }
+            std::lock_guard<std::mutex> lock(mutex);
+            datagrams.push_back(std::make_pair(std::string(buffer, n), cliaddr));
+            queued.notify_one();
         }
+        commands.join();
+        close_udp();
     }
 
     void SimTerminal::handle_input(void)
     {
-        std::string input;
         std::cout << "This is the simulator terminal program.  Type 'HELP' for help." << std::endl << std::endl;
-        while(getline(string_prompt(), input)) // keep looping and getting the next command line
-        {
-            std::string result = process_command(input);
-            if (result.compare("QUIT") == 0) {
-                break;
-            } else {
-                if (!_suppress_output) std::cout << result;
-            }
-        }
+        _console_terminal = this;
+        std::signal(SIGINT, handle_sigint);
+        _event_loop.run([this]{return string_prompt();}, [this](const std::string& input) {
+            bool quit;
+            const std::string& result = respond(input, quit);
+            if (quit) return false;
+            if (!_suppress_output) std::cout.write(result.data(), result.size()).flush();
+            return true;
+        });
 
+        SimTerminal* self = this;
+        _console_terminal.compare_exchange_strong(self, nullptr);
         std::cout << "SimTerminal is quitting!" << std::endl;
     }
 
     std::string SimTerminal::string_prompt(void)
     {
         std::stringstream ss;
-        if (!_suppress_output) {
-            if (_prompt == LONG) {
+        if (!_suppress_output && (_response_format == ResponseEncoder::TEXT)) {
+            if ((_prompt != NONE) && _macros.recording()) {
+                ss << "MACRO " << _macros.recording_name() << "> ";
+            } else if (_prompt == LONG) {
                 ss  <<         _command_node_name 
                     << "-"  << _active_connection_name
                     << "<"  << _other_node_name            << ">" 
@@ -233,36 +676,88 @@ namespace Nos3
         return ss.str();
     }
 
-    bool SimTerminal::getline(const std::string& prompt, std::string& input)
-    {
-        bool retval = true;
-        input.clear();
-        char *line_read = readline(prompt.c_str());
-        if (line_read) {
-            if (*line_read) add_history(line_read); // don't add blank lines
-            input.append(line_read);
-            free(line_read);
-            retval = true;
+    const SimTerminal::CommandResult& SimTerminal::execute(const std::string& command){
+        _cancel_requested = false; // a CANCEL that came in after the previous command finished cancels nothing
+        _command_result.error = false;
+        _command_result.has_result = false;
+        _command_result.payload.clear();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        _command_result.message = process_command(command);
+        _command_result.latency_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        _command_result.quit = (_command_result.message.compare("QUIT") == 0);
+        return _command_result;
+    }
+
+    // Runs a command and encodes its response in the current format; the returned buffer is reused by the next call
+    const std::string& SimTerminal::respond(const std::string& input, bool& quit){
+        const CommandResult& result = execute(input);
+        quit = result.quit;
+        ResponseEncoder::Response response = {++_response_seq, result.error, result.has_result, result.result, result.latency_us,
+                                              result.payload.data(), result.payload.size(), result.message.data(), result.message.size()};
+        NOS3_TRACE_SPAN("encode response");
+        _response_buffer.clear();
+        ResponseEncoder::encode_response(_response_format, response, _response_buffer);
+        return _response_buffer;
+    }
+
+    std::stringstream& SimTerminal::command_error(std::stringstream& ss){
+        _command_result.error = true;
+        return ss;
+    }
+
+    void SimTerminal::command_result(BusResult result){
+        _command_result.has_result = true;
+        _command_result.result = result;
+        if (result != BUS_SUCCESS) _command_result.error = true;
+    }
+
+    // Text mode shows the data in the output mode; the structured modes carry it raw in the response
+    void SimTerminal::command_payload(std::stringstream& ss, const char* buf, size_t len){
+        NOS3_TRACE_SPAN("format payload");
+        if (_response_format == ResponseEncoder::TEXT) {
+            ss << write_message_to_stream(buf, len).str();
         } else {
-            retval = false;
+            _command_result.payload.assign(buf, buf + len);
         }
-        return retval;
+    }
+
+    void SimTerminal::report_operation(std::stringstream& ss, const OperationResult& result){
+        command_result(result.result);
+        if (result.error.size() > 0) command_error(ss) << result.error << std::endl;
+    }
+
+    // Per-operation messages would corrupt the structured formats, so they are only shown in text mode
+    void SimTerminal::apply_bus_messages(void){
+        std::lock_guard<std::mutex> lock(_connection_mutex);
+        _connect_params.verbose = _bus_messages && (_response_format == ResponseEncoder::TEXT);
+        if (_bus_connection) _bus_connection->set_verbose(_connect_params.verbose);
     }
 
     std::string SimTerminal::process_command(std::string input){
-        std::string input_trimmed = input;
-        boost::trim(input_trimmed);
-        std::stringstream tokenizer(input_trimmed);
-        std::string token;
+        NOS3_TRACE_SPAN("process_command");
         std::vector<std::string> input_tokens, input_tokens_upper;
-        while (tokenizer.good()) {
-            tokenizer >> token;
-            input_tokens.push_back(token);
-            boost::to_upper(token);
-            input_tokens_upper.push_back(token);
+        {
+            NOS3_TRACE_SPAN("tokenize");
+            tokenize(input, input_tokens, input_tokens_upper);
         }
         std::stringstream ss;
 
+        if (_macros.recording()) {
+            if ((input_tokens_upper.size() == 1) && (input_tokens_upper[0].compare("END") == 0)) {
+                std::string name = _macros.recording_name();
+                const MacroLibrary::Macro& macro = _macros.end();
+                ss << "Defined macro " << name << " (" << macro.lines.size() << " lines)." << std::endl;
+            } else if ((input_tokens_upper.size() >= 2) && (input_tokens_upper[0].compare("MACRO") == 0) && (input_tokens_upper[1].compare("DEFINE") == 0)) {
+                command_error(ss) << "Macros cannot be defined inside a macro. Type END to finish " << _macros.recording_name() << "." << std::endl;
+            } else if ((input_tokens_upper.size() == 1) && (input_tokens_upper[0].compare("QUIT") == 0)) {
+                command_error(ss) << "QUIT cannot be used in a macro. Type END to finish " << _macros.recording_name() << " first." << std::endl;
+            } else {
+                std::string line = boost::trim_copy(input);
+                if (line.size() > 0) _macros.record(line);
+            }
+            return ss.str();
+        }
+
         if ((input_tokens_upper.size() == 1) && (input_tokens_upper[0].compare("HELP") == 0))
         {
             ss << "This is help for the simulator terminal program." << std::endl;
@@ -277,19 +772,87 @@ namespace Nos3
             ss << "    SET TERMNODE <term node> - Sets the name of this terminal's node to '<term node>'" << std::endl;
             ss << "    SET <ASCII|HEX> <IN|OUT> - Sets the terminal mode to ASCII mode or HEX mode; optionally IN or OUT only" << std::endl;
             ss << "    SET PROMPT <LONG|SHORT|NONE> - Sets the prompt to long format, short format, or none" << std::endl;
+            ss << "    SET RESPONSE FORMAT <TEXT|JSONL|BINARY> - Sets how responses are returned. JSONL and BINARY return one record per" << std::endl;
+            ss << "             command (status, bus result, latency, payload, message) and one per received message, and no prompt" << std::endl;
             ss << "    SUPPRESS OUTPUT <ON|OFF> - Suppresses output or not" << std::endl;
-            ss << "    LIST NOS CONNECTIONS - Lists all of the known NOS Engine connection strings along with a name for selecting them" << std::endl;
+            ss << "    BUS MESSAGES <ON|OFF> - Turns the per-operation \"Wrote N bytes...\" and \"Result: ...\" messages on or off" << std::endl;
+            ss << "    LIST NOS CONNECTIONS - Lists all of the known NOS Engine connection strings along with a name for selecting them," << std::endl;
+            ss << "        their reachability and round trip time, and whether a prewarmed connection is ready" << std::endl;
             ss << "    SET NOS CONNECTION <name> - Sets the NOS Engine connection to the one associated with <name> (initially \"default\")" << std::endl;
             ss << "    ADD NOS CONNECTION <name> <uri> - Adds NOS Engine URI connection string <uri> to the list of known connection strings and associates it with <name>" << std::endl;
+            ss << "    STATUS - Shows the state of the active connection and the reachability and round trip time of each known connection" << std::endl;
             ss << "    WRITE <data> - Writes <data> to the current node. Interprets <data> as ascii or hex depending on input setting." << std::endl;
+            ss << "    WRITE @<name> - Writes the named payload to the current node.  Data that really starts with @ is written @@." << std::endl;
             ss << "    READ <length> - Reads the given number of bytes from the current node. Only works on SPI and I2C buses." << std::endl;
             ss << "    TRANSACT <read length> <data> - Performs a transaction. Sends the given data, and expects a return value of the given length." << std::endl;
             ss << "             Interprets everything after the first space after <read length> as data to be written." << std::endl;
+            ss << "    TRANSACT <read length> @<name> - Performs a transaction, sending the named payload." << std::endl;
+            ss << "    TRANSACT TIMEOUT <duration> <read length> <data|@name> - Performs a transaction with its own deadline (e.g. 50ms, 2s)." << std::endl;
+            ss << "             Transactions can be cancelled with Ctrl-C, or over UDP by sending CANCEL." << std::endl;
+            ss << "    SET TIMEOUT <duration> - Sets the deadline for transactions, including retries (initially 5000ms)" << std::endl;
+            ss << "    SET RETRY <count> [<max backoff>] - Retries transactions that fail with BUSY or ERROR up to <count> times," << std::endl;
+            ss << "             doubling the wait between attempts from 1ms up to <max backoff> (default 100ms)" << std::endl;
+            ss << "    PAYLOAD DEFINE <name> <data> - Stores <data> as a named payload. Interprets <data> as ascii or hex depending on input setting." << std::endl;
+            ss << "    PAYLOAD LOAD <name> <file> [BINARY|HEX] - Stores the contents of <file> as a named payload; HEX files may contain whitespace" << std::endl;
+            ss << "    PAYLOAD LIST - Lists the named payloads and their lengths" << std::endl;
+            ss << "    VECTORS <file> [<report file>] - Runs the test vectors in <file> against the current node and summarizes the results." << std::endl;
+            ss << "             Each line is <command hex> <expected hex|-> [<mask hex|-> [<timeout ms>]]; a report file ending in .json is" << std::endl;
+            ss << "             written as JSON, anything else as JUnit XML.  Cancelling stops before the next vector." << std::endl;
+            ss << "    UPLOAD <file> [<chunk size> [<window>]] [VERIFY <data>] - Writes <file> to the current node in chunks sized for the bus." << std::endl;
+            ss << "             On the base bus every <window>th chunk (default 8, 0 for never) waits up to 500 ms for a reply; if none comes" << std::endl;
+            ss << "             the rest is sent without waiting.  Progress is reported with the result. With VERIFY, <data> is sent" << std::endl;
+            ss << "             as a transaction afterwards and the 4 byte reply is compared with the file's CRC-32.  Cancelling stops" << std::endl;
+            ss << "             before the next chunk." << std::endl;
+            ss << "    CAN SEND <frame> [<frame> ...] - Sends CAN frames in order, each written <hex id>#<hex data> (e.g. 123#DEADBEEF)" << std::endl;
+            ss << "    CAN BURST <count> <frame> - Sends a frame up to 100000 times and reports the frame rate and bus utilization" << std::endl;
+            ss << "    CAN RECV <id> [<count> [<length>]] - Reads <count> frames of <length> bytes (default 8) from <id>, which the acceptance" << std::endl;
+            ss << "             filters must accept; the bus does not report the DLC of a frame read" << std::endl;
+            ss << "    CAN FILTER <ADD <id> <mask>|CLEAR|LIST> - Manages acceptance filters; an identifier passes if (identifier & mask) == (id & mask)" << std::endl;
+            ss << "    CAN ISOTP SEND <tx id> <rx id> <data|@name> - Sends up to 4095 bytes with ISO-TP, reading flow control from <rx id>" << std::endl;
+            ss << "    CAN ISOTP RECV <tx id> <rx id> - Receives an ISO-TP message from <rx id>, sending flow control from <tx id>" << std::endl;
+            ss << "    CAN ISOTP OPTIONS <block size> <STmin> [<timeout ms>] - Sets the flow control sent when receiving (initially 0 0 1000)" << std::endl;
+            ss << "    CAN STATS [RESET] - Shows per-identifier frame counts and gaps, and bus utilization" << std::endl;
+            ss << "    CAN BITRATE <bit/s> - Sets the bitrate used for utilization (initially 500000)" << std::endl;
+            ss << "    REG READ <device> <start> <count> - Reads <count> I2C registers from <start> with one auto-increment burst" << std::endl;
+            ss << "    REG WRITE <device> <start> <value> [<value> ...] - Writes consecutive registers from <start> in one transaction" << std::endl;
+            ss << "    REG MAP <file> - Loads register names; each line is <device> <register> <name> [STATIC]" << std::endl;
+            ss << "    REG CACHE <ON|OFF|CLEAR> - Keeps STATIC registers in a shadow after their first read so REG READ skips them" << std::endl;
+            ss << "    REG WATCH <device> <start> <count> [<period>] - Polls the registers (every 1s by default) and shows only changes" << std::endl;
+            ss << "    REG WATCH LIST - Lists the register watches" << std::endl;
+            ss << "    REG UNWATCH <id|ALL> - Stops a register watch" << std::endl;
+            ss << "    MONITOR [ON|<refresh>] - Shows a live table of messages/s, bytes/s, average size and last seen time per source, redrawn" << std::endl;
+            ss << "             every <refresh> (default 1s); STDIO only. Counts both received messages and this terminal's operations." << std::endl;
+            ss << "    MONITOR <OFF|SNAPSHOT|RESET> - Stops the live table, shows the table once (with rates since the previous" << std::endl;
+            ss << "             SNAPSHOT), or zeroes the counts" << std::endl;
+            ss << "    CORRELATE ORDER [<timeout>] - Matches each base/UART reply to the oldest unanswered write to its source and" << std::endl;
+            ss << "             records the round trip latency (writes unanswered after <timeout>, default 5s, count as timed out)" << std::endl;
+            ss << "    CORRELATE OFFSET <request offset> <reply offset> <width> [<timeout>] - Matches replies to writes by a big endian" << std::endl;
+            ss << "             sequence number of <width> bytes at the given offsets" << std::endl;
+            ss << "    CORRELATE CCSDS [<timeout>] - Matches replies to writes by the CCSDS primary header sequence count" << std::endl;
+            ss << "    CORRELATE <REPORT|RESET|OFF> - Shows counts and latency histograms per node, clears them, or stops matching" << std::endl;
+            ss << "    TRACE START <file> - Records how long each stage of handling commands and received messages takes, on every" << std::endl;
+            ss << "        thread in this process, until TRACE STOP writes it to <file> in Chrome trace format (chrome://tracing, Perfetto)" << std::endl;
+            ss << "    TRACE STOP - Stops recording and writes the trace" << std::endl;
+            ss << "    STRESS <operations> [SEED=<n>] [WORKERS=<n>] [MIX=<writes>:<reads>:<transactions>] [SIZES=<n>[-<m>],...]" << std::endl;
+            ss << "        [TARGETS=<target>,...] [MASTERS=<address>,...] [GAP=<mean>] [REPRO=<file>] - Runs random operations from a" << std::endl;
+            ss << "        seeded generator on the current bus, each worker on a connection of its own, with exponentially distributed" << std::endl;
+            ss << "        gaps of the given mean (e.g. 500us).  On I2C and CAN each worker is a master with an address of its own," << std::endl;
+            ss << "        by default the ones after the terminal's; MASTERS gives one per worker instead.  Reports throughput, latency" << std::endl;
+            ss << "        percentiles and errors, and writes commands repeating the first failure, as the worker's node, to the repro" << std::endl;
+            ss << "        file (stress_repro_<seed>.txt).  The same seed repeats the same operations." << std::endl;
+            ss << "    MACRO DEFINE <name> [<param> ...] - Records the lines that follow, up to END, as a macro; $<param> in them is" << std::endl;
+            ss << "        replaced by the value RUN gives it" << std::endl;
+            ss << "    MACRO LIST | MACRO SHOW <name> | MACRO DELETE <name> - Lists, shows or deletes macros" << std::endl;
+            ss << "    RUN <name> [<times>] [<param>=<value> ...] - Runs a macro <times> times (up to 1000000) and reports how long the" << std::endl;
+            ss << "        runs took.  The macro is compiled once into bus operations with its payloads decoded; only the last run's" << std::endl;
+            ss << "        output is shown" << std::endl;
         } 
         else if ((input_tokens_upper.size() == 3) && (input_tokens_upper[0].compare("SET") == 0) && (input_tokens_upper[1].compare("SIMNODE") == 0))
         {
-            _other_node_name = input_tokens[2];
-            _bus_connection->set_target(_other_node_name);
+            std::string error;
+            if (!select_target(input_tokens[2], error)) {
+                command_error(ss) << error << "  Not changing sim node." << std::endl;
+            }
         } 
         else if ((input_tokens_upper.size() == 3) && (input_tokens_upper[0].compare("SET") == 0) && (input_tokens_upper[1].compare("SIMBUS") == 0))
         {
@@ -307,7 +870,7 @@ namespace Nos3
             if (set_bus_type(new_command_bus_type)) {
                 reset_bus_connection();
             } else {
-                 ss << "Invalid bus type setting: " << new_command_bus_type << ".  Not changing bus type." << std::endl;
+                 command_error(ss) << "Invalid bus type setting: " << new_command_bus_type << ".  Not changing bus type." << std::endl;
             }
         } 
         else if ((input_tokens_upper.size() == 3) && (input_tokens_upper[0].compare("SET") == 0) && (input_tokens_upper[1].compare("TERMNODE") == 0))
@@ -335,41 +898,59 @@ namespace Nos3
             if (prompt_type.compare("LONG") == 0) _prompt = LONG;
             else if (prompt_type.compare("SHORT") == 0) _prompt = SHORT;
             else if (prompt_type.compare("NONE") == 0) _prompt = NONE;
-            else ss << "Invalid prompt length specified: " << prompt_type << "." << std::endl;
+            else command_error(ss) << "Invalid prompt length specified: " << prompt_type << "." << std::endl;
         }
         else if ((input_tokens_upper.size() == 3) && (input_tokens_upper[0].compare("SUPPRESS") == 0) && (input_tokens_upper[1].compare("OUTPUT") == 0))
         {
             std::string on_off = input_tokens_upper[2];
             if (on_off.compare("ON") == 0) _suppress_output = true;
             else if (on_off.compare("OFF") == 0) _suppress_output = false;
-            else ss << "Invalid suppress output flag specified (valid values are ON, OFF): " << on_off << "." << std::endl;
+            else command_error(ss) << "Invalid suppress output flag specified (valid values are ON, OFF): " << on_off << "." << std::endl;
+        }
+        else if ((input_tokens_upper.size() == 3) && (input_tokens_upper[0].compare("BUS") == 0) && (input_tokens_upper[1].compare("MESSAGES") == 0))
+        {
+            std::string on_off = input_tokens_upper[2];
+            if (on_off.compare("ON") == 0) _bus_messages = true;
+            else if (on_off.compare("OFF") == 0) _bus_messages = false;
+            else command_error(ss) << "Invalid bus messages flag specified (valid values are ON, OFF): " << on_off << "." << std::endl;
+            apply_bus_messages();
+        }
+        else if ((input_tokens_upper.size() == 4) && (input_tokens_upper[0].compare("SET") == 0) && (input_tokens_upper[1].compare("RESPONSE") == 0) && (input_tokens_upper[2].compare("FORMAT") == 0))
+        {
+            std::string format = input_tokens_upper[3];
+            if (format.compare("TEXT") == 0) _response_format = ResponseEncoder::TEXT;
+            else if (format.compare("JSONL") == 0) _response_format = ResponseEncoder::JSONL;
+            else if (format.compare("BINARY") == 0) _response_format = ResponseEncoder::BINARY;
+            else command_error(ss) << "Invalid response format specified (valid values are TEXT, JSONL, BINARY): " << format << "." << std::endl;
+            apply_bus_messages();
         }
         else if ((input_tokens_upper.size() == 3) && (input_tokens_upper[0].compare("LIST") == 0) && (input_tokens_upper[1].compare("NOS") == 0) && (input_tokens_upper[2].compare("CONNECTIONS") == 0))
         {
-            for (std::map<std::string, std::string>::const_iterator it = _connection_strings.begin(); it != _connection_strings.end(); it++)
-                ss << "    name=" << it->first << ", connection string=" << it->second << std::endl;
+            ss << list_connections();
         }
         else if ((input_tokens_upper.size() == 4) && (input_tokens_upper[0].compare("SET") == 0) && (input_tokens_upper[1].compare("NOS") == 0) && (input_tokens_upper[2].compare("CONNECTION") == 0))
         {
             std::string name = input_tokens[3];
-            std::string old_connection_string = _nos_connection_string;
-            try {
-                std::string connection_string = _connection_strings.at(name);
-                if (connection_string.compare(_nos_connection_string) != 0) {
-                    _nos_connection_string = connection_string;
-                    reset_bus_connection();
-                    _active_connection_name = name; // set after reset in case it throws
-                } else {
-                    ss << "Connection string is the same as the current one; doing nothing." << std::endl;
-                }
-            } catch (std::exception&) {
-                _nos_connection_string = old_connection_string;
-                ss << "Invalid connection: \"" << name << "\"." << std::endl;
+            std::map<std::string, std::string>::const_iterator it = _connection_strings.find(name);
+            if (it == _connection_strings.end()) {
+                command_error(ss) << "Invalid connection: \"" << name << "\"." << std::endl;
+            } else if (it->second.compare(_nos_connection_string) == 0) {
+                ss << "Connection string is the same as the current one; doing nothing." << std::endl;
+            } else {
+                use_connection(name); // connects in the background; see STATUS
             }
         }
         else if ((input_tokens_upper.size() == 5) && (input_tokens_upper[0].compare("ADD") == 0) && (input_tokens_upper[1].compare("NOS") == 0) && (input_tokens_upper[2].compare("CONNECTION") == 0))
         {
-            _connection_strings[input_tokens[3]] = input_tokens[4];
+            add_connection(input_tokens[3], input_tokens[4]);
+        }
+        else if ((input_tokens_upper.size() == 1) && (input_tokens_upper[0].compare("STATUS") == 0))
+        {
+            ss << connection_status();
+        }
+        else if ((input_tokens_upper.size() == 1) && (input_tokens_upper[0].compare("CANCEL") == 0))
+        {
+            ss << "No transaction in progress." << std::endl;
         }
         else if ((input_tokens_upper.size() == 1) && (input_tokens_upper[0].compare("QUIT") == 0))
         {
@@ -377,148 +958,1468 @@ namespace Nos3
         }
         else if ((input_tokens_upper.size() >= 2) && (input_tokens_upper[0].compare("WRITE") == 0))
         {
-            if(_bus_connection.get() == nullptr){
-                ss << "Connection has not been instantiated. Connect to a bus with SET SIMBUS." << std::endl;
-            } else {
-                std::string buf = input.substr(6, input.length() - 6);
-                boost::trim(buf);
-                if(_current_in_mode == HEX){
-                    buf = convert_asciihex_to_hexhex(buf);
+            try{
+                if ((input_tokens.size() == 2) && PayloadLibrary::is_reference(input_tokens[1])) {
+                    const PayloadLibrary::Payload& payload = find_payload(input_tokens[1]);
+                    report_operation(ss, write(ByteSpan(payload.data, payload.len)));
+                } else {
+                    std::string buf = PayloadLibrary::unescape(text_after_tokens(input, 1));
+                    if(_current_in_mode == HEX){
+                        buf = convert_asciihex_to_hexhex(buf);
+                    }
+                    report_operation(ss, write(ByteSpan(buf)));
                 }
-                int wlen = buf.length();
+            }catch (std::runtime_error &e){
+                command_error(ss) << e.what() << std::endl;
+            }
+        }
+        else if ((input_tokens_upper.size() == 2) && (input_tokens_upper[0].compare("READ") == 0))
+        {
+            int len;
+            std::string len_string = input_tokens[1];
+            try{
+                len = stoi(len_string);
+            }catch (std::invalid_argument &e){
+                len = 0;
+            }
 
-                try{
-                    _bus_connection->write(buf.c_str(), wlen);
+            OperationResult result = read(std::max(len, 0));
+            report_operation(ss, result);
+            if (result.error.size() == 0) command_payload(ss, result.data.data(), result.data.size());
+        }
+        else if ((input_tokens_upper.size() == 3) && (input_tokens_upper[0].compare("SET") == 0) && (input_tokens_upper[1].compare("TIMEOUT") == 0))
+        {
+            try {
+                _transaction_policy.timeout = TransactionEngine::parse_duration(input_tokens[2]);
+            } catch (std::logic_error &e) {
+                command_error(ss) << "Invalid timeout specified: " << input_tokens[2] << "." << std::endl;
+            }
+        }
+        else if ((input_tokens_upper.size() >= 3) && (input_tokens_upper.size() <= 4) && (input_tokens_upper[0].compare("SET") == 0) && (input_tokens_upper[1].compare("RETRY") == 0))
+        {
+            try {
+                unsigned retries = stoul(input_tokens[2]);
+                if (input_tokens.size() == 4) _transaction_policy.max_backoff = TransactionEngine::parse_duration(input_tokens[3]);
+                _transaction_policy.retries = retries;
+            } catch (std::logic_error &e) {
+                command_error(ss) << "Invalid retry policy specified." << std::endl;
+            }
+        }
+        else if ((input_tokens_upper.size() >= 3) && (input_tokens_upper[0].compare("TRANSACT") == 0))
+        {
+            TransactionEngine::Policy policy = _transaction_policy;
+            size_t arg = 1;
+            bool valid = true;
+            if (input_tokens_upper[1].compare("TIMEOUT") == 0) {
+                arg = 3;
+                try {
+                    if (input_tokens.size() < 5) throw std::invalid_argument("missing arguments");
+                    policy.timeout = TransactionEngine::parse_duration(input_tokens[2]);
+                } catch (std::logic_error &e) {
+                    command_error(ss) << "Usage: TRANSACT TIMEOUT <duration> <read length> <data>" << std::endl;
+                    valid = false;
+                }
+            }
+            if (valid) {
+                int rlen;
+                std::string wbuf;
+                const char* wdata;
+                size_t wlen;
+                try {
+                    rlen = stoi(input_tokens[arg]);
+                    if (rlen <= 0) throw std::runtime_error("Error: Length must be greater than zero.");
+                    if ((input_tokens.size() == arg + 2) && PayloadLibrary::is_reference(input_tokens[arg + 1])) {
+                        const PayloadLibrary::Payload& payload = find_payload(input_tokens[arg + 1]);
+                        wdata = payload.data;
+                        wlen = payload.len;
+                    } else {
+                        wbuf = PayloadLibrary::unescape(text_after_tokens(input, arg + 1));
+                        if(_current_in_mode == HEX){
+                            wbuf = convert_asciihex_to_hexhex(wbuf);
+                        }
+                        wdata = wbuf.c_str();
+                        wlen = wbuf.length();
+                    }
+                    _interrupted = false;
+                    _transaction_in_progress = true;
+                    OperationResult result = transact(ByteSpan(wdata, wlen), rlen, policy);
+                    _transaction_in_progress = false;
+                    report_operation(ss, result);
+                    if (result.ok) {
+                        command_payload(ss, result.data.data(), result.data.size());
+                        if (result.attempts > 1) ss << "(succeeded after " << (result.attempts - 1) << " retries)" << std::endl;
+                    }
+                }catch (std::invalid_argument &e){
+                    command_error(ss) << "\"" << input_tokens[arg] << "\" is not a valid number." << std::endl;
                 }catch (std::runtime_error &e){
-                    ss << e.what() << std::endl;
+                    command_error(ss) << e.what() << std::endl;
                 }
             }
         }
-        else if ((input_tokens_upper.size() == 2) && (input_tokens_upper[0].compare("READ") == 0))
+        else if ((input_tokens_upper.size() >= 4) && (input_tokens_upper[0].compare("PAYLOAD") == 0) && (input_tokens_upper[1].compare("DEFINE") == 0))
+        {
+            std::string buf = text_after_tokens(input, 3);
+            if(_current_in_mode == HEX){
+                buf = convert_asciihex_to_hexhex(buf);
+            }
+            try {
+                _payloads.define(input_tokens[2], buf.c_str(), buf.length());
+            }catch (std::runtime_error &e){
+                command_error(ss) << e.what() << std::endl;
+            }
+        }
+        else if ((input_tokens_upper.size() >= 4) && (input_tokens_upper.size() <= 5) && (input_tokens_upper[0].compare("PAYLOAD") == 0) && (input_tokens_upper[1].compare("LOAD") == 0))
         {
-            if(_bus_connection.get() == nullptr){
-                ss << "Connection has not been instantiated. Connect to a bus with SET SIMBUS." << std::endl;
+            std::string format = (input_tokens_upper.size() == 5) ? input_tokens_upper[4] : "BINARY";
+            if ((format.compare("BINARY") != 0) && (format.compare("HEX") != 0)) {
+                command_error(ss) << "Invalid payload file format (valid formats are BINARY, HEX): " << format << "." << std::endl;
             } else {
-                char buf[255];
-                int len;
-                std::string len_string = input_tokens[1];
-                try{
-                    len = stoi(len_string);
-                }catch (std::invalid_argument &e){
-                    len = 0;
-                }
-
                 try {
-                    _bus_connection->read(buf, len);
-                    ss = write_message_to_stream(buf, len);
+                    const PayloadLibrary::Payload& payload = _payloads.load(input_tokens[2], input_tokens[3], format.compare("HEX") == 0);
+                    ss << "Loaded " << payload.len << " bytes into payload " << input_tokens[2] << "." << std::endl;
                 }catch (std::runtime_error &e){
-                    ss << e.what() << std::endl;
+                    command_error(ss) << e.what() << std::endl;
                 }
-            }            
+            }
         }
-        else if ((input_tokens_upper.size() >= 3) && (input_tokens_upper[0].compare("TRANSACT") == 0))
+        else if ((input_tokens_upper.size() == 2) && (input_tokens_upper[0].compare("PAYLOAD") == 0) && (input_tokens_upper[1].compare("LIST") == 0))
         {
-            if(_bus_connection.get() == nullptr){
-                ss << "Connection has not been instantiated. Connect to a bus with SET SIMBUS." << std::endl;
-            } else {
-                char rbuf[255];
-                int rlen;
-                int dataStart;
-
-                boost::iterator_range<std::string::iterator> r = boost::find_nth(input, " ", 1);
-                dataStart = std::distance(input.begin(), r.begin()) + 1;
-
-                std::string wbuf = input.substr(dataStart, input.length() - dataStart);
-                boost::trim(wbuf);
-                if(_current_in_mode == HEX){
-                    wbuf = convert_asciihex_to_hexhex(wbuf);
+            for (std::map<std::string, PayloadLibrary::Payload>::const_iterator it = _payloads.payloads().begin(); it != _payloads.payloads().end(); it++)
+                ss << "    name=" << it->first << ", length=" << it->second.len << std::endl;
+        }
+        else if ((input_tokens_upper.size() >= 2) && (input_tokens_upper[0].compare("UPLOAD") == 0))
+        {
+            std::shared_ptr<BusConnection> bus = acquire_bus_connection(ss);
+            if (bus) {
+                FileUploader::Options options;
+                options.chunk_size = 0;
+                options.window = 8;
+                options.ack_timeout_ms = 500;
+                options.verify_timeout_ms = static_cast<unsigned>(std::max(1, _command_deadline_ms));
+                size_t i = 2;
+                bool valid = true;
+                try {
+                    if ((i < input_tokens.size()) && (input_tokens_upper[i].compare("VERIFY") != 0)) {
+                        options.chunk_size = stoul(input_tokens[i]);
+                        i++;
+                    }
+                    if ((i < input_tokens.size()) && (input_tokens_upper[i].compare("VERIFY") != 0)) {
+                        options.window = stoul(input_tokens[i]);
+                        i++;
+                    }
+                }catch (std::logic_error &e){
+                    command_error(ss) << "\"" << input_tokens[i] << "\" is not a valid number." << std::endl;
+                    valid = false;
+                }
+                if (valid && (i < input_tokens.size()) && (input_tokens_upper[i].compare("VERIFY") == 0)) {
+                    for (i++; i < input_tokens.size(); i++) {
+                        if (options.verify_request.size() > 0) options.verify_request.push_back(' ');
+                        options.verify_request.append(input_tokens[i]);
+                    }
+                    if(_current_in_mode == HEX){
+                        options.verify_request = convert_asciihex_to_hexhex(options.verify_request);
+                    }
+                }
+                if (valid && (i < input_tokens.size())) {
+                    command_error(ss) << "Unexpected UPLOAD argument \"" << input_tokens[i] << "\"." << std::endl;
+                } else if (valid) {
+                    try {
+                        FileUploader uploader(*bus, ss);
+                        std::lock_guard<std::mutex> lock(_bus_op_mutex);
+                        _interrupted = false;
+                        _transaction_in_progress = true;
+                        ss << FileUploader::result_as_string(uploader.upload(input_tokens[1], options, [this]{return command_cancelled();}));
+                    }catch (std::runtime_error &e){
+                        command_error(ss) << e.what() << std::endl;
+                    }
+                    _transaction_in_progress = false;
                 }
-                int wlen = wbuf.length();
+            }
+        }
+        else if ((input_tokens_upper.size() >= 2) && (input_tokens_upper.size() <= 3) && (input_tokens_upper[0].compare("VECTORS") == 0))
+        {
+            std::shared_ptr<BusConnection> bus = acquire_bus_connection(ss);
+            if (bus) {
                 try {
-                    rlen = stoi(input_tokens[1]);
-                    //ss << "rlen: " << rlen << ", Data: " << input.substr(dataStart, input.length() - dataStart) << std::endl;
-                    _bus_connection->transact(wbuf.c_str(), wlen, rbuf, rlen);
-                    ss = write_message_to_stream(rbuf, rlen);
-                }catch (std::invalid_argument &e){
-                    ss << "\"" << input_tokens[1] << "\" is not a valid number." << std::endl;
+                    TestVectorSet vectors;
+                    vectors.load(input_tokens[1]);
+                    TestVectorSet::Summary summary;
+                    {
+                        std::lock_guard<std::mutex> lock(_bus_op_mutex);
+                        _interrupted = false;
+                        _transaction_in_progress = true;
+                        summary = vectors.run(*bus, [this]{return command_cancelled();});
+                        _transaction_in_progress = false;
+                    }
+                    ss << TestVectorSet::summary_as_string(summary);
+                    if (input_tokens.size() == 3) {
+                        vectors.write_report(input_tokens[2], summary);
+                        ss << "Wrote report to " << input_tokens[2] << "." << std::endl;
+                    }
                 }catch (std::runtime_error &e){
-                    ss << e.what() << std::endl;
+                    command_error(ss) << e.what() << std::endl;
                 }
+                _transaction_in_progress = false;
             }
         }
-        else if (input.length() > 0)
+        else if ((input_tokens_upper.size() >= 2) && (input_tokens_upper[0].compare("CAN") == 0))
         {
-            ss << "Unrecognized command \"" << input << "\". Type \"HELP\" for help." << std::endl;
+            can_command(input_tokens, input_tokens_upper, ss);
         }
-
-        std::string retval = ss.str();
+        else if ((input_tokens_upper.size() >= 2) && (input_tokens_upper[0].compare("REG") == 0))
+        {
+            register_command(input_tokens, input_tokens_upper, ss);
+        }
+        else if ((input_tokens_upper.size() >= 2) && (input_tokens_upper[0].compare("CORRELATE") == 0))
+        {
+            correlate_command(input_tokens, input_tokens_upper, ss);
+        }
+        else if ((input_tokens_upper.size() <= 2) && (input_tokens_upper[0].compare("MONITOR") == 0))
+        {
+            monitor_command(input_tokens, input_tokens_upper, ss);
+        }
+        else if ((input_tokens_upper.size() >= 2) && (input_tokens_upper[0].compare("MACRO") == 0))
+        {
+            macro_command(input_tokens, input_tokens_upper, ss);
+        }
+        else if ((input_tokens_upper.size() >= 2) && (input_tokens_upper[0].compare("RUN") == 0))
+        {
+            run_command(input_tokens, ss);
+        }
+        else if ((input_tokens_upper.size() >= 2) && (input_tokens_upper[0].compare("STRESS") == 0))
+        {
+            stress_command(input_tokens, ss);
+        }
+        else if ((input_tokens_upper.size() == 3) && (input_tokens_upper[0].compare("TRACE") == 0) && (input_tokens_upper[1].compare("START") == 0))
+        {
+            std::string error;
+            if (Tracer::start(input_tokens[2], error)) {
+                ss << "Tracing.  TRACE STOP writes the trace to " << input_tokens[2] << "." << std::endl;
+            } else {
+                command_error(ss) << error << std::endl;
+            }
+        }
+        else if ((input_tokens_upper.size() == 2) && (input_tokens_upper[0].compare("TRACE") == 0) && (input_tokens_upper[1].compare("STOP") == 0))
+        {
+            std::string path, error;
+            size_t events, dropped;
+            if (Tracer::stop(path, events, dropped, error)) {
+                ss << "Wrote " << events << " spans to " << path;
+                if (dropped > 0) ss << " (" << dropped << " more did not fit in the per-thread buffers)";
+                ss << "." << std::endl;
+            } else {
+                command_error(ss) << error << std::endl;
+            }
+        }
+        else if (input.length() > 0)
+        {
+            command_error(ss) << "Unrecognized command \"" << input << "\". Type \"HELP\" for help." << std::endl;
+        }
+
+        std::string retval = ss.str();
         return retval;
     }
 
+    // Only reads flags: Ctrl-C sets one and cancel() the other, whichever thread the CANCEL datagram was read on
+    bool SimTerminal::command_cancelled(void){
+        return _interrupted || _cancel_requested;
+    }
+
+    bool SimTerminal::is_cancel_datagram(const char* data, size_t len){
+        std::string datagram(data, strnlen(data, len));
+        boost::trim(datagram);
+        return boost::iequals(datagram, "CANCEL");
+    }
+
+    const PayloadLibrary::Payload& SimTerminal::find_payload(const std::string& reference)
+    {
+        const PayloadLibrary::Payload* payload = _payloads.find(reference.substr(1));
+        if (payload == nullptr) {
+            throw std::runtime_error("Error: No payload named \"" + reference.substr(1) + "\". Define one with PAYLOAD DEFINE or PAYLOAD LOAD.");
+        }
+        return *payload;
+    }
+
+    static uint32_t can_identifier(const std::string& token)
+    {
+        uint32_t id;
+        if (!CANConnection::parse_identifier(token, id)) {
+            throw std::runtime_error("Error: \"" + token + "\" is not a valid CAN identifier; use 0 to 0x1FFFFFFF, in decimal or with a 0x prefix.");
+        }
+        return id;
+    }
+
+    // CAN ... commands; they work at the frame level, so they ignore the selected sim node
+    void SimTerminal::can_command(const std::vector<std::string>& tokens, const std::vector<std::string>& tokens_upper, std::stringstream& ss)
+    {
+        const std::string& sub = tokens_upper[1];
+        if ((tokens_upper.size() == 3) && (sub.compare("BITRATE") == 0)) {
+            try {
+                unsigned long bitrate = stoul(tokens[2]);
+                if (bitrate == 0) throw std::invalid_argument("zero bitrate");
+                _can_engine.set_bitrate(bitrate);
+            } catch (std::logic_error &e) {
+                command_error(ss) << "Invalid bitrate specified: " << tokens[2] << "." << std::endl;
+            }
+            return;
+        }
+        if ((tokens_upper.size() == 3) && (sub.compare("FILTER") == 0) && (tokens_upper[2].compare("LIST") == 0)) {
+            if (_can_engine.filters().empty()) ss << "No filters; all frames are accepted." << std::endl;
+            for (const CanEngine::Filter& filter : _can_engine.filters()) {
+                ss << "    id=0x" << std::hex << std::uppercase << filter.id << ", mask=0x" << filter.mask << std::dec << std::nouppercase << std::endl;
+            }
+            return;
+        }
+        if ((tokens_upper.size() == 3) && (sub.compare("FILTER") == 0) && (tokens_upper[2].compare("CLEAR") == 0)) {
+            _can_engine.clear_filters();
+            return;
+        }
+        if ((tokens_upper.size() == 5) && (sub.compare("FILTER") == 0) && (tokens_upper[2].compare("ADD") == 0)) {
+            CanEngine::Filter filter;
+            if (!CANConnection::parse_identifier(tokens[3], filter.id) || !CANConnection::parse_identifier(tokens[4], filter.mask)) {
+                command_error(ss) << "Usage: CAN FILTER ADD <id> <mask>, each at most 0x1FFFFFFF" << std::endl;
+            } else {
+                _can_engine.add_filter(filter);
+            }
+            return;
+        }
+        if ((tokens_upper.size() >= 2) && (tokens_upper.size() <= 3) && (sub.compare("STATS") == 0)) {
+            if (tokens_upper.size() == 3) {
+                if (tokens_upper[2].compare("RESET") == 0) {
+                    _can_engine.reset_stats();
+                } else {
+                    command_error(ss) << "Usage: CAN STATS [RESET]" << std::endl;
+                }
+            } else {
+                ss << _can_engine.stats_as_string();
+            }
+            return;
+        }
+        if ((tokens_upper.size() >= 5) && (tokens_upper.size() <= 6) && (sub.compare("ISOTP") == 0) && (tokens_upper[2].compare("OPTIONS") == 0)) {
+            try {
+                CanEngine::IsoTpOptions options = _can_engine.isotp_options();
+                int block_size, st_min;
+                if (!parse_bus_number(tokens[3], 0, 0xff, block_size) || !parse_bus_number(tokens[4], 0, 0xff, st_min)) throw std::out_of_range("options");
+                options.block_size = block_size;
+                options.st_min = st_min;
+                if (tokens.size() == 6) options.timeout_ms = stoul(tokens[5]);
+                _can_engine.set_isotp_options(options);
+            } catch (std::logic_error &e) {
+                command_error(ss) << "Usage: CAN ISOTP OPTIONS <block size> <STmin> [<timeout ms>], block size and STmin at most 255" << std::endl;
+            }
+            return;
+        }
+
+        // everything else uses the bus
+        std::shared_ptr<BusConnection> bus = acquire_bus_connection(ss);
+        if (!bus) return;
+        if (bus->kind() != BusConnection::CAN_KIND) {
+            command_error(ss) << "CAN commands need the CAN bus type; set it with SET SIMBUSTYPE CAN." << std::endl;
+            return;
+        }
+        CANConnection& can = static_cast<CANConnection&>(*bus);
+        std::lock_guard<std::mutex> lock(_bus_op_mutex);
+        try {
+            if ((tokens_upper.size() >= 3) && (sub.compare("SEND") == 0)) {
+                std::vector<CanFrame> frames(tokens.size() - 2);
+                for (size_t i = 2; i < tokens.size(); i++) {
+                    if (!CanEngine::parse_frame(tokens[i], frames[i - 2])) throw std::runtime_error("Error: \"" + tokens[i] + "\" is not a frame; use <hex id>#<hex data>, up to 8 bytes.");
+                }
+                size_t sent;
+                BusResult result = _can_engine.send(can, frames.data(), frames.size(), sent);
+                command_result(result);
+                if (result != BUS_SUCCESS) {
+                    command_error(ss) << "Sent " << sent << " of " << frames.size() << " frames; frame " << CanEngine::frame_as_string(frames[sent]) << " failed: " << bus_result_as_string(result) << std::endl;
+                }
+            } else if ((tokens_upper.size() == 4) && (sub.compare("BURST") == 0)) {
+                unsigned long count = stoul(tokens[2]);
+                if (count > _MAX_CAN_BURST) throw std::runtime_error("Error: A burst is limited to " + std::to_string(_MAX_CAN_BURST) + " frames.");
+                CanFrame frame;
+                if (!CanEngine::parse_frame(tokens[3], frame)) throw std::runtime_error("Error: \"" + tokens[3] + "\" is not a frame; use <hex id>#<hex data>, up to 8 bytes.");
+                std::vector<CanFrame> frames(count, frame);
+                size_t sent;
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                BusResult result = _can_engine.send(can, frames.data(), frames.size(), sent);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                command_result(result);
+                if (result != BUS_SUCCESS) command_error(ss) << "Frame " << (sent + 1) << " failed: " << bus_result_as_string(result) << std::endl;
+                ss << "Sent " << sent << " frames in " << (seconds * 1000) << " ms";
+                if (seconds > 0) {
+                    ss << " (" << (sent / seconds) << " frames/s, " << (100.0 * sent * CanEngine::frame_bits(frame) / (seconds * _can_engine.bitrate()))
+                       << "% of the bus at " << _can_engine.bitrate() << " bit/s)";
+                }
+                ss << std::endl;
+            } else if ((tokens_upper.size() >= 3) && (tokens_upper.size() <= 5) && (sub.compare("RECV") == 0)) {
+                uint32_t id = can_identifier(tokens[2]);
+                unsigned long count = (tokens.size() >= 4) ? stoul(tokens[3]) : 1;
+                unsigned long len = (tokens.size() == 5) ? stoul(tokens[4]) : 8;
+                if (len > 8) throw std::runtime_error("Error: A CAN frame holds at most 8 bytes.");
+                if (!_can_engine.accepts(id)) {
+                    command_error(ss) << "0x" << std::hex << std::uppercase << id << std::dec << std::nouppercase
+                                      << " is rejected by the acceptance filters." << std::endl;
+                    return;
+                }
+                for (unsigned long i = 0; i < count; i++) {
+                    CanFrame frame;
+                    BusResult result = _can_engine.receive(can, id, len, frame);
+                    command_result(result);
+                    if (result != BUS_SUCCESS) {
+                        command_error(ss) << "Reading frame " << (i + 1) << " failed: " << bus_result_as_string(result) << std::endl;
+                        break;
+                    }
+                    ss << CanEngine::frame_as_string(frame) << std::endl;
+                }
+            } else if ((tokens_upper.size() >= 6) && (sub.compare("ISOTP") == 0) && (tokens_upper[2].compare("SEND") == 0)) {
+                uint32_t tx_id = can_identifier(tokens[3]);
+                uint32_t rx_id = can_identifier(tokens[4]);
+                std::string buf;
+                const char* data;
+                size_t len;
+                if ((tokens.size() == 6) && PayloadLibrary::is_reference(tokens[5])) {
+                    const PayloadLibrary::Payload& payload = find_payload(tokens[5]);
+                    data = payload.data;
+                    len = payload.len;
+                } else {
+                    for (size_t i = 5; i < tokens.size(); i++) {
+                        if (buf.size() > 0) buf.push_back(' ');
+                        buf.append(tokens[i]);
+                    }
+                    buf = PayloadLibrary::unescape(buf);
+                    if(_current_in_mode == HEX){
+                        buf = convert_asciihex_to_hexhex(buf);
+                    }
+                    data = buf.c_str();
+                    len = buf.length();
+                }
+                std::string error;
+                BusResult result = _can_engine.isotp_send(can, tx_id, rx_id, data, len, error);
+                command_result(result);
+                if (result != BUS_SUCCESS) {
+                    command_error(ss) << "ISO-TP send failed: " << bus_result_as_string(result);
+                    if (error.size() > 0) ss << " (" << error << ")";
+                    ss << std::endl;
+                }
+            } else if ((tokens_upper.size() == 5) && (sub.compare("ISOTP") == 0) && (tokens_upper[2].compare("RECV") == 0)) {
+                uint32_t tx_id = can_identifier(tokens[3]);
+                uint32_t rx_id = can_identifier(tokens[4]);
+                std::vector<char> data;
+                std::string error;
+                BusResult result = _can_engine.isotp_receive(can, tx_id, rx_id, data, error);
+                command_result(result);
+                if (result == BUS_SUCCESS) {
+                    command_payload(ss, data.data(), data.size());
+                } else {
+                    command_error(ss) << "ISO-TP receive failed: " << bus_result_as_string(result);
+                    if (error.size() > 0) ss << " (" << error << ")";
+                    ss << std::endl;
+                }
+            } else {
+                command_error(ss) << "Unrecognized CAN command. Type \"HELP\" for help." << std::endl;
+            }
+        } catch (std::invalid_argument &e) {
+            command_error(ss) << "Invalid number in CAN command." << std::endl;
+        } catch (std::out_of_range &e) {
+            command_error(ss) << "Number out of range in CAN command." << std::endl;
+        } catch (std::runtime_error &e) {
+            command_error(ss) << e.what() << std::endl;
+        }
+    }
+
+    // MACRO ... commands
+    void SimTerminal::macro_command(const std::vector<std::string>& tokens, const std::vector<std::string>& tokens_upper, std::stringstream& ss)
+    {
+        const std::string& sub = tokens_upper[1];
+        try {
+            if ((tokens.size() >= 3) && (sub.compare("DEFINE") == 0)) {
+                _macros.begin(tokens[2], std::vector<std::string>(tokens.begin() + 3, tokens.end()));
+                ss << "Recording macro " << tokens[2] << ".  Type END to finish." << std::endl;
+            } else if ((tokens.size() == 2) && (sub.compare("LIST") == 0)) {
+                if (_macros.macros().empty()) ss << "No macros defined." << std::endl;
+                for (std::map<std::string, MacroLibrary::Macro>::const_iterator it = _macros.macros().begin(); it != _macros.macros().end(); it++) {
+                    ss << it->first;
+                    for (const std::string& param : it->second.params) ss << " " << param;
+                    ss << " (" << it->second.lines.size() << " lines)" << std::endl;
+                }
+            } else if ((tokens.size() == 3) && (sub.compare("SHOW") == 0)) {
+                const MacroLibrary::Macro* macro = _macros.find(tokens[2]);
+                if (!macro) throw std::runtime_error("Error: No macro named \"" + tokens[2] + "\".");
+                ss << "MACRO DEFINE " << tokens[2];
+                for (const std::string& param : macro->params) ss << " " << param;
+                ss << std::endl;
+                for (const std::string& line : macro->lines) ss << "    " << line << std::endl;
+                ss << "END" << std::endl;
+            } else if ((tokens.size() == 3) && (sub.compare("DELETE") == 0)) {
+                if (!_macros.remove(tokens[2])) throw std::runtime_error("Error: No macro named \"" + tokens[2] + "\".");
+            } else {
+                command_error(ss) << "Unrecognized MACRO command. Type \"HELP\" for help." << std::endl;
+            }
+        } catch (std::runtime_error &e) {
+            command_error(ss) << e.what() << std::endl;
+        }
+    }
+
+    // Resolves what can be resolved before running: bus and target switches (consecutive bus settings collapse into
+    // one switch) and payloads, decoded in the input mode they would have been typed in.  Lines that are not bus
+    // operations are kept as commands.
+    std::vector<SimTerminal::MacroOp> SimTerminal::compile_macro(const std::vector<std::string>& lines)
+    {
+        std::vector<MacroOp> ops;
+        BusType bus_type = _bus_type;
+        std::string bus_name = _bus_name;
+        SimTerminalMode in_mode = _current_in_mode;
+        for (size_t i = 0; i < lines.size(); i++) {
+            const std::string& line = lines[i];
+            std::vector<std::string> tokens, upper;
+            tokenize(line, tokens, upper);
+            if ((upper.size() == 1) && (upper[0].size() == 0)) continue;
+            size_t n = upper.size();
+            MacroOp op = {MacroOp::COMMAND, bus_type, line, std::string(), 0, i + 1};
+            try {
+                if ((n == 3) && (upper[0].compare("SET") == 0) && ((upper[1].compare("SIMBUSTYPE") == 0) || (upper[1].compare("SIMBUS") == 0))) {
+                    if (upper[1].compare("SIMBUS") == 0) {
+                        bus_name = tokens[2];
+                    } else {
+                        if (!parse_bus_type(upper[2], bus_type)) throw std::runtime_error("Error: Invalid bus type setting: " + upper[2] + ".");
+                    }
+                    op.type = MacroOp::SELECT_BUS;
+                    op.bus_type = bus_type;
+                    op.text = bus_name;
+                    if (!ops.empty() && (ops.back().type == MacroOp::SELECT_BUS)) {
+                        ops.back() = op;
+                        continue;
+                    }
+                } else if ((n == 3) && (upper[0].compare("SET") == 0) && (upper[1].compare("SIMNODE") == 0)) {
+                    op.type = MacroOp::SELECT_TARGET;
+                    op.text = tokens[2];
+                } else if ((n >= 2) && (upper[0].compare("SET") == 0) && ((upper[1].compare("HEX") == 0) || (upper[1].compare("ASCII") == 0))) {
+                    if ((n == 2) || (upper[2].compare("IN") == 0)) in_mode = (upper[1].compare("HEX") == 0) ? HEX : ASCII;
+                } else if ((n >= 2) && ((upper[0].compare("WRITE") == 0) || ((n >= 3) && (upper[0].compare("TRANSACT") == 0) && (upper[1].compare("TIMEOUT") != 0)))) {
+                    size_t data_arg = 1;
+                    op.type = MacroOp::WRITE;
+                    if (upper[0].compare("TRANSACT") == 0) {
+                        int rlen = stoi(tokens[1]);
+                        if (rlen <= 0) throw std::runtime_error("Error: Length must be greater than zero.");
+                        op.type = MacroOp::TRANSACT;
+                        op.len = rlen;
+                        data_arg = 2;
+                    }
+                    if ((n == data_arg + 1) && PayloadLibrary::is_reference(tokens[data_arg])) {
+                        const PayloadLibrary::Payload& payload = find_payload(tokens[data_arg]);
+                        op.data.assign(payload.data, payload.len);
+                    } else {
+                        op.data = PayloadLibrary::unescape(text_after_tokens(line, data_arg));
+                        if (in_mode == HEX) op.data = convert_asciihex_to_hexhex(op.data);
+                    }
+                } else if ((n == 2) && (upper[0].compare("READ") == 0)) {
+                    int len = stoi(tokens[1]);
+                    if (len <= 0) throw std::runtime_error("Error: Length must be greater than zero.");
+                    op.type = MacroOp::READ;
+                    op.len = len;
+                } else if ((n == 1) && (upper[0].compare("QUIT") == 0)) {
+                    throw std::runtime_error("Error: QUIT cannot be used in a macro.");
+                }
+            } catch (std::logic_error &e) {
+                throw std::runtime_error("Error: Line " + std::to_string(i + 1) + " of the macro (" + line + ") has an invalid number.");
+            } catch (std::runtime_error &e) {
+                throw std::runtime_error(std::string(e.what()) + " (line " + std::to_string(i + 1) + " of the macro: " + line + ")");
+            }
+            ops.push_back(op);
+        }
+        return ops;
+    }
+
+    // Runs one compiled macro line; show is false for all runs but the last, so that only its output is shown
+    bool SimTerminal::run_macro_op(const MacroOp& op, bool show, std::stringstream& ss)
+    {
+        OperationResult result;
+        switch (op.type) {
+        case MacroOp::SELECT_BUS:
+            if ((op.bus_type != _bus_type) || (op.text.compare(_bus_name) != 0)) select_bus(op.bus_type, op.text);
+            return true;
+        case MacroOp::SELECT_TARGET:
+            {
+                std::string error;
+                if ((op.text.compare(_other_node_name) == 0) || select_target(op.text, error)) return true;
+                command_error(ss) << error << std::endl;
+                return false;
+            }
+        case MacroOp::COMMAND:
+            {
+                bool failed_before = _command_result.error;
+                _command_result.error = false;
+                std::string output = process_command(op.text);
+                bool failed = _command_result.error;
+                _command_result.error = failed_before || failed;
+                if (show || failed) ss << output;
+                return !failed;
+            }
+        case MacroOp::WRITE:
+            result = write(ByteSpan(op.data));
+            break;
+        case MacroOp::READ:
+            result = read(op.len);
+            break;
+        default:
+            result = transact(ByteSpan(op.data), op.len);
+            break;
+        }
+        if (!result.ok) {
+            report_operation(ss, result);
+            if (result.error.size() == 0) command_error(ss) << "Result: " << bus_result_as_string(result.result) << std::endl;
+            return false;
+        }
+        if (show) {
+            report_operation(ss, result);
+            if (result.data.size() > 0) command_payload(ss, result.data.data(), result.data.size());
+        }
+        return true;
+    }
+
+    // RUN <name> [<times>] [<param>=<value> ...]
+    void SimTerminal::run_command(const std::vector<std::string>& tokens, std::stringstream& ss)
+    {
+        const std::string& name = tokens[1];
+        unsigned long times = 1;
+        std::map<std::string, std::string> values;
+        try {
+            size_t arg = 2;
+            if ((tokens.size() > 2) && (tokens[2].find('=') == std::string::npos)) {
+                times = stoul(tokens[2]);
+                if ((times == 0) || (times > _MAX_MACRO_RUNS)) {
+                    command_error(ss) << "Error: <times> must be from 1 to " << _MAX_MACRO_RUNS << "." << std::endl;
+                    return;
+                }
+                arg = 3;
+            }
+            for (; arg < tokens.size(); arg++) {
+                size_t equals = tokens[arg].find('=');
+                if ((equals == std::string::npos) || (equals == 0)) throw std::invalid_argument(tokens[arg]);
+                values[tokens[arg].substr(0, equals)] = tokens[arg].substr(equals + 1);
+            }
+        } catch (std::logic_error &e) {
+            command_error(ss) << "Usage: RUN <name> [<times>] [<param>=<value> ...]" << std::endl;
+            return;
+        }
+        if (_macro_depth >= _MAX_MACRO_DEPTH) {
+            command_error(ss) << "Error: Macros are nested more than " << _MAX_MACRO_DEPTH << " deep." << std::endl;
+            return;
+        }
+
+        std::vector<MacroOp> ops;
+        try {
+            ops = compile_macro(_macros.expand(name, values));
+        } catch (std::runtime_error &e) {
+            command_error(ss) << e.what() << std::endl;
+            return;
+        }
+
+        _macro_depth++;
+        bool outer = _transaction_in_progress;
+        if (!outer) {
+            _interrupted = false;
+            _transaction_in_progress = true;
+        }
+        unsigned long runs = 0;
+        double total = 0, least = 0, most = 0;
+        bool failed = false;
+        for (unsigned long run = 0; (run < times) && !failed; run++) {
+            if (command_cancelled()) {
+                command_error(ss) << "Cancelled after " << run << " runs." << std::endl;
+                break;
+            }
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (const MacroOp& op : ops) {
+                if (!run_macro_op(op, run + 1 == times, ss)) {
+                    ss << "(" << name << " run " << (run + 1) << ", line " << op.line << ")" << std::endl;
+                    failed = true;
+                    break;
+                }
+            }
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            total += ms;
+            least = (runs == 0) ? ms : std::min(least, ms);
+            most = std::max(most, ms);
+            runs++;
+        }
+        if (!outer) _transaction_in_progress = false;
+        _macro_depth--;
+
+        if (runs == 0) return;
+        char line[160];
+        snprintf(line, sizeof(line), "%s: %lu runs of %zu operations in %.3f ms; per run min %.3f, mean %.3f, max %.3f ms\n",
+                 name.c_str(), runs, ops.size(), total, least, total / runs, most);
+        ss << line;
+    }
+
+    // STRESS <operations> [<option>=<value> ...]
+    void SimTerminal::stress_command(const std::vector<std::string>& tokens, std::stringstream& ss)
+    {
+        std::shared_ptr<BusConnection> bus = acquire_bus_connection(ss);
+        if (!bus) return;
+        ConnectParameters params;
+        {
+            std::lock_guard<std::mutex> lock(_connection_mutex);
+            params = _connect_params;
+        }
+
+        StressGenerator::Options options;
+        options.seed = static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count());
+        options.workers = 4;
+        // by default only the operations the bus supports
+        options.mix[0] = 1;
+        options.mix[1] = ((params.bus_type == I2C) || (params.bus_type == CAN) || (params.bus_type == SPI)) ? 1 : 0;
+        options.mix[2] = (params.bus_type == UART) ? 0 : 1;
+        StressGenerator::SizeRange sizes = {1, 16};
+        options.sizes.push_back(sizes);
+        options.gap_us = 0;
+        try {
+            StressGenerator::parse(tokens, 1, options);
+        } catch (std::runtime_error &e) {
+            command_error(ss) << e.what() << std::endl;
+            return;
+        }
+        if (options.repro_path.size() == 0) options.repro_path = "stress_repro_" + std::to_string(options.seed) + ".txt";
+
+        for (const std::string& target : options.targets) {
+            if (!bus->is_valid_target(target)) {
+                command_error(ss) << bus->invalid_target_message(target) << std::endl;
+                return;
+            }
+        }
+
+        // every worker is a node of its own on the bus, named or addressed apart from the terminal; I2C and CAN
+        // workers are masters whose addresses must not be the terminal's, a target's or each other's
+        std::vector<std::string> worker_nodes;
+        if ((params.bus_type == I2C) || (params.bus_type == CAN)) {
+            long range = (params.bus_type == I2C) ? 128 : 0x20000000;
+            if (options.masters.empty()) {
+                for (size_t w = 0; w < options.workers; w++) options.masters.push_back((params.master_address + 1 + w) % range);
+            }
+            std::set<long> taken;
+            taken.insert(params.master_address);
+            for (const std::string& target : options.targets.empty() ? std::vector<std::string>(1, params.target) : options.targets) {
+                int address;
+                uint32_t id;
+                if ((params.bus_type == I2C) && I2CConnection::parse_address(target, address)) taken.insert(address);
+                if ((params.bus_type == CAN) && CANConnection::parse_identifier(target, id)) taken.insert(id);
+            }
+            for (size_t w = 0; w < options.workers; w++) {
+                if ((options.masters[w] >= range) || !taken.insert(options.masters[w]).second) {
+                    command_error(ss) << "Error: Stress worker " << w << "'s master address " << options.masters[w]
+                                      << " is out of range or is the terminal's, a target's or another worker's; give the workers"
+                                      << " addresses of their own with MASTERS=." << std::endl;
+                    return;
+                }
+                worker_nodes.push_back(std::to_string(options.masters[w]));
+            }
+        } else if (!options.masters.empty()) {
+            command_error(ss) << "Error: MASTERS only applies to I2C and CAN buses." << std::endl;
+            return;
+        } else {
+            for (size_t w = 0; w < options.workers; w++) worker_nodes.push_back(params.node_name + "-stress-" + std::to_string(w));
+        }
+
+        // the workers connect in the background like the terminal does, and are waited for up to the command deadline;
+        // connections that come up after it are released by the thread that made them
+        struct Connects {
+            std::mutex mutex;
+            std::condition_variable cv;
+            size_t done;
+            std::vector<std::shared_ptr<BusConnection>> connections;
+            std::vector<std::string> errors;
+        };
+        std::shared_ptr<Connects> connects = std::make_shared<Connects>();
+        connects->done = 0;
+        connects->connections.resize(options.workers);
+        connects->errors.resize(options.workers);
+        for (size_t w = 0; w < options.workers; w++) {
+            ConnectParameters worker_params = params;
+            worker_params.node_name = worker_nodes[w];
+            if ((params.bus_type == I2C) || (params.bus_type == CAN)) worker_params.master_address = options.masters[w];
+            worker_params.verbose = false;
+            std::thread([connects, worker_params, w, timeout_ms = _connect_timeout_ms] {
+                std::shared_ptr<BusConnection> connection;
+                std::string error;
+                open_bus_connection(worker_params, timeout_ms, connection, error);
+                std::lock_guard<std::mutex> lock(connects->mutex);
+                connects->connections[w] = connection;
+                connects->errors[w] = error;
+                connects->done++;
+                connects->cv.notify_all();
+            }).detach();
+        }
+        _interrupted = false;
+        _transaction_in_progress = true;
+        std::vector<std::shared_ptr<BusConnection>> connections;
+        std::stringstream connect_error;
+        {
+            std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_command_deadline_ms);
+            std::unique_lock<std::mutex> lock(connects->mutex);
+            while ((connects->done < options.workers) && !command_cancelled() && (std::chrono::steady_clock::now() < deadline)) {
+                connects->cv.wait_for(lock, std::chrono::milliseconds(100));
+            }
+            connections = connects->connections;
+            for (size_t w = 0; (w < options.workers) && (connect_error.tellp() == 0); w++) {
+                if (!connects->errors[w].empty()) connect_error << "Error: Could not connect stress worker " << w << ": " << connects->errors[w];
+            }
+            if ((connect_error.tellp() == 0) && (connects->done < options.workers)) {
+                if (command_cancelled()) connect_error << "Cancelled while connecting the stress workers.";
+                else connect_error << "Error: The stress workers were not all connected after " << _command_deadline_ms << " ms.";
+            }
+        }
+        if (connect_error.tellp() != 0) {
+            _transaction_in_progress = false;
+            for (std::shared_ptr<BusConnection>& connection : connections) if (connection) release_in_background(connection);
+            command_error(ss) << connect_error.str() << std::endl;
+            return;
+        }
+        for (std::shared_ptr<BusConnection>& connection : connections) connection->set_traffic(&_traffic);
+
+        std::atomic<bool> stop(false);
+        std::vector<StressTally> tallies(options.workers);
+        std::vector<std::future<void>> workers;
+        std::unique_lock<std::mutex> bus_op_lock(_bus_op_mutex); // embedded bus operations wait for the run
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t w = 0; w < options.workers; w++) {
+            workers.push_back(std::async(std::launch::async, [&options, &connections, &tallies, &stop, w]{
+                StressGenerator generator(options, w);
+                visit_bus_connection(*connections[w], [&](auto& connection) {run_stress_stream(connection, generator, w, tallies[w], stop);});
+            }));
+        }
+        std::string worker_error;
+        for (size_t w = 0; w < workers.size(); w++) {
+            while (workers[w].wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+                if (command_cancelled()) stop = true;
+            }
+            try {
+                workers[w].get();
+            } catch (std::exception &e) {
+                if (worker_error.empty()) worker_error = "Error: Stress worker " + std::to_string(w) + " stopped: " + e.what();
+            }
+        }
+        _transaction_in_progress = false;
+        bus_op_lock.unlock();
+        double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (std::shared_ptr<BusConnection>& connection : connections) {
+            connection->set_traffic(nullptr);
+            release_in_background(connection);
+        }
+
+        StressTally total;
+        for (const StressTally& tally : tallies) total.merge(tally);
+        ss << total.report(options, elapsed_s);
+        if (stop) ss << "Cancelled before all operations ran." << std::endl;
+        if (worker_error.size() > 0) command_error(ss) << worker_error << std::endl;
+        if (total.failed()) {
+            std::string error = total.write_repro(options, _bus_type_string[params.bus_type], params.bus_name, worker_nodes);
+            if (error.size() > 0) command_error(ss) << error << std::endl;
+            else ss << "The first failure is written to " << options.repro_path << "." << std::endl;
+        }
+    }
+
+    // CORRELATE ... commands
+    void SimTerminal::correlate_command(const std::vector<std::string>& tokens, const std::vector<std::string>& tokens_upper, std::stringstream& ss)
+    {
+        const std::string& sub = tokens_upper[1];
+        if ((tokens_upper.size() == 2) && (sub.compare("REPORT") == 0)) {
+            ss << _correlator.report();
+            return;
+        }
+        if ((tokens_upper.size() == 2) && (sub.compare("RESET") == 0)) {
+            _correlator.reset();
+            return;
+        }
+        if ((tokens_upper.size() == 2) && (sub.compare("OFF") == 0)) {
+            _correlator.disable();
+            return;
+        }
+
+        Correlator::Matcher matcher = {Correlator::ORDER, 0, 0, 1};
+        size_t timeout_arg = 2;
+        try {
+            if (sub.compare("CCSDS") == 0) {
+                matcher.by = Correlator::CCSDS;
+            } else if (sub.compare("OFFSET") == 0) {
+                if (tokens.size() < 5) throw std::invalid_argument("missing arguments");
+                matcher.by = Correlator::OFFSET;
+                matcher.request_offset = stoul(tokens[2]);
+                matcher.response_offset = stoul(tokens[3]);
+                matcher.width = stoul(tokens[4]);
+                if ((matcher.width < 1) || (matcher.width > 4)) throw std::out_of_range("width");
+                timeout_arg = 5;
+            } else if (sub.compare("ORDER") != 0) {
+                command_error(ss) << "Unrecognized CORRELATE command. Type \"HELP\" for help." << std::endl;
+                return;
+            }
+            if (tokens.size() > timeout_arg + 1) throw std::invalid_argument("too many arguments");
+            std::chrono::milliseconds timeout(5000);
+            if (tokens.size() == timeout_arg + 1) timeout = TransactionEngine::parse_duration(tokens[timeout_arg]);
+            _correlator.enable(matcher, timeout);
+        } catch (std::logic_error &e) {
+            command_error(ss) << "Usage: CORRELATE <ORDER|CCSDS|OFFSET <request offset> <reply offset> <width 1-4>> [<timeout>]" << std::endl;
+        }
+    }
+
+    // MONITOR ... commands.  The live view is redrawn from an event loop timer, so summing the per-thread counts happens
+    // on the display thread and never on the threads that count.
+    void SimTerminal::monitor_command(const std::vector<std::string>& tokens, const std::vector<std::string>& tokens_upper, std::stringstream& ss)
+    {
+        const std::string sub = (tokens_upper.size() == 2) ? tokens_upper[1] : "";
+        if (sub.compare("OFF") == 0) {
+            if (_traffic_timer != 0) _event_loop.cancel_timer(_traffic_timer);
+            _traffic_timer = 0;
+        } else if (sub.compare("SNAPSHOT") == 0) {
+            double interval_s;
+            std::vector<TrafficMonitor::Row> rows = _traffic.snapshot(_traffic_snapshot, interval_s);
+            ss << TrafficMonitor::table_as_string(rows, interval_s);
+        } else if (sub.compare("RESET") == 0) {
+            _traffic.reset();
+        } else if (_terminal_type != STDIO) {
+            command_error(ss) << "The live MONITOR view needs the STDIO terminal; use MONITOR SNAPSHOT." << std::endl;
+        } else {
+            std::chrono::milliseconds refresh(1000);
+            try {
+                if ((sub.size() > 0) && (sub.compare("ON") != 0)) refresh = TransactionEngine::parse_duration(tokens[1]);
+                if (refresh.count() <= 0) throw std::invalid_argument("refresh");
+            } catch (std::logic_error &e) {
+                command_error(ss) << "Invalid refresh period: " << tokens[1] << "." << std::endl;
+                return;
+            }
+            if (_traffic_timer != 0) _event_loop.cancel_timer(_traffic_timer);
+            double ignored;
+            _traffic.snapshot(_traffic_live, ignored); // the first interval starts now
+            _traffic_timer = _event_loop.add_timer(refresh, [this]{
+                double interval_s;
+                std::vector<TrafficMonitor::Row> rows = _traffic.snapshot(_traffic_live, interval_s);
+                _event_loop.print("\033[H\033[2J" + TrafficMonitor::table_as_string(rows, interval_s) + "Type MONITOR OFF to stop.\n");
+            });
+        }
+    }
+
+    // REG numbers follow the bus rules (decimal, or hex with a 0x prefix); ranges are checked by the caller
+    static unsigned long register_number(const std::string& token)
+    {
+        int number;
+        if (!parse_bus_number(token, 0, 0x7FFFFFFF, number)) throw std::invalid_argument(token);
+        return number;
+    }
+
+    // REG ... commands for register-mapped I2C devices; the device address is given per command, not the sim node
+    void SimTerminal::register_command(const std::vector<std::string>& tokens, const std::vector<std::string>& tokens_upper, std::stringstream& ss)
+    {
+        const std::string& sub = tokens_upper[1];
+        if ((tokens_upper.size() == 3) && (sub.compare("MAP") == 0)) {
+            std::lock_guard<std::mutex> lock(_bus_op_mutex);
+            try {
+                _registers.load(tokens[2]);
+                ss << "Loaded " << _registers.size() << " registers from " << tokens[2] << "." << std::endl;
+            } catch (std::runtime_error &e) {
+                command_error(ss) << e.what() << std::endl;
+            }
+            return;
+        }
+        if ((tokens_upper.size() == 3) && (sub.compare("CACHE") == 0)) {
+            std::lock_guard<std::mutex> lock(_bus_op_mutex);
+            if (tokens_upper[2].compare("ON") == 0) _registers.set_cache_enabled(true);
+            else if (tokens_upper[2].compare("OFF") == 0) _registers.set_cache_enabled(false);
+            else if (tokens_upper[2].compare("CLEAR") == 0) _registers.clear_cache();
+            else command_error(ss) << "Usage: REG CACHE <ON|OFF|CLEAR>" << std::endl;
+            return;
+        }
+        if ((tokens_upper.size() == 3) && (sub.compare("WATCH") == 0) && (tokens_upper[2].compare("LIST") == 0)) {
+            std::map<unsigned, RegisterWatcher::Watch> watches = _register_watcher.watches();
+            if (watches.empty()) ss << "No register watches." << std::endl;
+            for (std::map<unsigned, RegisterWatcher::Watch>::const_iterator it = watches.begin(); it != watches.end(); it++) {
+                ss << "    id=" << it->first << ", device=0x" << std::hex << it->second.device << ", start=0x" << it->second.start << std::dec
+                   << ", count=" << it->second.count << ", period=" << it->second.period.count() << "ms" << std::endl;
+            }
+            return;
+        }
+        if ((tokens_upper.size() == 3) && (sub.compare("UNWATCH") == 0)) {
+            if (tokens_upper[2].compare("ALL") == 0) {
+                _register_watcher.clear();
+                return;
+            }
+            try {
+                if (!_register_watcher.remove(stoul(tokens[2]))) command_error(ss) << "No register watch " << tokens[2] << "." << std::endl;
+            } catch (std::logic_error &e) {
+                command_error(ss) << "Usage: REG UNWATCH <id|ALL>" << std::endl;
+            }
+            return;
+        }
+
+        // everything else uses the bus
+        bool reading = (tokens_upper.size() == 5) && (sub.compare("READ") == 0);
+        bool writing = (tokens_upper.size() >= 5) && (sub.compare("WRITE") == 0);
+        bool watching = (tokens_upper.size() >= 5) && (tokens_upper.size() <= 6) && (sub.compare("WATCH") == 0);
+        if (!reading && !writing && !watching) {
+            command_error(ss) << "Unrecognized REG command. Type \"HELP\" for help." << std::endl;
+            return;
+        }
+        try {
+            unsigned long device_number = register_number(tokens[2]);
+            unsigned long start_number = register_number(tokens[3]);
+            size_t count = writing ? (tokens.size() - 4) : register_number(tokens[4]);
+            // checked before anything is sized by it
+            RegisterMap::check_range(device_number, start_number, count);
+            int device = device_number;
+            int start = start_number;
+            std::vector<uint8_t> values;
+            if (writing) {
+                for (size_t i = 4; i < tokens.size(); i++) {
+                    unsigned long value = register_number(tokens[i]);
+                    if (value > 0xff) throw std::out_of_range("register value");
+                    values.push_back(value);
+                }
+            } else {
+                values.resize(count);
+            }
+            std::chrono::milliseconds period(1000);
+            if (tokens.size() == 6) period = TransactionEngine::parse_duration(tokens[5]);
+
+            std::shared_ptr<BusConnection> bus = acquire_bus_connection(ss);
+            if (!bus) return;
+            if (bus->kind() != BusConnection::I2C_KIND) {
+                command_error(ss) << "REG commands need the I2C bus type; set it with SET SIMBUSTYPE I2C." << std::endl;
+                return;
+            }
+            I2CConnection& i2c = static_cast<I2CConnection&>(*bus);
+            std::unique_lock<std::mutex> lock(_bus_op_mutex);
+            BusResult result;
+            unsigned transactions = 0;
+            std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+            if (writing) {
+                result = _registers.write(i2c, device, start, values.data(), values.size());
+                transactions = 1;
+            } else {
+                result = _registers.read(i2c, device, start, values.size(), values.data(), reading, transactions);
+            }
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+            command_result(result);
+            if (result != BUS_SUCCESS) {
+                command_error(ss) << "Register " << (writing ? "write" : "read") << " failed: " << bus_result_as_string(result) << std::endl;
+                return;
+            }
+            if (writing) return;
+
+            char line[64];
+            for (size_t i = 0; i < values.size(); i++) {
+                const RegisterMap::Register* r = _registers.find(device, start + i);
+                snprintf(line, sizeof(line), "    0x%02X = 0x%02X", static_cast<unsigned>(start + i), values[i]);
+                ss << line;
+                if (r != nullptr) ss << "  " << r->name;
+                ss << std::endl;
+            }
+            lock.unlock();
+            if (reading) {
+                ss << "(" << values.size() << " registers in " << transactions << " transactions, " << ms << " ms)" << std::endl;
+            } else {
+                RegisterWatcher::Watch watch = {device, start, values.size(), period};
+                ss << "Watching as " << _register_watcher.add(watch, values) << "; changes are shown as they happen." << std::endl;
+            }
+            if (_response_format != ResponseEncoder::TEXT) command_payload(ss, reinterpret_cast<const char*>(values.data()), values.size());
+        } catch (std::invalid_argument &e) {
+            command_error(ss) << "Invalid number in REG command." << std::endl;
+        } catch (std::out_of_range &e) {
+            command_error(ss) << "Number out of range in REG command." << std::endl;
+        } catch (std::runtime_error &e) {
+            command_error(ss) << e.what() << std::endl;
+        }
+    }
+
+    // Runs on the watcher thread; uses whatever connection is current and never waits for one
+    BusResult SimTerminal::read_watched_registers(int device, int start, size_t count, uint8_t* values)
+    {
+        std::shared_ptr<BusConnection> bus = current_bus_connection();
+        if (!bus || (bus->kind() != BusConnection::I2C_KIND)) return BUS_UNSUPPORTED;
+        std::lock_guard<std::mutex> lock(_bus_op_mutex);
+        unsigned transactions;
+        return _registers.read(static_cast<I2CConnection&>(*bus), device, start, count, values, false, transactions);
+    }
+
+    // Text mode prints the changes with register names; the structured formats get a watch record, failures included
+    void SimTerminal::report_register_changes(unsigned id, const RegisterWatcher::Watch& watch, const std::vector<RegisterWatcher::Change>& changes, BusResult result)
+    {
+        std::string record;
+        ResponseEncoder::Format format = _response_format;
+        if (format != ResponseEncoder::TEXT) {
+            std::vector<uint8_t> triples;
+            triples.reserve(3 * changes.size());
+            for (const RegisterWatcher::Change& change : changes) {
+                triples.push_back(change.reg);
+                triples.push_back(change.old_value);
+                triples.push_back(change.new_value);
+            }
+            ResponseEncoder::WatchEvent event = {id, static_cast<uint8_t>(watch.device),
+                static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count()),
+                result, triples.data(), changes.size()};
+            ResponseEncoder::encode_watch(format, event, record);
+            deliver_unsolicited(record);
+            return;
+        }
+
+        char line[64];
+        snprintf(line, sizeof(line), "0x%02X", watch.device);
+        std::string device(line);
+        std::stringstream ss;
+        if (result != BUS_SUCCESS) {
+            ss << "REG WATCH " << id << ": reading device " << device << " failed: " << bus_result_as_string(result) << std::endl;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_bus_op_mutex); // guards the register map
+            for (const RegisterWatcher::Change& change : changes) {
+                snprintf(line, sizeof(line), "REG %s 0x%02X: 0x%02X -> 0x%02X", device.c_str(), change.reg, change.old_value, change.new_value);
+                ss << line;
+                const RegisterMap::Register* r = _registers.find(watch.device, change.reg);
+                if (r != nullptr) ss << "  " << r->name;
+                ss << std::endl;
+            }
+        }
+        deliver_unsolicited(ss.str());
+    }
+
+    // Connections are built on a background thread so an unreachable server cannot hang the terminal.  Commands that
+    // need the bus wait for it in acquire_bus_connection, up to the command deadline.
     void SimTerminal::reset_bus_connection(){
-         // Figure out where _old_connection lives and what data structure it belongs to
-         if (_bus_type == I2C){
-            int master_address;
+        NOS3_TRACE_SPAN("reset_bus_connection");
+        int master_address = 0;
+        if ((_bus_type == I2C) || (_bus_type == CAN)){
             try{
                 master_address = stoi(_command_node_name);
             }catch(std::invalid_argument &e){
+                // logged rather than printed, since stdout may be carrying JSONL or binary records
+                Nos3::sim_logger->warning("SimTerminal::reset_bus_connection: \"%s\" is not a valid %s address for the terminal. Defaulting to 127.",
+                    _command_node_name.c_str(), _bus_type_string[_bus_type].c_str());
                 master_address = 127;
                 _command_node_name = "127";
-                std::cout << "\"" << _command_node_name << "\" is not a valid I2C address for the terminal. Defaulting to 127." << std::endl;
-            }
-            // if old connection exists, free it
-            if (_bus_connection.get() != nullptr) {
-                BusConnection* old = _bus_connection.release();
-                delete old;
-                // Nos3::sim_logger->debug("reset_bus_connection: deleting old bus connection");
-            }
-            
-            I2CConnection* i2c = new I2CConnection(master_address, _nos_connection_string, _bus_name);
-            _bus_connection.reset(i2c);
-        } else if (_bus_type == CAN){
-            int master_identifier;
-            try{
-                master_identifier = stoi(_command_node_name);
-            }catch(std::invalid_argument &e){
-                master_identifier = 127;
-                _command_node_name = "127";
-                std::cout << "\"" << _command_node_name << "\" is not a valid CAN identifier for the terminal. Defaulting to 127." << std::endl;
-            }
-            // if old connection exists, free it
-            if (_bus_connection.get() != nullptr) {
-                BusConnection* old = _bus_connection.release();
-                delete old;
-                // Nos3::sim_logger->debug("reset_bus_connection: deleting old bus connection");
-            }
-            
-            CANConnection* can = new CANConnection(master_identifier, _nos_connection_string, _bus_name);
-            _bus_connection.reset(can);
-        } else if(_bus_type == SPI){
-            // if old connection exists, free it
-            if (_bus_connection.get() != nullptr) {
-                BusConnection* old = _bus_connection.release();
-                delete old;
-                // Nos3::sim_logger->debug("reset_bus_connection: deleting old bus connection");
-            }
-           _bus_connection.reset(new SPIConnection(_nos_connection_string, _bus_name));
-        }else if(_bus_type == UART){
-            // if old connection exists, free it
-            if (_bus_connection.get() != nullptr) {
-                BusConnection* old = _bus_connection.release();
-                delete old;
-                // Nos3::sim_logger->debug("reset_bus_connection: deleting old bus connection");
-            }
-            _bus_connection.reset(new UartConnection(this, _command_node_name, _nos_connection_string, _bus_name));
-        }else{ // not differentiating between BASE and COMMAND types... yet
-            // if old connection exists, free it
-            if (_bus_connection.get() != nullptr) {
-                BusConnection* old = _bus_connection.release();
-                delete old;
-                // Nos3::sim_logger->debug("reset_bus_connection: deleting old bus connection");
-            }
-            _bus_connection.reset(new BaseConnection(this, _command_node_name, _nos_connection_string, _bus_name));
-        }
-        _bus_connection->set_target(_other_node_name);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(_connection_mutex);
+        _connect_params.bus_type = _bus_type;
+        _connect_params.master_address = master_address;
+        _connect_params.node_name = _command_node_name;
+        _connect_params.connection_string = _nos_connection_string;
+        _connect_params.bus_name = _bus_name;
+        _connect_params.target = _other_node_name;
+        _connect_params.verbose = _bus_messages && (_response_format == ResponseEncoder::TEXT);
+        _reconnect_delay_ms = _reconnect_initial_ms;
+        start_connect();
+        if (_prewarm) prewarm_connections();
+    }
+
+    // _connection_mutex must be held
+    void SimTerminal::start_connect(void){
+        _connect_generation++;
+        _connection_state = CONNECTING;
+        _connect_started = std::chrono::steady_clock::now();
+        std::shared_ptr<BusConnection> old = std::move(_bus_connection);
+        _bus_connection.reset();
+        // a connection being left, parked or released, stops delivering received data straight away
+        if (old) {
+            old->set_receiver(nullptr);
+            old->set_traffic(nullptr);
+        }
+
+        if (_prewarm) {
+            // park the connection being left so that switching back to it is instant
+            if (old) {
+                WarmConnection& parked = _warm_connections[_bus_connection_string];
+                std::swap(parked.connection, old);
+                parked.params_key = _bus_params_key;
+                parked.warmed_at = std::chrono::steady_clock::now();
+                parked.connect_ms = -1;
+            }
+            std::map<std::string, WarmConnection>::iterator warm = _warm_connections.find(_connect_params.connection_string);
+            if ((warm != _warm_connections.end()) && (warm->second.params_key.compare(params_key(_connect_params)) == 0)) {
+                _bus_connection = warm->second.connection;
+                _warm_connections.erase(warm);
+                _bus_connection->set_target(_connect_params.target);
+                _bus_connection->set_verbose(_connect_params.verbose);
+                _bus_connection->set_receiver(this);
+                _bus_connection->set_traffic(&_traffic);
+                _bus_connection_string = _connect_params.connection_string;
+                _bus_params_key = params_key(_connect_params);
+                _connection_state = CONNECTED;
+                _connected_at = std::chrono::steady_clock::now();
+                _connection_error.clear();
+                _connection_cv.notify_all();
+                if (old) release_in_background(old);
+                return;
+            }
+        }
+
+        // the old connection is released on the connect thread too; tearing down a transport can block as well
+        _connects_running++;
+        std::thread(&SimTerminal::connect, _lifeline, _connect_generation, _connect_params, old, _connect_timeout_ms).detach();
+    }
+
+    // Tearing down a transport can block, so connections that are done with are released on a thread of their own
+    void SimTerminal::release_in_background(std::shared_ptr<BusConnection> connection){
+        std::thread([connection]() mutable {connection.reset();}).detach();
+    }
+
+    // Everything that has to match for a warm connection to stand in for a new one, apart from the connection string
+    std::string SimTerminal::params_key(const ConnectParameters& params){
+        std::stringstream ss;
+        ss << _bus_type_string[params.bus_type] << "|" << params.bus_name << "|" << params.node_name << "|" << params.master_address;
+        return ss.str();
+    }
+
+    // Keeps a connection with the current bus settings open to every other known endpoint.  Connections warmed for
+    // other bus settings are released, and endpoints the monitor has seen go down are left alone until they come
+    // back.  _connection_mutex must be held.
+    void SimTerminal::prewarm_connections(void){
+        std::string key = params_key(_connect_params);
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::vector<std::shared_ptr<BusConnection>> stale;
+        for (std::map<std::string, WarmConnection>::iterator it = _warm_connections.begin(); it != _warm_connections.end(); ) {
+            ConnectionMonitor::EndpointStatus status = _monitor->status(it->first);
+            bool down = status.probed && !status.reachable && (status.last_probe > it->second.warmed_at);
+            if ((it->second.params_key.compare(key) != 0) || down) {
+                stale.push_back(it->second.connection);
+                it = _warm_connections.erase(it);
+            } else {
+                it++;
+            }
+        }
+        for (std::shared_ptr<BusConnection>& connection : stale) release_in_background(std::move(connection));
+
+        for (const std::string& connection_string : _prewarm_targets) {
+            if ((connection_string.compare(_connect_params.connection_string) == 0) ||
+                (_warm_connections.find(connection_string) != _warm_connections.end()) ||
+                (_warming.find(connection_string) != _warming.end())) continue;
+            std::map<std::string, std::chrono::steady_clock::time_point>::const_iterator retry = _warm_retry_at.find(connection_string);
+            if ((retry != _warm_retry_at.end()) && (now < retry->second)) continue;
+            ConnectionMonitor::EndpointStatus status = _monitor->status(connection_string);
+            if (status.probed && !status.reachable) continue;
+
+            ConnectParameters params = _connect_params;
+            params.connection_string = connection_string;
+            _warming.insert(connection_string);
+            std::thread(&SimTerminal::warm_connection, _lifeline, params, _connect_timeout_ms).detach();
+        }
+    }
+
+    // Probes the endpoint, then builds the connection; false with error set if either fails
+    bool SimTerminal::open_bus_connection(const ConnectParameters& params, int timeout_ms, std::shared_ptr<BusConnection>& connection, std::string& error){
+        double rtt_ms;
+        if (!probe_endpoint(params.connection_string, timeout_ms, rtt_ms, error)) return false;
+        try {
+            connection = make_bus_connection(params);
+        } catch (std::exception& e) {
+            error = e.what();
+        } catch (...) {
+            error = "unknown error while creating the bus connection";
+        }
+        return connection != nullptr;
+    }
+
+    // The connect and warm threads only touch the terminal through the lifeline, so that the terminal can go away
+    // while one of them is stuck in the bus
+    void SimTerminal::warm_connection(std::shared_ptr<Lifeline> lifeline, ConnectParameters params, int timeout_ms){
+        std::string error;
+        std::shared_ptr<BusConnection> connection; // released after the locks if it is not kept
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        open_bus_connection(params, timeout_ms, connection, error);
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> lifeline_lock(lifeline->mutex);
+        if (lifeline->terminal) lifeline->terminal->warmed(params, connection, error, start, end);
+    }
+
+    void SimTerminal::warmed(const ConnectParameters& params, const std::shared_ptr<BusConnection>& connection, const std::string& error,
+                             std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end){
+        std::lock_guard<std::mutex> lock(_connection_mutex);
+        _warming.erase(params.connection_string);
+        if (!connection) {
+            sim_logger->info("SimTerminal: could not prewarm %s: %s", params.connection_string.c_str(), error.c_str());
+            _warm_retry_at[params.connection_string] = end + std::chrono::milliseconds(_reconnect_max_ms);
+        } else if ((params_key(params).compare(params_key(_connect_params)) == 0) &&
+                   (params.connection_string.compare(_connect_params.connection_string) != 0)) {
+            WarmConnection& warm = _warm_connections[params.connection_string];
+            warm.params_key = params_key(params);
+            warm.connection = connection;
+            warm.warmed_at = end;
+            warm.connect_ms = std::chrono::duration<double, std::milli>(end - start).count();
+            _warm_retry_at.erase(params.connection_string);
+        } // else the bus settings changed while warming; the connection is released by the warm thread
+    }
+
+    void SimTerminal::connect(std::shared_ptr<Lifeline> lifeline, unsigned generation, ConnectParameters params, std::shared_ptr<BusConnection> old, int timeout_ms){
+        old.reset();
+        std::string error;
+        std::shared_ptr<BusConnection> connection; // released after the locks if it is not kept
+        open_bus_connection(params, timeout_ms, connection, error);
+
+        std::lock_guard<std::mutex> lifeline_lock(lifeline->mutex);
+        if (lifeline->terminal) lifeline->terminal->connected(generation, params, connection, error);
+    }
+
+    void SimTerminal::connected(unsigned generation, const ConnectParameters& params, const std::shared_ptr<BusConnection>& connection, const std::string& error){
+        std::lock_guard<std::mutex> lock(_connection_mutex);
+        _connects_running--;
+        if (generation != _connect_generation) return; // superseded while connecting; connection is dropped unused
+        if (connection) {
+            connection->set_receiver(this);
+            connection->set_traffic(&_traffic);
+            _bus_connection = connection;
+            _bus_connection_string = params.connection_string;
+            _bus_params_key = params_key(params);
+            _connection_state = CONNECTED;
+            _connected_at = std::chrono::steady_clock::now();
+            _connection_error.clear();
+            _reconnect_delay_ms = _reconnect_initial_ms;
+            _connection_cv.notify_all();
+        } else {
+            connection_failed(error);
+        }
+    }
+
+    // _connection_mutex must be held
+    void SimTerminal::connection_failed(const std::string& error){
+        _connection_state = FAILED;
+        _connection_error = error;
+        _retry_at = std::chrono::steady_clock::now() + std::chrono::milliseconds(_reconnect_delay_ms);
+        sim_logger->error("SimTerminal: connection to %s failed: %s; retrying in %d ms", _connect_params.connection_string.c_str(), error.c_str(), _reconnect_delay_ms);
+        std::stringstream ss;
+        ss << "Connection to " << _connect_params.connection_string << " failed: " << error
+           << "; retrying in " << _reconnect_delay_ms << " ms." << std::endl;
+        // the structured formats have no record for it, and it is logged anyway
+        if (_response_format == ResponseEncoder::TEXT) deliver_unsolicited(ss.str());
+        _reconnect_delay_ms = std::min(_reconnect_delay_ms * 2, _reconnect_max_ms);
+        _connection_cv.notify_all();
+    }
+
+    // Runs on the connection monitor thread
+    void SimTerminal::service_connection(void){
+        std::shared_ptr<BusConnection> dropped; // released after the lock
+        std::lock_guard<std::mutex> lock(_connection_mutex);
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if ((_connection_state == CONNECTING) && (now - _connect_started > std::chrono::milliseconds(_connect_timeout_ms))) {
+            std::stringstream ss;
+            ss << "timed out after " << _connect_timeout_ms << " ms";
+            _connect_generation++; // a late result from the stuck attempt is discarded
+            connection_failed(ss.str());
+        } else if ((_connection_state == FAILED) && (now >= _retry_at) && (_connects_running < _MAX_CONNECTS_RUNNING)) {
+            // retries wait while earlier attempts are still stuck in the bus, so that they cannot pile up
+            start_connect();
+        } else if (_connection_state == CONNECTED) {
+            ConnectionMonitor::EndpointStatus status = _monitor->status(_connect_params.connection_string);
+            if (status.probed && !status.reachable && (status.last_probe > _connected_at)) {
+                dropped = std::move(_bus_connection);
+                _bus_connection.reset();
+                dropped->set_receiver(nullptr);
+                dropped->set_traffic(nullptr);
+                connection_failed("heartbeat failed: " + status.error);
+            }
+        }
+        if (_prewarm) prewarm_connections();
+    }
+
+    // The connection starts without a receiver; see BusConnection::set_receiver
+    std::shared_ptr<BusConnection> SimTerminal::make_bus_connection(const ConnectParameters& params){
+        std::shared_ptr<BusConnection> connection;
+        std::shared_ptr<NosEngine::Transport::TransportHub> hub = TransportRegistry::acquire(params.connection_string);
+        if (params.bus_type == I2C){
+            connection.reset(new I2CConnection(params.master_address, params.connection_string, params.bus_name, hub));
+        } else if (params.bus_type == CAN){
+            connection.reset(new CANConnection(params.master_address, params.connection_string, params.bus_name, hub));
+        } else if (params.bus_type == SPI){
+            connection.reset(new SPIConnection(params.connection_string, params.bus_name, hub));
+        } else if (params.bus_type == UART){
+            connection.reset(new UartConnection(params.node_name, params.connection_string, params.bus_name, hub));
+        } else { // not differentiating between BASE and COMMAND types... yet
+            connection.reset(new BaseConnection(params.node_name, params.connection_string, params.bus_name, hub));
+        }
+        connection->set_target(params.target);
+        connection->set_verbose(params.verbose);
+        return connection;
+    }
+
+    // Waits up to the command deadline for the connection to come up; on timeout explains why in error
+    std::shared_ptr<BusConnection> SimTerminal::acquire_bus_connection(std::string& error){
+        std::unique_lock<std::mutex> lock(_connection_mutex);
+        if (!_connection_cv.wait_for(lock, std::chrono::milliseconds(_command_deadline_ms), [this]{return _connection_state == CONNECTED;})) {
+            std::stringstream ss;
+            ss << "Connection to " << _connect_params.connection_string << " is " << _connection_state_string[_connection_state];
+            if (_connection_error.size() > 0) ss << " (" << _connection_error << ")";
+            ss << "; command dropped after waiting " << _command_deadline_ms << " ms.";
+            error = ss.str();
+            return nullptr;
+        }
+        return _bus_connection;
+    }
+
+    std::shared_ptr<BusConnection> SimTerminal::acquire_bus_connection(std::stringstream& ss){
+        std::string error;
+        std::shared_ptr<BusConnection> bus = acquire_bus_connection(error);
+        if (!bus) command_error(ss) << error << std::endl;
+        return bus;
+    }
+
+    std::shared_ptr<BusConnection> SimTerminal::current_bus_connection(void){
+        std::lock_guard<std::mutex> lock(_connection_mutex);
+        return _bus_connection;
+    }
+
+    // A transaction given up on while still in the bus leaves its connection in use by the engine's worker, so the
+    // connection is dropped, never parked, and a fresh one is made for the next command.  _bus_op_mutex must be held.
+    void SimTerminal::retire_bus_connection(const std::shared_ptr<BusConnection>& bus){
+        std::shared_ptr<BusConnection> retired; // released after the lock, by whichever of this and the worker is last
+        std::lock_guard<std::mutex> lock(_connection_mutex);
+        if (_bus_connection != bus) return;
+        retired = std::move(_bus_connection);
+        _bus_connection.reset();
+        retired->set_receiver(nullptr);
+        retired->set_traffic(nullptr);
+        start_connect();
+    }
+
+    std::string SimTerminal::connection_status(void){
+        std::stringstream ss;
+        {
+            std::lock_guard<std::mutex> lock(_connection_mutex);
+            ss << "Active: " << _active_connection_name << " (" << _connect_params.connection_string << "), bus "
+               << _connect_params.bus_name << " (" << _bus_type_string[_connect_params.bus_type] << "): "
+               << _connection_state_string[_connection_state];
+            if (_connection_error.size() > 0) ss << " (" << _connection_error << ")";
+            ss << std::endl;
+        }
+        ss << list_connections();
+        ss << TransactionEngine::stats_as_string(_transactions.stats());
+        ss << "Transaction timeout " << _transaction_policy.timeout.count() << " ms, " << _transaction_policy.retries
+           << " retries with backoff up to " << _transaction_policy.max_backoff.count() << " ms" << std::endl;
+        return ss.str();
+    }
+
+    std::string SimTerminal::list_connections(void){
+        std::stringstream ss;
+        for (std::map<std::string, std::string>::const_iterator it = _connection_strings.begin(); it != _connection_strings.end(); it++) {
+            ConnectionMonitor::EndpointStatus status = _monitor->status(it->second);
+            ss << "    name=" << it->first << ", connection string=" << it->second << ", ";
+            if (!status.probed) {
+                ss << "not probed yet";
+            } else if (!status.reachable) {
+                ss << "unreachable (" << status.error << ")";
+            } else if (status.rtt_ms < 0) {
+                ss << "reachable, rtt=n/a";
+            } else {
+                ss << "reachable, rtt=" << status.rtt_ms << " ms";
+            }
+            std::lock_guard<std::mutex> lock(_connection_mutex);
+            std::map<std::string, WarmConnection>::const_iterator warm = _warm_connections.find(it->second);
+            if ((_connection_state == CONNECTED) && (it->second.compare(_bus_connection_string) == 0)) {
+                ss << ", active";
+            } else if (warm != _warm_connections.end()) {
+                ss << ", warm";
+                if (warm->second.connect_ms >= 0) ss << " (connected in " << warm->second.connect_ms << " ms)";
+            } else if (_warming.find(it->second) != _warming.end()) {
+                ss << ", warming";
+            }
+            ss << std::endl;
+        }
+        return ss.str();
     }
 
     std::string SimTerminal::mode_as_string(void)
@@ -558,6 +2459,7 @@ namespace Nos3
 
     std::string SimTerminal::convert_asciihex_to_hexhex(std::string in)
     {
+        NOS3_TRACE_SPAN("hex decode");
         std::string out;
         in.push_back('0'); // in case there are an odd number of characters, tack a 0 on the end
         for (size_t i = 0; i < in.size() - 1; i += 2) {
@@ -584,22 +2486,27 @@ namespace Nos3
     }
 
     bool SimTerminal::set_bus_type(std::string type)
+    {
+        return parse_bus_type(type, _bus_type);
+    }
+
+    bool SimTerminal::parse_bus_type(std::string type, BusType& bus_type)
     {
         bool succeeded = true;
         boost::to_upper(type);
         boost::trim(type);
         if (type.compare("BASE") == 0) {
-            _bus_type = BASE;
+            bus_type = BASE;
         } else if (type.compare("I2C") == 0) {
-            _bus_type = I2C;
+            bus_type = I2C;
         } else if (type.compare("CAN") == 0) {
-            _bus_type = CAN;
+            bus_type = CAN;
         } else if (type.compare("SPI") == 0) {
-            _bus_type = SPI;
+            bus_type = SPI;
         } else if (type.compare("UART") == 0) {
-            _bus_type = UART;
+            bus_type = UART;
         } else if (type.compare("COMMAND") == 0) {
-            _bus_type = COMMAND;
+            bus_type = COMMAND;
         } else {
             succeeded = false;
         }
@@ -0,0 +1,160 @@
+#include <simulator_terminal_host.hpp>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <boost/foreach.hpp>
+
+#include <ItcLogger/Logger.hpp>
+
+#include <sim_hardware_model_factory.hpp>
+
+#include <tracer.hpp>
+
+namespace Nos3
+{
+    REGISTER_HARDWARE_MODEL(SimTerminalHost,"SimTerminalHost");
+
+    SimTerminalHost::SimTerminalHost(const boost::property_tree::ptree& config) : SimIHardwareModel(config),
+        _monitor(std::make_shared<ConnectionMonitor>(config.get("simulator.hardware-model.connection.heartbeat-ms", 1000),
+                                                     config.get("simulator.hardware-model.connection.connect-timeout-ms", 5000),
+                                                     config.get("simulator.hardware-model.connection.max-heartbeat-ms", 16000))),
+        _console(nullptr),
+        _open(0),
+        _stopping(false),
+        _workers(config.get("simulator.hardware-model.worker-threads", 4))
+    {
+        if (config.get_child_optional("simulator.hardware-model.instances"))
+        {
+            BOOST_FOREACH(const boost::property_tree::ptree::value_type &v, config.get_child("simulator.hardware-model.instances"))
+            {
+                if (v.first.compare("instance") != 0) continue;
+                bool console = (v.second.get("terminal.type", "STDIO").compare("STDIO") == 0);
+                if (console && _console) {
+                    sim_logger->error("SimTerminalHost:  Only one terminal can use STDIO; skipping another.");
+                    continue;
+                }
+                // each terminal sees the host's configuration with its own instance as the hardware model
+                boost::property_tree::ptree instance_config(config);
+                instance_config.put_child("simulator.hardware-model", v.second);
+                std::unique_ptr<Instance> instance(new Instance());
+                instance->terminal.reset(new SimTerminal(instance_config, _monitor));
+                instance->sockfd = -1;
+                instance->busy = false;
+                instance->done = false;
+                if (console) _console = instance.get();
+                _instances.push_back(std::move(instance));
+            }
+        }
+        if (_instances.empty()) sim_logger->error("SimTerminalHost:  No terminal instances are configured.");
+    }
+
+    SimTerminalHost::~SimTerminalHost()
+    {
+    }
+
+    void SimTerminalHost::run(void)
+    {
+        EventLoop& loop = _console ? _console->terminal->event_loop() : _loop;
+        for (const std::unique_ptr<Instance>& instance : _instances) {
+            if (instance.get() == _console) continue;
+            instance->sockfd = instance->terminal->open_udp();
+            if (instance->sockfd < 0) {
+                instance->done = true;
+                continue;
+            }
+            _open++;
+            Instance* watched = instance.get();
+            loop.watch_fd(instance->sockfd, [this, watched]{readable(*watched);});
+        }
+        sim_logger->info("SimTerminalHost::run:  %u terminals (%u over UDP) on %u worker threads.", (unsigned)_instances.size(),
+                         (unsigned)_open, (unsigned)_workers.size());
+
+        if (_console) {
+            _console->terminal->run();
+        } else if (_open > 0) {
+            _loop.run();
+        }
+
+        // the console quit, or every UDP terminal did: drop whatever is still queued
+        _stopping = true;
+        for (const std::unique_ptr<Instance>& instance : _instances) {
+            if (instance->sockfd >= 0) loop.unwatch_fd(instance->sockfd);
+        }
+    }
+
+    // On the loop thread: takes every datagram waiting on the socket
+    void SimTerminalHost::readable(Instance& instance)
+    {
+        char buffer[_MAXLINE];
+        struct sockaddr_in client;
+        while (true) {
+            socklen_t len = sizeof(client);
+            ssize_t n;
+            {
+                NOS3_TRACE_SPAN("recvfrom");
+                n = recvfrom(instance.sockfd, buffer, _MAXLINE - 1, MSG_DONTWAIT, (struct sockaddr *)&client, &len);
+            }
+            if (n < 0) return;
+            std::string datagram(buffer, n);
+
+            std::lock_guard<std::mutex> lock(instance.mutex);
+            if (instance.done || _stopping) continue;
+            if (instance.busy && SimTerminal::is_cancel_datagram(buffer, n)) {
+                instance.terminal->cancel();
+                continue;
+            }
+            instance.datagrams.push_back(std::make_pair(datagram, client));
+            if (!instance.busy) {
+                instance.busy = true;
+                _workers.post([this, &instance]{drain(instance);});
+            }
+        }
+    }
+
+    // On a worker: runs one command, then posts itself again if more are queued so that other terminals get a turn
+    void SimTerminalHost::drain(Instance& instance)
+    {
+        std::pair<std::string, struct sockaddr_in> next;
+        {
+            std::lock_guard<std::mutex> lock(instance.mutex);
+            if (_stopping) {
+                instance.datagrams.clear();
+                instance.busy = false;
+                return;
+            }
+            next = instance.datagrams.front();
+            instance.datagrams.pop_front();
+        }
+
+        bool running = true;
+        try {
+            running = instance.terminal->handle_datagram(next.first.data(), next.first.size(), next.second);
+        } catch (const std::exception& e) {
+            sim_logger->error("SimTerminalHost::drain:  Exception caught: %s", e.what());
+        } catch (...) {
+            sim_logger->error("SimTerminalHost::drain:  Exception caught!");
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(instance.mutex);
+            if (!running) {
+                instance.done = true;
+                instance.datagrams.clear();
+            }
+            if (instance.datagrams.empty()) {
+                instance.busy = false;
+            } else {
+                _workers.post([this, &instance]{drain(instance);});
+            }
+        }
+        if (!running) finished(instance);
+    }
+
+    void SimTerminalHost::finished(Instance& instance)
+    {
+        EventLoop& loop = _console ? _console->terminal->event_loop() : _loop;
+        loop.unwatch_fd(instance.sockfd);
+        if ((--_open == 0) && !_console) _loop.stop();
+    }
+}
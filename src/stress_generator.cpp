@@ -0,0 +1,312 @@
+#include <stress_generator.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace Nos3 {
+
+    namespace {
+
+        std::vector<std::string> split(const std::string& text, char separator)
+        {
+            std::vector<std::string> parts;
+            std::stringstream in(text);
+            std::string part;
+            while (std::getline(in, part, separator)) parts.push_back(part);
+            return parts;
+        }
+
+        // "250us", "2ms", "1s"; a bare number is milliseconds
+        double parse_gap_us(const std::string& text)
+        {
+            size_t end;
+            double value = stod(text, &end);
+            std::string unit = text.substr(end);
+            std::transform(unit.begin(), unit.end(), unit.begin(), ::toupper);
+            if ((unit.size() == 0) || (unit.compare("MS") == 0)) value *= 1000.0;
+            else if (unit.compare("S") == 0) value *= 1000000.0;
+            else if (unit.compare("US") != 0) throw std::invalid_argument("unknown unit");
+            if (value < 0) throw std::invalid_argument("negative gap");
+            return value;
+        }
+
+        std::string hex(const std::vector<char>& data)
+        {
+            static const char digits[] = "0123456789abcdef";
+            std::string out;
+            for (char c : data) {
+                out.push_back(digits[(static_cast<uint8_t>(c) >> 4) & 0xf]);
+                out.push_back(digits[static_cast<uint8_t>(c) & 0xf]);
+            }
+            return out;
+        }
+
+    }
+
+    void StressGenerator::parse(const std::vector<std::string>& tokens, size_t first, Options& options)
+    {
+        if (tokens.size() <= first) throw std::runtime_error("Error: STRESS needs the number of operations to run.");
+        std::string option;
+        try {
+            option = tokens[first];
+            options.operations = stoul(option);
+            if (options.operations == 0) throw std::out_of_range("no operations");
+            for (size_t i = first + 1; i < tokens.size(); i++) {
+                option = tokens[i];
+                size_t equals = option.find('=');
+                if ((equals == std::string::npos) || (equals + 1 == option.size())) throw std::invalid_argument("not key=value");
+                std::string key = option.substr(0, equals), value = option.substr(equals + 1);
+                std::transform(key.begin(), key.end(), key.begin(), ::toupper);
+                if (key.compare("SEED") == 0) {
+                    options.seed = stoull(value, nullptr, 0);
+                } else if (key.compare("WORKERS") == 0) {
+                    options.workers = stoul(value);
+                    if ((options.workers < 1) || (options.workers > 64)) throw std::out_of_range("workers");
+                } else if (key.compare("MIX") == 0) {
+                    std::vector<std::string> weights = split(value, ':');
+                    if (weights.size() != 3) throw std::invalid_argument("mix");
+                    for (size_t k = 0; k < 3; k++) options.mix[k] = stoul(weights[k]);
+                    if (options.mix[0] + options.mix[1] + options.mix[2] == 0) throw std::out_of_range("mix");
+                } else if (key.compare("SIZES") == 0) {
+                    options.sizes.clear();
+                    for (const std::string& part : split(value, ',')) {
+                        size_t dash = part.find('-');
+                        SizeRange range;
+                        range.min = stoul(part.substr(0, dash));
+                        range.max = (dash == std::string::npos) ? range.min : stoul(part.substr(dash + 1));
+                        if ((range.min < 1) || (range.max < range.min) || (range.max > 65536)) throw std::out_of_range("size");
+                        options.sizes.push_back(range);
+                    }
+                    if (options.sizes.empty()) throw std::invalid_argument("sizes");
+                } else if (key.compare("TARGETS") == 0) {
+                    options.targets = split(value, ',');
+                    options.targets.erase(std::remove(options.targets.begin(), options.targets.end(), std::string()), options.targets.end());
+                } else if (key.compare("MASTERS") == 0) {
+                    options.masters.clear();
+                    for (const std::string& part : split(value, ',')) {
+                        unsigned long address = stoul(part, nullptr, 0);
+                        if (address > 0x1FFFFFFF) throw std::out_of_range("master");
+                        options.masters.push_back(static_cast<long>(address));
+                    }
+                    if (options.masters.empty()) throw std::invalid_argument("masters");
+                } else if (key.compare("GAP") == 0) {
+                    options.gap_us = parse_gap_us(value);
+                } else if (key.compare("REPRO") == 0) {
+                    options.repro_path = value;
+                } else {
+                    throw std::invalid_argument("unknown option");
+                }
+            }
+        } catch (std::logic_error &e) {
+            throw std::runtime_error("Error: Invalid STRESS option \"" + option + "\". Type \"HELP\" for help.");
+        }
+        if (!options.masters.empty() && (options.masters.size() != options.workers)) {
+            throw std::runtime_error("Error: MASTERS needs one address for each of the " + std::to_string(options.workers) + " workers.");
+        }
+    }
+
+    std::string StressGenerator::command_line(const Options& options)
+    {
+        std::stringstream ss;
+        ss << "STRESS " << options.operations << " SEED=" << options.seed << " WORKERS=" << options.workers
+           << " MIX=" << options.mix[0] << ":" << options.mix[1] << ":" << options.mix[2] << " SIZES=";
+        for (size_t i = 0; i < options.sizes.size(); i++) {
+            if (i > 0) ss << ",";
+            ss << options.sizes[i].min;
+            if (options.sizes[i].max != options.sizes[i].min) ss << "-" << options.sizes[i].max;
+        }
+        for (size_t i = 0; i < options.targets.size(); i++) ss << ((i == 0) ? " TARGETS=" : ",") << options.targets[i];
+        for (size_t i = 0; i < options.masters.size(); i++) ss << ((i == 0) ? " MASTERS=" : ",") << options.masters[i];
+        if (options.gap_us > 0) ss << " GAP=" << options.gap_us << "us";
+        return ss.str();
+    }
+
+    const char* StressGenerator::kind_as_string(OpKind kind)
+    {
+        switch (kind) {
+        case WRITE: return "write";
+        case READ: return "read";
+        default: return "transaction";
+        }
+    }
+
+    StressGenerator::StressGenerator(const Options& options, size_t worker) : _options(options),
+        _random(options.seed ^ (0xD1B54A32D192ED03ULL * (worker + 1))),
+        _count(options.operations / options.workers + ((worker < options.operations % options.workers) ? 1 : 0)),
+        _next(0),
+        _mix_total(options.mix[0] + options.mix[1] + options.mix[2])
+    {
+    }
+
+    void StressGenerator::next(Op& op)
+    {
+        op.index = _next++;
+        uint64_t pick = _random.below(_mix_total);
+        op.kind = (pick < _options.mix[0]) ? WRITE : (pick < _options.mix[0] + _options.mix[1]) ? READ : TRANSACT;
+        op.target = _options.targets.empty() ? nullptr : &_options.targets[_random.below(_options.targets.size())];
+
+        const SizeRange* range = &_options.sizes[_random.below(_options.sizes.size())];
+        size_t size = range->min + _random.below(range->max - range->min + 1);
+        op.data.clear();
+        op.rlen = 0;
+        if (op.kind == READ) {
+            op.rlen = size;
+        } else {
+            op.data.resize(size);
+            for (size_t i = 0; i < size; i += 8) {
+                uint64_t bits = _random.next();
+                for (size_t j = i; (j < i + 8) && (j < size); j++, bits >>= 8) op.data[j] = static_cast<char>(bits);
+            }
+            if (op.kind == TRANSACT) {
+                range = &_options.sizes[_random.below(_options.sizes.size())];
+                op.rlen = range->min + _random.below(range->max - range->min + 1);
+            }
+        }
+        op.gap_us = (_options.gap_us > 0) ? -_options.gap_us * std::log(1.0 - _random.uniform()) : 0;
+    }
+
+    StressTally::StressTally() : _min_us(0), _max_us(0), _total_us(0), _bytes(0), _failed(false)
+    {
+        for (size_t b = 0; b < BUCKETS; b++) _buckets[b] = 0;
+        for (size_t i = 0; i < 3; i++) _counts[i] = 0;
+        for (size_t i = 0; i <= BUS_UNSUPPORTED; i++) _errors[i] = 0;
+    }
+
+    size_t StressTally::bucket(double us)
+    {
+        size_t b = 0;
+        for (uint64_t v = static_cast<uint64_t>(us); (v > 1) && (b < BUCKETS - 1); v >>= 1) b++;
+        return b;
+    }
+
+    void StressTally::record(size_t worker, const StressGenerator::Op& op, BusResult result, double latency_us, const std::string& error)
+    {
+        _min_us = (operations() == 0) ? latency_us : std::min(_min_us, latency_us);
+        _max_us = std::max(_max_us, latency_us);
+        _total_us += latency_us;
+        _buckets[bucket(latency_us)]++;
+        _counts[op.kind]++;
+        if (result == BUS_SUCCESS) {
+            _bytes += op.data.size() + op.rlen;
+            return;
+        }
+        _errors[result]++;
+        if (_failed) return;
+        _failed = true;
+        _first.at = std::chrono::steady_clock::now();
+        _first.worker = worker;
+        _first.index = op.index;
+        _first.kind = op.kind;
+        _first.target = op.target ? *op.target : std::string();
+        _first.data = op.data;
+        _first.rlen = op.rlen;
+        _first.result = result;
+        _first.latency_us = latency_us;
+        _first.error = error;
+    }
+
+    void StressTally::merge(const StressTally& other)
+    {
+        if (other.operations() > 0) {
+            _min_us = (operations() == 0) ? other._min_us : std::min(_min_us, other._min_us);
+            _max_us = std::max(_max_us, other._max_us);
+        }
+        _total_us += other._total_us;
+        for (size_t b = 0; b < BUCKETS; b++) _buckets[b] += other._buckets[b];
+        for (size_t i = 0; i < 3; i++) _counts[i] += other._counts[i];
+        for (size_t i = 0; i <= BUS_UNSUPPORTED; i++) _errors[i] += other._errors[i];
+        _bytes += other._bytes;
+        if (other._failed && (!_failed || (other._first.at < _first.at))) {
+            _failed = true;
+            _first = other._first;
+        }
+    }
+
+    std::string StressTally::report(const StressGenerator::Options& options, double elapsed_s) const
+    {
+        std::stringstream ss;
+        char line[256];
+        uint64_t total = operations();
+        double seconds = std::max(elapsed_s, 1e-9);
+        snprintf(line, sizeof(line), "STRESS seed %llu: %llu operations on %zu workers in %.3f s (%.1f ops/s, %.1f KB/s)\n",
+                 static_cast<unsigned long long>(options.seed), static_cast<unsigned long long>(total), options.workers, elapsed_s,
+                 total / seconds, _bytes / seconds / 1024.0);
+        ss << line;
+        ss << "  writes " << _counts[0] << ", reads " << _counts[1] << ", transactions " << _counts[2] << std::endl;
+        if (total > 0) {
+            // percentiles are the upper edge of the bucket they fall in
+            const double fractions[] = {0.5, 0.9, 0.99};
+            double percentiles[3] = {0, 0, 0};
+            for (size_t p = 0; p < 3; p++) {
+                uint64_t seen = 0, wanted = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(fractions[p] * total)));
+                for (size_t b = 0; b < BUCKETS; b++) {
+                    seen += _buckets[b];
+                    if (seen >= wanted) {
+                        percentiles[p] = static_cast<double>(2ULL << b);
+                        break;
+                    }
+                }
+            }
+            snprintf(line, sizeof(line), "  latency us: min %.1f, mean %.1f, max %.1f; p50 < %.0f, p90 < %.0f, p99 < %.0f\n",
+                     _min_us, _total_us / total, _max_us, percentiles[0], percentiles[1], percentiles[2]);
+            ss << line;
+        }
+
+        uint64_t errors = 0;
+        for (size_t i = 0; i <= BUS_UNSUPPORTED; i++) errors += _errors[i];
+        if (errors == 0) {
+            ss << "  no errors" << std::endl;
+            return ss.str();
+        }
+        ss << "  errors: " << errors << " (";
+        const char* separator = "";
+        for (size_t i = 0; i <= BUS_UNSUPPORTED; i++) {
+            if (_errors[i] == 0) continue;
+            ss << separator << bus_result_as_string(static_cast<BusResult>(i)) << " " << _errors[i];
+            separator = ", ";
+        }
+        ss << ")" << std::endl;
+        ss << "  first failure: worker " << _first.worker << ", operation " << _first.index << ", "
+           << StressGenerator::kind_as_string(_first.kind) << " of " << _first.data.size() << " bytes";
+        if (_first.rlen > 0) ss << " reading " << _first.rlen;
+        if (_first.target.size() > 0) ss << " to " << _first.target;
+        ss << ": " << bus_result_as_string(_first.result) << " after " << static_cast<uint64_t>(_first.latency_us) << " us";
+        if (_first.error.size() > 0) ss << " (" << _first.error << ")";
+        ss << std::endl;
+        return ss.str();
+    }
+
+    std::string StressTally::write_repro(const StressGenerator::Options& options, const std::string& bus_type, const std::string& bus_name,
+                                         const std::vector<std::string>& worker_nodes) const
+    {
+        std::ofstream out(options.repro_path);
+        if (!out) return "Error: Could not open repro file \"" + options.repro_path + "\".";
+        out << "# Reproduces the first failure of: " << StressGenerator::command_line(options) << std::endl;
+        out << "# worker " << _first.worker << ", operation " << _first.index << ": " << bus_result_as_string(_first.result)
+            << " after " << static_cast<uint64_t>(_first.latency_us) << " us" << std::endl;
+        out << "SET SIMBUSTYPE " << bus_type << std::endl;
+        out << "SET SIMBUS " << bus_name << std::endl;
+        if (_first.worker < worker_nodes.size()) out << "SET TERMNODE " << worker_nodes[_first.worker] << std::endl;
+        if (_first.target.size() > 0) out << "SET SIMNODE " << _first.target << std::endl;
+        out << "SET HEX IN" << std::endl;
+        switch (_first.kind) {
+        case StressGenerator::WRITE:
+            out << "WRITE " << hex(_first.data) << std::endl;
+            break;
+        case StressGenerator::READ:
+            out << "READ " << _first.rlen << std::endl;
+            break;
+        default:
+            out << "TRANSACT " << _first.rlen << " " << hex(_first.data) << std::endl;
+            break;
+        }
+        out.close();
+        return out ? std::string() : "Error: Writing repro file \"" + options.repro_path + "\" failed.";
+    }
+
+}
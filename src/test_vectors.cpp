@@ -0,0 +1,316 @@
+#include <test_vectors.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace Nos3 {
+
+    namespace {
+        int hex_nibble(char c){
+            if (('0' <= c) && (c <= '9')) return c - '0';
+            if (('A' <= c) && (c <= 'F')) return c - 'A' + 10;
+            if (('a' <= c) && (c <= 'f')) return c - 'a' + 10;
+            return -1;
+        }
+
+        // XML 1.0 has no way to carry control characters other than tab, LF and CR, even as character references, so
+        // the rest are written as text such as \x01
+        std::string xml_escape(const std::string& in){
+            std::string out;
+            for (char c : in) {
+                switch (c) {
+                case '<': out.append("&lt;"); break;
+                case '>': out.append("&gt;"); break;
+                case '&': out.append("&amp;"); break;
+                case '"': out.append("&quot;"); break;
+                case '\t': case '\n': case '\r': out.push_back(c); break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        char escaped[8];
+                        snprintf(escaped, sizeof(escaped), "\\x%02X", static_cast<unsigned>(c));
+                        out.append(escaped);
+                    } else {
+                        out.push_back(c);
+                    }
+                    break;
+                }
+            }
+            return out;
+        }
+
+        std::string json_escape(const std::string& in){
+            std::string out;
+            for (char c : in) {
+                if (c == '\n') {
+                    out.append("\\n");
+                } else if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04X", static_cast<unsigned>(c));
+                    out.append(escaped);
+                } else {
+                    if ((c == '"') || (c == '\\')) out.push_back('\\');
+                    out.push_back(c);
+                }
+            }
+            return out;
+        }
+
+        const char* status_as_string(TestVectorSet::VectorStatus status){
+            switch (status) {
+            case TestVectorSet::PASS: return "pass";
+            case TestVectorSet::MISMATCH: return "mismatch";
+            case TestVectorSet::TIMEOUT: return "timeout";
+            default: return "error";
+            }
+        }
+    }
+
+    uint32_t TestVectorSet::append_hex(const std::string& hex, uint32_t line){
+        uint32_t offset = _arena.size();
+        if (hex.compare("-") == 0) return offset;
+        if ((hex.size() % 2) != 0) {
+            std::stringstream ss;
+            ss << "Error: line " << line << " of " << _path << ": \"" << hex << "\" has an odd number of hex digits.";
+            throw std::runtime_error(ss.str());
+        }
+        for (size_t i = 0; i < hex.size(); i += 2) {
+            int upper = hex_nibble(hex[i]);
+            int lower = hex_nibble(hex[i+1]);
+            if ((upper < 0) || (lower < 0)) {
+                std::stringstream ss;
+                ss << "Error: line " << line << " of " << _path << ": \"" << hex << "\" is not valid hex.";
+                throw std::runtime_error(ss.str());
+            }
+            _arena.push_back((upper << 4) | lower);
+        }
+        return offset;
+    }
+
+    void TestVectorSet::load(const std::string& path){
+        std::ifstream in(path);
+        if (!in) {
+            throw std::runtime_error("Error: Could not open test vector file \"" + path + "\".");
+        }
+        _path = path;
+        _arena.clear();
+        _vectors.clear();
+        _results.clear();
+
+        std::string line;
+        uint32_t line_number = 0;
+        while (std::getline(in, line)) {
+            line_number++;
+            std::stringstream tokenizer(line);
+            std::string command, expected, mask, timeout;
+            tokenizer >> command;
+            if ((command.size() == 0) || (command[0] == '#')) continue;
+            tokenizer >> expected >> mask >> timeout;
+            if (expected.size() == 0) expected = "-";
+            if (mask.size() == 0) mask = "-";
+
+            Vector v;
+            v.line = line_number;
+            v.command_offset = append_hex(command, line_number);
+            v.command_length = _arena.size() - v.command_offset;
+            v.expected_offset = append_hex(expected, line_number);
+            v.expected_length = _arena.size() - v.expected_offset;
+            if (mask.compare("-") == 0) {
+                _arena.insert(_arena.end(), v.expected_length, 0xFF);
+            } else {
+                uint32_t mask_offset = append_hex(mask, line_number);
+                if (_arena.size() - mask_offset != v.expected_length) {
+                    std::stringstream ss;
+                    ss << "Error: line " << line_number << " of " << path << ": mask length does not match expected response length.";
+                    throw std::runtime_error(ss.str());
+                }
+            }
+            v.timeout_ms = 5000;
+            if (timeout.size() > 0) {
+                try {
+                    v.timeout_ms = stoul(timeout);
+                } catch (std::exception&) {
+                    std::stringstream ss;
+                    ss << "Error: line " << line_number << " of " << path << ": \"" << timeout << "\" is not a valid timeout.";
+                    throw std::runtime_error(ss.str());
+                }
+            }
+            _vectors.push_back(v);
+        }
+    }
+
+    TestVectorSet::Summary TestVectorSet::run(BusConnection& bus, std::function<bool(void)> cancelled){
+        if (!bus.target_valid()) {
+            throw std::runtime_error(bus.invalid_target_message(bus.target()));
+        }
+        return visit_bus_connection(bus, [this, &cancelled](auto& connection) {return run_on(connection, cancelled);});
+    }
+
+    template <typename Connection>
+    TestVectorSet::Summary TestVectorSet::run_on(Connection& bus, const std::function<bool(void)>& cancelled){
+        Summary summary = Summary();
+        _results.assign(_vectors.size(), VectorResult());
+
+        uint32_t max_expected = 0;
+        for (const Vector& v : _vectors) max_expected = std::max(max_expected, v.expected_length);
+        std::vector<uint8_t> received(max_expected);
+
+        const char* arena = reinterpret_cast<const char*>(_arena.data());
+        std::chrono::steady_clock::time_point run_start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < _vectors.size(); i++) {
+            if (cancelled()) {
+                summary.skipped = _vectors.size() - i;
+                _results.resize(i);
+                break;
+            }
+            const Vector& v = _vectors[i];
+            VectorResult& r = _results[i];
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            BusResult result = (v.expected_length == 0)
+                ? bus.try_write(arena + v.command_offset, v.command_length)
+                : bus.try_transact(arena + v.command_offset, v.command_length, reinterpret_cast<char*>(received.data()), v.expected_length, v.timeout_ms);
+            r.status = (result == BUS_SUCCESS) ? PASS : ((result == BUS_TIMEOUT) ? TIMEOUT : ERROR);
+            r.latency_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+            // the base bus gives up at the timeout itself; the other masters block until the bus answers, so a late
+            // answer from them still fails the vector
+            if ((r.status == PASS) && (r.latency_us > v.timeout_ms * 1000ull)) {
+                r.status = TIMEOUT;
+            }
+            if (r.status == PASS) {
+                const uint8_t* expected = _arena.data() + v.expected_offset;
+                const uint8_t* mask = expected + v.expected_length;
+                for (uint32_t j = 0; j < v.expected_length; j++) {
+                    if ((received[j] & mask[j]) != (expected[j] & mask[j])) {
+                        r.status = MISMATCH;
+                        break;
+                    }
+                }
+            }
+
+            switch (r.status) {
+            case PASS: summary.passed++; break;
+            case MISMATCH: summary.mismatched++; break;
+            case TIMEOUT: summary.timed_out++; break;
+            case ERROR: summary.errored++; break;
+            }
+            if ((r.status != PASS) && (summary.first_failures.size() < _MAX_REPORTED_FAILURES)) {
+                summary.first_failures.push_back(describe_failure(i, received.data(), bus_result_as_string(result)));
+            }
+        }
+        summary.total_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count();
+
+        if (_results.size() > 0) {
+            std::vector<uint32_t> latencies;
+            latencies.reserve(_results.size());
+            double total = 0.0;
+            for (const VectorResult& r : _results) {
+                latencies.push_back(r.latency_us);
+                total += r.latency_us;
+            }
+            std::sort(latencies.begin(), latencies.end());
+            summary.min_us = latencies.front();
+            summary.max_us = latencies.back();
+            summary.mean_us = total / latencies.size();
+            summary.p50_us = latencies[(latencies.size() - 1) * 50 / 100];
+            summary.p95_us = latencies[(latencies.size() - 1) * 95 / 100];
+            summary.p99_us = latencies[(latencies.size() - 1) * 99 / 100];
+        }
+        return summary;
+    }
+
+    std::string TestVectorSet::describe_failure(size_t index, const uint8_t* received, const std::string& error) const {
+        const Vector& v = _vectors[index];
+        const VectorResult& r = _results[index];
+        std::stringstream ss;
+        ss << "vector " << index << " (line " << v.line << "): " << status_as_string(r.status);
+        if (r.status == ERROR) {
+            ss << ": " << error;
+        } else if (r.status == TIMEOUT) {
+            ss << ": took " << r.latency_us << " us, limit " << v.timeout_ms << " ms";
+        } else {
+            const uint8_t* expected = _arena.data() + v.expected_offset;
+            const uint8_t* mask = expected + v.expected_length;
+            ss << std::hex << std::uppercase << std::setfill('0');
+            ss << ":" << std::endl << "      expected:";
+            for (uint32_t j = 0; j < v.expected_length; j++) ss << " " << std::setw(2) << int(expected[j]);
+            ss << std::endl << "      mask:    ";
+            for (uint32_t j = 0; j < v.expected_length; j++) ss << " " << std::setw(2) << int(mask[j]);
+            ss << std::endl << "      received:";
+            for (uint32_t j = 0; j < v.expected_length; j++) ss << " " << std::setw(2) << int(received[j]);
+            ss << std::endl << "      diff:    ";
+            for (uint32_t j = 0; j < v.expected_length; j++) {
+                ss << (((received[j] & mask[j]) != (expected[j] & mask[j])) ? " ^^" : "   ");
+            }
+        }
+        return ss.str();
+    }
+
+    std::string TestVectorSet::summary_as_string(const Summary& summary){
+        std::stringstream ss;
+        size_t total = summary.passed + summary.mismatched + summary.timed_out + summary.errored;
+        ss << "Ran " << total << " vectors in " << summary.total_seconds << " s: "
+           << summary.passed << " passed, " << summary.mismatched << " mismatched, "
+           << summary.timed_out << " timed out, " << summary.errored << " errored." << std::endl;
+        if (summary.skipped > 0) ss << "Cancelled; " << summary.skipped << " vectors were not run." << std::endl;
+        if (total > 0) {
+            ss << "Latency (us): min " << summary.min_us << ", mean " << summary.mean_us << ", p50 " << summary.p50_us
+               << ", p95 " << summary.p95_us << ", p99 " << summary.p99_us << ", max " << summary.max_us << std::endl;
+        }
+        for (const std::string& failure : summary.first_failures) {
+            ss << "    " << failure << std::endl;
+        }
+        return ss.str();
+    }
+
+    void TestVectorSet::write_report(const std::string& path, const Summary& summary) const {
+        std::ofstream out(path);
+        if (!out) {
+            throw std::runtime_error("Error: Could not open report file \"" + path + "\".");
+        }
+        size_t total = summary.passed + summary.mismatched + summary.timed_out + summary.errored;
+        bool json = (path.size() >= 5) && (path.compare(path.size() - 5, 5, ".json") == 0);
+        if (json) {
+            out << "{\"file\":\"" << json_escape(_path) << "\",\"tests\":" << total
+                << ",\"passed\":" << summary.passed << ",\"mismatched\":" << summary.mismatched
+                << ",\"timed_out\":" << summary.timed_out << ",\"errored\":" << summary.errored << ",\"skipped\":" << summary.skipped
+                << ",\"seconds\":" << summary.total_seconds
+                << ",\"latency_us\":{\"min\":" << summary.min_us << ",\"mean\":" << summary.mean_us
+                << ",\"p50\":" << summary.p50_us << ",\"p95\":" << summary.p95_us << ",\"p99\":" << summary.p99_us
+                << ",\"max\":" << summary.max_us << "},\"first_failures\":[";
+            for (size_t i = 0; i < summary.first_failures.size(); i++) {
+                out << (i ? "," : "") << "\"" << json_escape(summary.first_failures[i]) << "\"";
+            }
+            out << "],\"vectors\":[";
+            for (size_t i = 0; i < _results.size(); i++) {
+                out << (i ? "," : "") << "{\"line\":" << _vectors[i].line << ",\"status\":\""
+                    << status_as_string(_results[i].status) << "\",\"latency_us\":" << _results[i].latency_us << "}";
+            }
+            out << "]}" << std::endl;
+        } else {
+            out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>" << std::endl;
+            out << "<testsuite name=\"" << xml_escape(_path) << "\" tests=\"" << (total + summary.skipped)
+                << "\" failures=\"" << (summary.mismatched + summary.timed_out) << "\" errors=\"" << summary.errored << "\" skipped=\"" << summary.skipped
+                << "\" time=\"" << summary.total_seconds << "\">" << std::endl;
+            for (size_t i = 0; i < _results.size(); i++) {
+                out << "  <testcase name=\"line " << _vectors[i].line << "\" time=\"" << (_results[i].latency_us / 1e6) << "\"";
+                if (_results[i].status == PASS) {
+                    out << "/>" << std::endl;
+                } else {
+                    const char* element = (_results[i].status == ERROR) ? "error" : "failure";
+                    out << "><" << element << " type=\"" << status_as_string(_results[i].status) << "\"/></testcase>" << std::endl;
+                }
+            }
+            for (size_t i = _results.size(); i < _results.size() + summary.skipped; i++) {
+                out << "  <testcase name=\"line " << _vectors[i].line << "\"><skipped/></testcase>" << std::endl;
+            }
+            out << "  <system-out>" << xml_escape(summary_as_string(summary)) << "</system-out>" << std::endl;
+            out << "</testsuite>" << std::endl;
+        }
+    }
+
+}
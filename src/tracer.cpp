@@ -0,0 +1,164 @@
+#include <tracer.hpp>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <unistd.h>
+
+namespace Nos3 {
+
+    std::atomic<bool> Tracer::_enabled(false);
+    std::string Tracer::_path;
+
+    namespace {
+
+        struct Event {
+            const char* name;
+            uint64_t start_ns;
+            uint64_t end_ns;
+            unsigned tid; // a reused buffer holds events of more than one thread
+        };
+
+        // Written only by the thread that holds it; gathered by stop() up to the count it has published
+        struct Buffer {
+            static const size_t CAPACITY = 1 << 16;
+            std::unique_ptr<Event[]> events;
+            std::atomic<size_t> count;
+            std::atomic<size_t> dropped;
+            std::atomic<uint64_t> session; // the trace the events belong to; a stale buffer is emptied on its next use
+            std::atomic<bool> in_use;      // held by a live thread
+            unsigned tid;                  // of the thread holding it now
+        };
+
+        std::mutex control_mutex; // serializes start and stop
+        std::mutex buffers_mutex; // guards the list, not the buffers in it
+        std::vector<std::unique_ptr<Buffer>> buffers;
+        unsigned last_tid = 0;    // every thread that records gets a tid of its own, whether or not its buffer is new
+        std::atomic<uint64_t> current_session(0);
+        uint64_t session_start_ns = 0;
+        FILE* output = nullptr;
+
+        // Gives this thread's buffer back for another thread to reuse when the thread ends
+        struct BufferHolder {
+            Buffer* buffer;
+            ~BufferHolder() {if (buffer) buffer->in_use = false;}
+        };
+        thread_local BufferHolder holder = {nullptr};
+
+        Buffer* thread_buffer(void)
+        {
+            if (holder.buffer) return holder.buffer;
+            std::lock_guard<std::mutex> lock(buffers_mutex);
+            for (const std::unique_ptr<Buffer>& b : buffers) {
+                bool free = false;
+                if (b->in_use.compare_exchange_strong(free, true)) {
+                    b->tid = ++last_tid;
+                    holder.buffer = b.get();
+                    return holder.buffer;
+                }
+            }
+            std::unique_ptr<Buffer> b(new Buffer());
+            b->events.reset(new Event[Buffer::CAPACITY]);
+            b->count = 0;
+            b->dropped = 0;
+            b->session = 0;
+            b->in_use = true;
+            b->tid = ++last_tid;
+            holder.buffer = b.get();
+            buffers.push_back(std::move(b));
+            return holder.buffer;
+        }
+
+    }
+
+    void Tracer::record(const char* name, uint64_t start_ns, uint64_t end_ns)
+    {
+        Buffer* b = thread_buffer();
+        uint64_t session = current_session.load(std::memory_order_acquire);
+        if (b->session.load(std::memory_order_relaxed) != session) {
+            b->count.store(0, std::memory_order_relaxed);
+            b->dropped.store(0, std::memory_order_relaxed);
+            b->session.store(session, std::memory_order_release);
+        }
+        size_t i = b->count.load(std::memory_order_relaxed);
+        if (i == Buffer::CAPACITY) {
+            b->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Event& e = b->events[i];
+        e.name = name;
+        e.start_ns = start_ns;
+        e.end_ns = end_ns;
+        e.tid = b->tid;
+        b->count.store(i + 1, std::memory_order_release);
+    }
+
+    bool Tracer::start(const std::string& path, std::string& error)
+    {
+        std::lock_guard<std::mutex> lock(control_mutex);
+        if (_enabled) {
+            error = "Error: A trace is already being recorded to " + _path + ".";
+            return false;
+        }
+        output = fopen(path.c_str(), "w");
+        if (!output) {
+            error = "Error: Cannot open \"" + path + "\": " + strerror(errno);
+            return false;
+        }
+        _path = path;
+        session_start_ns = now_ns();
+        current_session.fetch_add(1, std::memory_order_release);
+        _enabled = true;
+        return true;
+    }
+
+    bool Tracer::stop(std::string& path, size_t& events, size_t& dropped, std::string& error)
+    {
+        std::lock_guard<std::mutex> lock(control_mutex);
+        if (!_enabled) {
+            error = "Error: No trace is being recorded.";
+            return false;
+        }
+        _enabled = false;
+        path = _path;
+        uint64_t session = current_session.load();
+        events = 0;
+        dropped = 0;
+
+        // spans still in progress on other threads may or may not make it in; nothing waits for them
+        std::vector<Buffer*> gathered;
+        {
+            std::lock_guard<std::mutex> lock(buffers_mutex);
+            for (const std::unique_ptr<Buffer>& b : buffers) gathered.push_back(b.get());
+        }
+        int pid = getpid();
+        fprintf(output, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        fprintf(output, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"sim_terminal\"}}", pid);
+        for (Buffer* b : gathered) {
+            if (b->session.load(std::memory_order_acquire) != session) continue;
+            size_t count = b->count.load(std::memory_order_acquire);
+            dropped += b->dropped.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < count; i++) {
+                const Event& e = b->events[i];
+                if (e.start_ns < session_start_ns) continue; // began before the trace did
+                uint64_t ts = e.start_ns - session_start_ns;
+                uint64_t dur = (e.end_ns > e.start_ns) ? e.end_ns - e.start_ns : 0;
+                fprintf(output, ",\n{\"name\":\"%s\",\"cat\":\"sim_terminal\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%llu.%03llu,\"dur\":%llu.%03llu}",
+                        e.name, pid, e.tid, (unsigned long long)(ts / 1000), (unsigned long long)(ts % 1000),
+                        (unsigned long long)(dur / 1000), (unsigned long long)(dur % 1000));
+                events++;
+            }
+        }
+        fprintf(output, "\n]}\n");
+        bool ok = (ferror(output) == 0);
+        if (fclose(output) != 0) ok = false;
+        output = nullptr;
+        if (!ok) error = "Error: Writing \"" + _path + "\" failed.";
+        return ok;
+    }
+
+}
@@ -0,0 +1,147 @@
+#include <traffic_monitor.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+namespace Nos3 {
+
+    namespace {
+
+        std::atomic<uint64_t> next_instance(1);
+
+        // The shard this thread last used; a thread that records into several monitors falls back to a lookup
+        struct ShardCache {
+            uint64_t instance;
+            void* shard;
+        };
+        thread_local ShardCache shard_cache = {0, nullptr};
+
+    }
+
+    TrafficMonitor::TrafficMonitor() : _instance(next_instance++), _resets(0), _reset_at(std::chrono::steady_clock::now())
+    {
+    }
+
+    TrafficMonitor::Shard& TrafficMonitor::shard(void)
+    {
+        if (shard_cache.instance == _instance) return *static_cast<Shard*>(shard_cache.shard);
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::unique_ptr<Shard>& shard = _shards[std::this_thread::get_id()];
+        if (!shard) shard.reset(new Shard());
+        shard_cache.instance = _instance;
+        shard_cache.shard = shard.get();
+        return *shard;
+    }
+
+    void TrafficMonitor::record(const char* bus, const std::string& source, size_t bytes, bool outbound)
+    {
+        Shard& s = shard();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        SourceCounters& sources = s.counters[bus];
+        SourceCounters::iterator it = sources.find(source);
+        if (it == sources.end()) {
+            Counter counter = {bus, 0, 0, 0, 0, std::chrono::steady_clock::time_point()};
+            it = sources.insert(std::make_pair(source, counter)).first;
+        }
+        Counter& counter = it->second;
+        if (outbound) {
+            counter.tx_messages++;
+            counter.tx_bytes += bytes;
+        } else {
+            counter.rx_messages++;
+            counter.rx_bytes += bytes;
+        }
+        counter.last_seen = std::chrono::steady_clock::now();
+    }
+
+    std::vector<TrafficMonitor::Row> TrafficMonitor::snapshot(Baseline& baseline, double& interval_s)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Counters totals;
+        for (std::map<std::thread::id, std::unique_ptr<Shard>>::iterator it = _shards.begin(); it != _shards.end(); it++) {
+            std::lock_guard<std::mutex> shard_lock(it->second->mutex);
+            for (Counters::const_iterator b = it->second->counters.begin(); b != it->second->counters.end(); b++) {
+                SourceCounters& sources = totals[b->first];
+                for (SourceCounters::const_iterator c = b->second.begin(); c != b->second.end(); c++) {
+                    SourceCounters::iterator total = sources.find(c->first);
+                    if (total == sources.end()) {
+                        sources.insert(*c);
+                        continue;
+                    }
+                    total->second.rx_messages += c->second.rx_messages;
+                    total->second.rx_bytes += c->second.rx_bytes;
+                    total->second.tx_messages += c->second.tx_messages;
+                    total->second.tx_bytes += c->second.tx_bytes;
+                    total->second.last_seen = std::max(total->second.last_seen, c->second.last_seen);
+                }
+            }
+        }
+
+        if (baseline.resets != _resets) {
+            baseline.counters.clear();
+            baseline.at = std::max(baseline.at, _reset_at);
+            baseline.resets = _resets;
+        }
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        interval_s = std::chrono::duration<double>(now - baseline.at).count();
+        double scale = (interval_s > 0) ? 1.0 / interval_s : 0.0;
+        std::vector<Row> rows;
+        for (Counters::const_iterator b = totals.begin(); b != totals.end(); b++) {
+            Counters::const_iterator previous_bus = baseline.counters.find(b->first);
+            for (SourceCounters::const_iterator it = b->second.begin(); it != b->second.end(); it++) {
+                const Counter& c = it->second;
+                Counter p = {c.bus, 0, 0, 0, 0, c.last_seen};
+                if (previous_bus != baseline.counters.end()) {
+                    SourceCounters::const_iterator prev = previous_bus->second.find(it->first);
+                    if (prev != previous_bus->second.end()) p = prev->second;
+                }
+                Row row = {it->first, c.bus,
+                           (c.rx_messages - p.rx_messages) * scale, (c.rx_bytes - p.rx_bytes) * scale,
+                           (c.tx_messages - p.tx_messages) * scale, (c.tx_bytes - p.tx_bytes) * scale,
+                           c.rx_messages + c.tx_messages, c.rx_bytes + c.tx_bytes,
+                           std::chrono::duration<double>(now - c.last_seen).count()};
+                rows.push_back(row);
+            }
+        }
+        std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+            double ra = a.rx_messages_per_s + a.tx_messages_per_s, rb = b.rx_messages_per_s + b.tx_messages_per_s;
+            return (ra != rb) ? (ra > rb) : (a.messages > b.messages);
+        });
+        baseline.counters.swap(totals);
+        baseline.at = now;
+        return rows;
+    }
+
+    void TrafficMonitor::reset(void)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (std::map<std::thread::id, std::unique_ptr<Shard>>::iterator it = _shards.begin(); it != _shards.end(); it++) {
+            std::lock_guard<std::mutex> shard_lock(it->second->mutex);
+            it->second->counters.clear();
+        }
+        _resets++;
+        _reset_at = std::chrono::steady_clock::now();
+    }
+
+    std::string TrafficMonitor::table_as_string(const std::vector<Row>& rows, double interval_s)
+    {
+        char line[160];
+        std::string table;
+        snprintf(line, sizeof(line), "Traffic over the last %.1f s\n", interval_s);
+        table += line;
+        snprintf(line, sizeof(line), "%-24s %-5s %9s %11s %9s %11s %8s %10s %9s\n",
+                 "SOURCE", "BUS", "RX MSG/S", "RX BYTES/S", "TX MSG/S", "TX BYTES/S", "AVG SIZE", "MESSAGES", "LAST SEEN");
+        table += line;
+        for (const Row& row : rows) {
+            double average = (row.messages > 0) ? static_cast<double>(row.bytes) / row.messages : 0.0;
+            snprintf(line, sizeof(line), "%-24.24s %-5.5s %9.1f %11.1f %9.1f %11.1f %8.1f %10llu %8.1fs\n",
+                     row.source.c_str(), row.bus, row.rx_messages_per_s, row.rx_bytes_per_s, row.tx_messages_per_s, row.tx_bytes_per_s,
+                     average, static_cast<unsigned long long>(row.messages), row.last_seen_s);
+            table += line;
+        }
+        if (rows.empty()) table += "No traffic yet.\n";
+        return table;
+    }
+
+}
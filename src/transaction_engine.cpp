@@ -0,0 +1,238 @@
+#include <transaction_engine.hpp>
+#include <bus_connections.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <limits>
+#include <deque>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace Nos3 {
+
+    struct TransactionEngine::Job {
+        std::shared_ptr<BusConnection> bus;
+        std::vector<char> wbuf;
+        std::vector<char> rbuf;
+        unsigned timeout_ms;
+        BusResult result;
+        bool done;
+    };
+
+    struct TransactionEngine::Worker {
+        std::mutex mutex;
+        std::condition_variable job_queued;
+        std::condition_variable job_done;
+        std::deque<std::shared_ptr<Job>> queue;
+        bool stopping;
+
+        void run(void)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                job_queued.wait(lock, [this]{return stopping || !queue.empty();});
+                if (stopping) return;
+                std::shared_ptr<Job> job = queue.front();
+                queue.pop_front();
+                lock.unlock();
+
+                BusResult result = BUS_ERROR;
+                try {
+                    result = visit_bus_connection(*job->bus, [&job](auto& connection) {
+                        return connection.try_transact(job->wbuf.data(), job->wbuf.size(), job->rbuf.data(), job->rbuf.size(), job->timeout_ms);
+                    });
+                } catch (...) {
+                    // keep the worker alive; the caller sees an ERROR and may retry
+                }
+
+                lock.lock();
+                job->result = result;
+                job->done = true;
+                job_done.notify_all();
+            }
+        }
+    };
+
+    TransactionEngine::TransactionEngine() : _stats()
+    {
+        start_worker();
+    }
+
+    TransactionEngine::~TransactionEngine()
+    {
+        retire_worker();
+    }
+
+    void TransactionEngine::start_worker(void)
+    {
+        _worker.reset(new Worker());
+        _worker->stopping = false;
+        std::shared_ptr<Worker> worker = _worker;
+        std::thread([worker]{worker->run();}).detach();
+    }
+
+    // The worker finishes the call it is in, if any, and exits
+    void TransactionEngine::retire_worker(void)
+    {
+        std::lock_guard<std::mutex> lock(_worker->mutex);
+        _worker->stopping = true;
+        _worker->queue.clear();
+        _worker->job_queued.notify_all();
+    }
+
+    TransactionEngine::Result TransactionEngine::transact(std::shared_ptr<BusConnection> bus, const char* wbuf, size_t wlen, char* rbuf, size_t rlen,
+                                                          const Policy& policy, std::function<bool(void)> cancelled)
+    {
+        const std::chrono::milliseconds slice(10);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point deadline = start + policy.timeout;
+        std::chrono::milliseconds backoff(1);
+        Result result = {TIMEOUT, BUS_TIMEOUT, 0, 0.0, false};
+
+        while (true) {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (now >= deadline) break;
+
+            std::shared_ptr<Job> job(new Job());
+            job->bus = bus;
+            job->wbuf.assign(wbuf, wbuf + wlen);
+            job->rbuf.assign(rlen, 0);
+            job->timeout_ms = std::max<long>(1, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count());
+            job->done = false;
+            result.attempts++;
+
+            std::unique_lock<std::mutex> lock(_worker->mutex);
+            _worker->queue.push_back(job);
+            _worker->job_queued.notify_all();
+            while (!job->done && (std::chrono::steady_clock::now() < deadline)) {
+                if (cancelled && cancelled()) {
+                    result.outcome = CANCELLED;
+                    break;
+                }
+                _worker->job_done.wait_for(lock, slice);
+            }
+            if (!job->done) {
+                if (result.outcome != CANCELLED) {
+                    result.outcome = TIMEOUT;
+                    result.last_result = BUS_TIMEOUT;
+                }
+                result.abandoned = true;
+                break;
+            }
+            if (result.outcome == CANCELLED) break;
+            lock.unlock();
+
+            result.last_result = job->result;
+            if (job->result == BUS_SUCCESS) {
+                std::memcpy(rbuf, job->rbuf.data(), rlen);
+                result.outcome = SUCCESS;
+                break;
+            }
+            if (job->result == BUS_TIMEOUT) {
+                result.outcome = TIMEOUT;
+                break;
+            }
+            if (((job->result != BUS_BUSY) && (job->result != BUS_ERROR)) || (result.attempts > policy.retries)) {
+                result.outcome = FAILED;
+                break;
+            }
+
+            // back off before retrying, watching for cancellation
+            std::chrono::steady_clock::time_point resume = std::min(deadline, std::chrono::steady_clock::now() + backoff);
+            while (std::chrono::steady_clock::now() < resume) {
+                if (cancelled && cancelled()) {
+                    result.outcome = CANCELLED;
+                    break;
+                }
+                std::this_thread::sleep_for(std::min(slice, std::chrono::duration_cast<std::chrono::milliseconds>(resume - std::chrono::steady_clock::now()) + std::chrono::milliseconds(1)));
+            }
+            if (result.outcome == CANCELLED) break;
+            backoff = std::min(backoff * 2, policy.max_backoff);
+            result.outcome = TIMEOUT; // in case the deadline passes before the next attempt
+        }
+        result.latency_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (result.abandoned) {
+            // the call still holds the worker; later transactions, on a new connection, get a worker of their own
+            retire_worker();
+            start_worker();
+        }
+
+        std::lock_guard<std::mutex> lock(_stats_mutex);
+        if (result.attempts > 1) _stats.retries += result.attempts - 1;
+        switch (result.outcome) {
+        case SUCCESS:
+            _stats.successes++;
+            _stats.success_total_ms += result.latency_ms;
+            _stats.success_max_ms = std::max(_stats.success_max_ms, result.latency_ms);
+            break;
+        case TIMEOUT: _stats.timeouts++; break;
+        case CANCELLED: _stats.cancelled++; break;
+        case FAILED: _stats.failures++; break;
+        }
+        return result;
+    }
+
+    TransactionEngine::Stats TransactionEngine::stats(void)
+    {
+        std::lock_guard<std::mutex> lock(_stats_mutex);
+        return _stats;
+    }
+
+    std::string TransactionEngine::result_as_string(const Result& result, const BusConnection& bus)
+    {
+        std::stringstream ss;
+        switch (result.outcome) {
+        case SUCCESS:
+            break;
+        case TIMEOUT:
+            ss << "Error: Transaction timed out after " << result.latency_ms << " ms (" << result.attempts << " attempts)." << std::endl;
+            break;
+        case CANCELLED:
+            ss << "Transaction cancelled after " << result.latency_ms << " ms." << std::endl;
+            break;
+        case FAILED:
+            if (result.last_result == BUS_INVALID_TARGET) {
+                ss << bus.invalid_target_message(bus.target()) << std::endl;
+            } else if (result.last_result == BUS_UNSUPPORTED) {
+                ss << "Error: Cannot perform transactions on this bus." << std::endl;
+            } else {
+                ss << "Error: Transaction failed (" << bus_result_as_string(result.last_result) << ") after "
+                   << result.attempts << " attempts in " << result.latency_ms << " ms." << std::endl;
+            }
+            break;
+        }
+        return ss.str();
+    }
+
+    std::string TransactionEngine::stats_as_string(const Stats& stats)
+    {
+        std::stringstream ss;
+        ss << "Transactions: " << stats.successes << " succeeded, " << stats.timeouts << " timed out, "
+           << stats.failures << " failed, " << stats.cancelled << " cancelled, " << stats.retries << " retries";
+        if (stats.successes > 0) {
+            ss << "; successful latency avg " << (stats.success_total_ms / stats.successes) << " ms, max " << stats.success_max_ms << " ms";
+        }
+        ss << std::endl;
+        return ss.str();
+    }
+
+    std::chrono::milliseconds TransactionEngine::parse_duration(const std::string& text)
+    {
+        size_t end;
+        double value = stod(text, &end);
+        std::string unit = text.substr(end);
+        double ms;
+        if ((unit.size() == 0) || (unit.compare("ms") == 0) || (unit.compare("MS") == 0)) ms = value;
+        else if ((unit.compare("s") == 0) || (unit.compare("S") == 0)) ms = value * 1000.0;
+        else if ((unit.compare("us") == 0) || (unit.compare("US") == 0)) ms = value / 1000.0;
+        else throw std::invalid_argument("unknown unit");
+        if (!std::isfinite(ms)) throw std::invalid_argument("duration must be finite");
+        if (ms < 1.0) throw std::invalid_argument("duration must be at least 1 ms");
+        if (ms > std::numeric_limits<unsigned>::max()) throw std::out_of_range("duration too long");
+        return std::chrono::milliseconds(static_cast<long>(ms));
+    }
+
+}
@@ -0,0 +1,20 @@
+#include <transport_registry.hpp>
+
+namespace Nos3 {
+
+    std::mutex TransportRegistry::_mutex;
+    std::map<std::string, std::weak_ptr<NosEngine::Transport::TransportHub>> TransportRegistry::_hubs;
+
+    std::shared_ptr<NosEngine::Transport::TransportHub> TransportRegistry::acquire(const std::string& connection_string)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::weak_ptr<NosEngine::Transport::TransportHub>& entry = _hubs[connection_string];
+        std::shared_ptr<NosEngine::Transport::TransportHub> hub = entry.lock();
+        if (!hub) {
+            hub = std::make_shared<NosEngine::Transport::TransportHub>();
+            entry = hub;
+        }
+        return hub;
+    }
+
+}
@@ -0,0 +1,44 @@
+#include <worker_pool.hpp>
+
+namespace Nos3 {
+
+    WorkerPool::WorkerPool(size_t threads) : _stopping(false)
+    {
+        if (threads == 0) threads = 1;
+        for (size_t i = 0; i < threads; i++) _threads.push_back(std::thread([this]{run();}));
+    }
+
+    WorkerPool::~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _cv.notify_all();
+        for (std::thread& thread : _threads) thread.join();
+    }
+
+    void WorkerPool::post(std::function<void(void)> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.push_back(std::move(job));
+        }
+        _cv.notify_one();
+    }
+
+    void WorkerPool::run(void)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _cv.wait(lock, [this]{return _stopping || !_jobs.empty();});
+            if (_jobs.empty()) return; // stopping, and everything posted has run
+            std::function<void(void)> job = std::move(_jobs.front());
+            _jobs.pop_front();
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+    }
+
+}
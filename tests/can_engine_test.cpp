@@ -0,0 +1,225 @@
+#include <can_engine.hpp>
+#include <bus_connections.hpp>
+
+#include <string>
+#include <vector>
+
+#include <check.hpp>
+
+using namespace Nos3;
+
+static std::vector<uint8_t> bytes(std::initializer_list<int> values)
+{
+    std::vector<uint8_t> out;
+    for (int value : values) out.push_back(static_cast<uint8_t>(value));
+    return out;
+}
+
+static std::string message(size_t len)
+{
+    std::string data;
+    for (size_t i = 0; i < len; i++) data.push_back(static_cast<char>(i));
+    return data;
+}
+
+static CanEngine engine_with_timeout(unsigned timeout_ms)
+{
+    CanEngine engine;
+    CanEngine::IsoTpOptions options = engine.isotp_options();
+    options.timeout_ms = timeout_ms;
+    engine.set_isotp_options(options);
+    return engine;
+}
+
+static void test_parse_frame(void)
+{
+    CanFrame frame;
+    CHECK(CanEngine::parse_frame("123#DEADBEEF", frame));
+    CHECK_EQUAL(frame.id, 0x123u);
+    CHECK_EQUAL(unsigned(frame.len), 4u);
+    CHECK_EQUAL(unsigned(frame.data[0]), 0xDEu);
+    CHECK_EQUAL(CanEngine::frame_as_string(frame), std::string("123#DEADBEEF"));
+
+    CHECK(CanEngine::parse_frame("1ABCDEF0#", frame));
+    CHECK_EQUAL(frame.id, 0x1ABCDEF0u);
+    CHECK_EQUAL(unsigned(frame.len), 0u);
+    CHECK_EQUAL(CanEngine::frame_as_string(frame), std::string("1ABCDEF0#"));
+
+    CHECK(!CanEngine::parse_frame("#00", frame));
+    CHECK(!CanEngine::parse_frame("123", frame));
+    CHECK(!CanEngine::parse_frame("20000000#00", frame));  // beyond 29 bits
+    CHECK(!CanEngine::parse_frame("123#0", frame));        // odd digit count
+    CHECK(!CanEngine::parse_frame("123#000000000000000000", frame)); // 9 bytes
+    CHECK(!CanEngine::parse_frame("12G#00", frame));
+    CHECK(!CanEngine::parse_frame("123#0G", frame));
+}
+
+static void test_filters(void)
+{
+    CanEngine engine;
+    CHECK(engine.accepts(0x7FF));
+    CanEngine::Filter filter = {0x700, 0x7F0};
+    engine.add_filter(filter);
+    CHECK(engine.accepts(0x705));
+    CHECK(!engine.accepts(0x715));
+    engine.clear_filters();
+    CHECK(engine.accepts(0x715));
+}
+
+static void test_send(void)
+{
+    CanEngine engine;
+    CANConnection bus;
+    CanFrame frames[3];
+    for (uint32_t i = 0; i < 3; i++) CanEngine::parse_frame(std::to_string(100 + i) + "#0102", frames[i]);
+    size_t sent;
+    CHECK_EQUAL(engine.send(bus, frames, 3, sent), BUS_SUCCESS);
+    CHECK_EQUAL(sent, 3u);
+    CHECK_EQUAL(bus.written.size(), 3u);
+    CHECK_EQUAL(bus.written[2].id, 0x102u);
+
+    bus.write_result = BUS_BUSY;
+    CHECK_EQUAL(engine.send(bus, frames, 3, sent), BUS_BUSY);
+    CHECK_EQUAL(sent, 0u);
+}
+
+static void test_isotp_send_single_frame(void)
+{
+    CanEngine engine;
+    CANConnection bus;
+    std::string error;
+    std::string data = message(5);
+    CHECK_EQUAL(engine.isotp_send(bus, 0x7E0, 0x7E8, data.data(), data.size(), error), BUS_SUCCESS);
+    CHECK_EQUAL(bus.written.size(), 1u);
+    CHECK(bus.written[0].data == bytes({0x05, 0, 1, 2, 3, 4, 0xCC, 0xCC}));
+    CHECK_EQUAL(bus.reads, 0u); // no flow control for a single frame
+}
+
+static void test_isotp_send_segmented(void)
+{
+    CanEngine engine;
+    CANConnection bus;
+    std::string error;
+    std::string data = message(20);
+    bus.queue(0x7E8, bytes({0x30, 0x00, 0x00}));
+    CHECK_EQUAL(engine.isotp_send(bus, 0x7E0, 0x7E8, data.data(), data.size(), error), BUS_SUCCESS);
+    CHECK_EQUAL(bus.written.size(), 3u);
+    CHECK(bus.written[0].data == bytes({0x10, 20, 0, 1, 2, 3, 4, 5}));
+    CHECK(bus.written[1].data == bytes({0x21, 6, 7, 8, 9, 10, 11, 12}));
+    CHECK(bus.written[2].data == bytes({0x22, 13, 14, 15, 16, 17, 18, 19}));
+    for (const CANConnection::Frame& frame : bus.written) CHECK_EQUAL(frame.id, 0x7E0u);
+}
+
+static void test_isotp_send_blocks(void)
+{
+    CanEngine engine;
+    CANConnection bus;
+    std::string error;
+    std::string data = message(6 + 7 * 4);
+    // a block size of 2 asks for flow control after every second consecutive frame
+    bus.queue(0x7E8, bytes({0x30, 0x02, 0x00}));
+    bus.queue(0x7E8, bytes({0x30, 0x02, 0x00}));
+    CHECK_EQUAL(engine.isotp_send(bus, 0x7E0, 0x7E8, data.data(), data.size(), error), BUS_SUCCESS);
+    CHECK_EQUAL(bus.written.size(), 5u);
+    CHECK_EQUAL(unsigned(bus.written[4].data[0]), 0x24u);
+
+    // the second flow control never comes
+    CANConnection silent;
+    silent.queue(0x7E8, bytes({0x30, 0x02, 0x00}));
+    CanEngine impatient = engine_with_timeout(20);
+    CHECK_EQUAL(impatient.isotp_send(silent, 0x7E0, 0x7E8, data.data(), data.size(), error), BUS_TIMEOUT);
+    CHECK_EQUAL(silent.written.size(), 3u);
+    CHECK(error.find("no flow control") != std::string::npos);
+}
+
+static void test_isotp_send_overflow(void)
+{
+    CanEngine engine;
+    CANConnection bus;
+    std::string error;
+    std::string data = message(20);
+    bus.queue(0x7E8, bytes({0x32}));
+    CHECK_EQUAL(engine.isotp_send(bus, 0x7E0, 0x7E8, data.data(), data.size(), error), BUS_ERROR);
+    CHECK_EQUAL(bus.written.size(), 1u);
+
+    std::string too_long = message(4096);
+    CHECK_EQUAL(engine.isotp_send(bus, 0x7E0, 0x7E8, too_long.data(), too_long.size(), error), BUS_ERROR);
+}
+
+static void test_isotp_receive(void)
+{
+    CanEngine engine;
+    CANConnection bus;
+    std::string error;
+    std::vector<char> data;
+
+    bus.queue(0x7E8, bytes({0x03, 0xA, 0xB, 0xC}));
+    CHECK_EQUAL(engine.isotp_receive(bus, 0x7E0, 0x7E8, data, error), BUS_SUCCESS);
+    CHECK(data == std::vector<char>({0xA, 0xB, 0xC}));
+    CHECK(bus.written.empty());
+
+    bus.queue(0x7E8, bytes({0x10, 20, 0, 1, 2, 3, 4, 5}));
+    bus.queue(0x7E8, bytes({0x21, 6, 7, 8, 9, 10, 11, 12}));
+    bus.queue(0x7E8, bytes({0x22, 13, 14, 15, 16, 17, 18, 19, 0xCC}));
+    CHECK_EQUAL(engine.isotp_receive(bus, 0x7E0, 0x7E8, data, error), BUS_SUCCESS);
+    std::string expected = message(20);
+    CHECK(std::string(data.begin(), data.end()) == expected);
+    CHECK_EQUAL(bus.written.size(), 1u); // flow control
+    CHECK_EQUAL(bus.written[0].id, 0x7E0u);
+    CHECK_EQUAL(unsigned(bus.written[0].data[0]), 0x30u);
+}
+
+static void test_isotp_receive_errors(void)
+{
+    CanEngine engine = engine_with_timeout(20);
+    std::string error;
+    std::vector<char> data;
+
+    CANConnection out_of_order;
+    out_of_order.queue(0x7E8, bytes({0x10, 20, 0, 1, 2, 3, 4, 5}));
+    out_of_order.queue(0x7E8, bytes({0x22, 6, 7, 8, 9, 10, 11, 12}));
+    CHECK_EQUAL(engine.isotp_receive(out_of_order, 0x7E0, 0x7E8, data, error), BUS_ERROR);
+    CHECK(error.find("sequence") != std::string::npos);
+
+    CANConnection nothing;
+    CHECK_EQUAL(engine.isotp_receive(nothing, 0x7E0, 0x7E8, data, error), BUS_TIMEOUT);
+
+    CANConnection failing;
+    failing.read_result = BUS_ERROR;
+    CHECK_EQUAL(engine.isotp_receive(failing, 0x7E0, 0x7E8, data, error), BUS_ERROR);
+}
+
+// Polls that find no frame of the kind awaited are not traffic
+static void test_stats_skip_empty_polls(void)
+{
+    CanEngine engine;
+    CANConnection bus;
+    std::string error;
+    std::string data = message(10);
+    bus.queue(0x7E8, bytes({0x10})); // not flow control
+    bus.queue(0x7E8, bytes({0x30, 0x00, 0x00}));
+    CHECK_EQUAL(engine.isotp_send(bus, 0x7E0, 0x7E8, data.data(), data.size(), error), BUS_SUCCESS);
+    CHECK(bus.reads >= 2);
+    std::string stats = engine.stats_as_string();
+    CHECK(stats.find("CAN: 3 frames") != std::string::npos);
+    CHECK(stats.find("0x7E8: tx 0 (0 bytes), rx 1 (8 bytes), errors 0") != std::string::npos);
+    CHECK(stats.find("0x7E0: tx 2 (16 bytes), rx 0 (0 bytes), errors 0") != std::string::npos);
+
+    engine.reset_stats();
+    CHECK(engine.stats_as_string().find("CAN: 0 frames") != std::string::npos);
+}
+
+int main(void)
+{
+    test_parse_frame();
+    test_filters();
+    test_send();
+    test_isotp_send_single_frame();
+    test_isotp_send_segmented();
+    test_isotp_send_blocks();
+    test_isotp_send_overflow();
+    test_isotp_receive();
+    test_isotp_receive_errors();
+    test_stats_skip_empty_polls();
+    return check_result();
+}
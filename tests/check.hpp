@@ -0,0 +1,43 @@
+#ifndef NOS3_CHECK_HPP
+#define NOS3_CHECK_HPP
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+// Just enough of a test harness for these tests: CHECK records a failure and carries on, and main returns
+// check_result() so that ctest sees it
+namespace Nos3 {
+    inline int& check_failures(void) {static int failures = 0; return failures;}
+    inline int check_result(void) {
+        if (check_failures() > 0) std::cerr << check_failures() << " check(s) failed" << std::endl;
+        return (check_failures() > 0) ? 1 : 0;
+    }
+}
+
+#define CHECK(expr) do { \
+        if (!(expr)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #expr ") failed" << std::endl; \
+            ::Nos3::check_failures()++; \
+        } \
+    } while (0)
+
+#define CHECK_EQUAL(actual, expected) do { \
+        if (!((actual) == (expected))) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_EQUAL(" #actual ", " #expected ") failed: got " << (actual) \
+                      << ", expected " << (expected) << std::endl; \
+            ::Nos3::check_failures()++; \
+        } \
+    } while (0)
+
+// Checks that statement throws exception_type
+#define CHECK_THROWS(statement, exception_type) do { \
+        bool thrown = false; \
+        try { statement; } catch (exception_type&) { thrown = true; } \
+        if (!thrown) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": " #statement " did not throw " #exception_type << std::endl; \
+            ::Nos3::check_failures()++; \
+        } \
+    } while (0)
+
+#endif
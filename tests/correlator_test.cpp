@@ -0,0 +1,130 @@
+#include <correlator.hpp>
+
+#include <chrono>
+#include <string>
+
+#include <check.hpp>
+
+using namespace Nos3;
+
+typedef std::chrono::steady_clock Clock;
+
+static bool contains(const std::string& text, const std::string& part)
+{
+    bool found = text.find(part) != std::string::npos;
+    if (!found) std::cerr << "\"" << part << "\" is not in:" << std::endl << text;
+    return found;
+}
+
+static Correlator::Matcher matcher(Correlator::MatchBy by, size_t request_offset, size_t response_offset, size_t width)
+{
+    Correlator::Matcher m = {by, request_offset, response_offset, width};
+    return m;
+}
+
+static void test_order(void)
+{
+    Correlator correlator;
+    CHECK(!correlator.enabled());
+    correlator.enable(matcher(Correlator::ORDER, 0, 0, 1), std::chrono::milliseconds(5000));
+    CHECK(correlator.enabled());
+    correlator.sent("node", "a", 1, Clock::now());
+    correlator.sent("node", "b", 1, Clock::now());
+    correlator.received("node", "x", 1);
+    correlator.received("node", "y", 1);
+    correlator.received("node", "z", 1);
+    correlator.received("stranger", "z", 1); // nothing was sent there
+    std::string report = correlator.report();
+    CHECK(contains(report, "Correlation by ORDER, timeout 5000 ms"));
+    CHECK(contains(report, "node: sent 2, matched 2, timed out 0, unmatched replies 1, pending 0"));
+    CHECK(report.find("stranger") == std::string::npos);
+}
+
+static void test_offset(void)
+{
+    Correlator correlator;
+    correlator.enable(matcher(Correlator::OFFSET, 0, 1, 2), std::chrono::milliseconds(5000));
+    correlator.sent("node", "\x00\x01", 2, Clock::now());
+    correlator.sent("node", "\x00\x02", 2, Clock::now());
+    correlator.sent("node", "\x00", 1, Clock::now()); // too short to carry a sequence number
+    correlator.received("node", "R\x00\x02", 3);
+    CHECK(contains(correlator.report(), "node: sent 3, matched 1, timed out 0, unmatched replies 0, pending 1"));
+    correlator.received("node", "R\x00\x02", 3); // already matched
+    correlator.received("node", "R\x00", 2);     // too short
+    correlator.received("node", "R\x00\x01", 3);
+    CHECK(contains(correlator.report(), "node: sent 3, matched 2, timed out 0, unmatched replies 2, pending 0"));
+    CHECK(contains(correlator.report(), "(request offset 0, reply offset 1, 2 bytes)"));
+}
+
+static void test_ccsds(void)
+{
+    Correlator correlator;
+    correlator.enable(matcher(Correlator::CCSDS, 0, 0, 2), std::chrono::milliseconds(5000));
+    // the sequence count is the low 14 bits of bytes 2 and 3; the sequence flags above it are ignored
+    const char request[] = {0x18, 0x01, static_cast<char>(0xC0 | 0x12), 0x34, 0x00, 0x01, 0x00};
+    const char reply[] = {0x08, 0x02, 0x12, 0x34, 0x00, 0x00};
+    const char other[] = {0x08, 0x02, 0x12, 0x35, 0x00, 0x00};
+    correlator.sent("node", request, sizeof(request), Clock::now());
+    correlator.received("node", other, sizeof(other));
+    correlator.received("node", reply, 5); // not a whole primary header
+    correlator.received("node", reply, sizeof(reply));
+    CHECK(contains(correlator.report(), "node: sent 1, matched 1, timed out 0, unmatched replies 2, pending 0"));
+}
+
+static void test_withdraw(void)
+{
+    Correlator correlator;
+    correlator.enable(matcher(Correlator::ORDER, 0, 0, 1), std::chrono::milliseconds(5000));
+    Clock::time_point first = Clock::now();
+    Clock::time_point second = first + std::chrono::microseconds(1);
+    correlator.sent("node", "a", 1, first);
+    correlator.sent("node", "b", 1, second);
+    correlator.withdraw("node", second);
+    correlator.withdraw("stranger", second);
+    CHECK(contains(correlator.report(), "node: sent 1, matched 0, timed out 0, unmatched replies 0, pending 1"));
+    correlator.received("node", "x", 1);
+    CHECK(contains(correlator.report(), "node: sent 1, matched 1, timed out 0, unmatched replies 0, pending 0"));
+}
+
+static void test_timeout(void)
+{
+    Correlator correlator;
+    correlator.enable(matcher(Correlator::ORDER, 0, 0, 1), std::chrono::milliseconds(10));
+    correlator.sent("node", "a", 1, Clock::now() - std::chrono::seconds(1));
+    correlator.received("node", "x", 1);
+    CHECK(contains(correlator.report(), "node: sent 1, matched 0, timed out 1, unmatched replies 1, pending 0"));
+}
+
+static void test_latency(void)
+{
+    Correlator correlator;
+    correlator.enable(matcher(Correlator::ORDER, 0, 0, 1), std::chrono::milliseconds(60000));
+    correlator.sent("node", "a", 1, Clock::now() - std::chrono::milliseconds(3));
+    correlator.received("node", "x", 1);
+    std::string report = correlator.report();
+    // 3 ms falls in the [2048, 4096) us bucket
+    CHECK(contains(report, "p50 < 4096, p90 < 4096, p99 < 4096"));
+}
+
+static void test_reset(void)
+{
+    Correlator correlator;
+    correlator.enable(matcher(Correlator::ORDER, 0, 0, 1), std::chrono::milliseconds(5000));
+    correlator.sent("node", "a", 1, Clock::now());
+    correlator.reset();
+    CHECK(contains(correlator.report(), "Nothing sent yet."));
+    correlator.disable();
+    CHECK(contains(correlator.report(), "Correlation (off) by ORDER"));
+}
+
+int main(void)
+{
+    test_order();
+    test_offset();
+    test_ccsds();
+    test_withdraw();
+    test_timeout();
+    test_latency();
+    test_reset();
+    return check_result();
+}
@@ -0,0 +1,83 @@
+#ifndef NOS3_BUS_CONNECTIONS_HPP
+#define NOS3_BUS_CONNECTIONS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <bus_result.hpp>
+
+// Stands in for inc/bus_connections.hpp in the unit tests, with just the calls the modules under test make.  Writes
+// are logged and reads are answered from a script, so no NOS Engine is needed.
+namespace Nos3 {
+
+    // A bus of devices with 256 8 bit registers each and an auto-incrementing register pointer
+    class I2CConnection {
+    public:
+        I2CConnection() : registers(128, std::vector<uint8_t>(256, 0)) {}
+
+        size_t max_chunk_size(void) const {return chunk_size;}
+        // Writes the register number, then reads rlen registers from it
+        BusResult try_transact_device(int address, const uint8_t* wbuf, size_t wlen, uint8_t* rbuf, size_t rlen){
+            transactions++;
+            if (result != BUS_SUCCESS) return result;
+            if (wlen != 1) return BUS_ERROR;
+            for (size_t i = 0; i < rlen; i++) rbuf[i] = registers[address][(wbuf[0] + i) & 0xff];
+            return BUS_SUCCESS;
+        }
+        // The first byte is the register number, the rest the values from it on
+        BusResult try_write_device(int address, const uint8_t* buf, size_t len){
+            writes++;
+            if (result != BUS_SUCCESS) return result;
+            for (size_t i = 1; i < len; i++) registers[address][(buf[0] + i - 1) & 0xff] = buf[i];
+            return BUS_SUCCESS;
+        }
+
+        std::vector<std::vector<uint8_t>> registers;
+        size_t chunk_size = 255;
+        size_t transactions = 0;
+        size_t writes = 0;
+        BusResult result = BUS_SUCCESS;
+    };
+
+    class CANConnection {
+    public:
+        struct Frame {
+            uint32_t id;
+            std::vector<uint8_t> data;
+        };
+
+        BusResult try_write_frame(uint32_t id, const uint8_t* data, size_t len){
+            if (write_result != BUS_SUCCESS) return write_result;
+            Frame frame = {id, std::vector<uint8_t>(data, data + len)};
+            written.push_back(frame);
+            return BUS_SUCCESS;
+        }
+        // Answers with the next frame queued for id; with none queued the bytes read are 0xFF, which is no ISO-TP frame
+        BusResult try_read_frame(uint32_t id, uint8_t* data, size_t len){
+            reads++;
+            if (read_result != BUS_SUCCESS) return read_result;
+            std::memset(data, 0xFF, len);
+            std::deque<std::vector<uint8_t>>& queue = frames[id];
+            if (!queue.empty()) {
+                std::memcpy(data, queue.front().data(), std::min(len, queue.front().size()));
+                queue.pop_front();
+            }
+            return BUS_SUCCESS;
+        }
+
+        void queue(uint32_t id, const std::vector<uint8_t>& data) {frames[id].push_back(data);}
+
+        std::vector<Frame> written;
+        std::map<uint32_t, std::deque<std::vector<uint8_t>>> frames;
+        size_t reads = 0;
+        BusResult write_result = BUS_SUCCESS;
+        BusResult read_result = BUS_SUCCESS;
+    };
+
+}
+
+#endif
@@ -0,0 +1,92 @@
+#include <macro_library.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <check.hpp>
+
+using namespace Nos3;
+
+static void define(MacroLibrary& library, const std::string& name, const std::vector<std::string>& params, const std::vector<std::string>& lines)
+{
+    library.begin(name, params);
+    for (const std::string& line : lines) library.record(line);
+    library.end();
+}
+
+static void test_recording(void)
+{
+    MacroLibrary library;
+    CHECK(!library.recording());
+    library.begin("boot", std::vector<std::string>(1, "mode"));
+    CHECK(library.recording());
+    CHECK_EQUAL(library.recording_name(), std::string("boot"));
+    library.record("WRITE $mode");
+    library.record("READ 4");
+    const MacroLibrary::Macro& macro = library.end();
+    CHECK(!library.recording());
+    CHECK_EQUAL(macro.lines.size(), 2u);
+    CHECK_EQUAL(macro.params.size(), 1u);
+    CHECK(library.find("boot") != nullptr);
+    CHECK(library.find("other") == nullptr);
+
+    // redefining replaces the old body
+    define(library, "boot", std::vector<std::string>(), std::vector<std::string>(1, "READ 1"));
+    CHECK_EQUAL(library.find("boot")->lines.size(), 1u);
+    CHECK_EQUAL(library.macros().size(), 1u);
+
+    CHECK(library.remove("boot"));
+    CHECK(!library.remove("boot"));
+}
+
+static void test_names(void)
+{
+    MacroLibrary library;
+    CHECK_THROWS(library.begin("", std::vector<std::string>()), std::runtime_error);
+    CHECK_THROWS(library.begin("two words", std::vector<std::string>()), std::runtime_error);
+    CHECK_THROWS(library.begin("ok", std::vector<std::string>(1, "bad-name")), std::runtime_error);
+    CHECK_THROWS(library.begin("ok", std::vector<std::string>(2, "twice")), std::runtime_error);
+    CHECK(!library.recording());
+    library.begin("Snake_case_2", std::vector<std::string>());
+    CHECK(library.recording());
+}
+
+static void test_expand(void)
+{
+    MacroLibrary library;
+    std::vector<std::string> params = {"addr", "n"};
+    define(library, "poll", params, {"SET SIMNODE $addr", "READ ${n}", "WRITE ${addr}00", "WRITE 100$ and $ alone", "WRITE ${n"});
+    std::map<std::string, std::string> values = {{"addr", "0x40"}, {"n", "4"}};
+    std::vector<std::string> lines = library.expand("poll", values);
+    CHECK_EQUAL(lines.size(), 5u);
+    if (lines.size() == 5) {
+        CHECK_EQUAL(lines[0], std::string("SET SIMNODE 0x40"));
+        CHECK_EQUAL(lines[1], std::string("READ 4"));
+        CHECK_EQUAL(lines[2], std::string("WRITE 0x4000"));
+        CHECK_EQUAL(lines[3], std::string("WRITE 100$ and $ alone"));
+        CHECK_EQUAL(lines[4], std::string("WRITE ${n"));
+    }
+}
+
+static void test_expand_errors(void)
+{
+    MacroLibrary library;
+    define(library, "poll", std::vector<std::string>(1, "addr"), {"SET SIMNODE $addr"});
+    define(library, "typo", std::vector<std::string>(1, "addr"), {"SET SIMNODE $adr"});
+    std::map<std::string, std::string> values = {{"addr", "0x40"}};
+    CHECK_THROWS(library.expand("missing", values), std::runtime_error);
+    CHECK_THROWS(library.expand("poll", std::map<std::string, std::string>()), std::runtime_error);
+    CHECK_THROWS(library.expand("poll", {{"addr", "1"}, {"extra", "2"}}), std::runtime_error);
+    CHECK_THROWS(library.expand("typo", values), std::runtime_error);
+    CHECK_EQUAL(library.expand("poll", values).size(), 1u);
+}
+
+int main(void)
+{
+    test_recording();
+    test_names();
+    test_expand();
+    test_expand_errors();
+    return check_result();
+}
@@ -0,0 +1,84 @@
+#include <payload_library.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <check.hpp>
+
+using namespace Nos3;
+
+static void test_decode_hex(void)
+{
+    CHECK_EQUAL(PayloadLibrary::decode_hex("0102ff"), std::string("\x01\x02\xff"));
+    CHECK_EQUAL(PayloadLibrary::decode_hex("de AD\n be\tEF"), std::string("\xde\xad\xbe\xef"));
+    CHECK_EQUAL(PayloadLibrary::decode_hex(""), std::string());
+    CHECK_THROWS(PayloadLibrary::decode_hex("0g"), std::runtime_error);
+    CHECK_EQUAL(PayloadLibrary::decode_hex("abc"), std::string("\xab\xc0")); // an odd digit count pads with 0, like WRITE
+}
+
+static void test_references(void)
+{
+    CHECK(PayloadLibrary::is_reference("@boot"));
+    CHECK(!PayloadLibrary::is_reference("@"));
+    CHECK(!PayloadLibrary::is_reference("@@boot"));
+    CHECK(!PayloadLibrary::is_reference("boot"));
+    CHECK_EQUAL(PayloadLibrary::unescape("@@boot"), std::string("@boot"));
+    CHECK_EQUAL(PayloadLibrary::unescape("@@@"), std::string("@@"));
+    CHECK_EQUAL(PayloadLibrary::unescape("boot"), std::string("boot"));
+    CHECK_EQUAL(PayloadLibrary::unescape("a@@"), std::string("a@@"));
+}
+
+static void test_define(void)
+{
+    PayloadLibrary library;
+    const PayloadLibrary::Payload& small = library.define("small", "abc", 3);
+    const char* small_data = small.data;
+    CHECK_EQUAL(small.len, 3u);
+    CHECK(std::memcmp(small.data, "abc", 3) == 0);
+
+    // payloads never move, even when later ones need blocks of their own
+    std::vector<char> large(100 * 1024, 'x');
+    library.define("large", large.data(), large.size());
+    for (int i = 0; i < 100; i++) library.define("filler" + std::to_string(i), large.data(), 1000);
+    const PayloadLibrary::Payload* found = library.find("small");
+    CHECK(found != nullptr);
+    CHECK(found->data == small_data);
+    CHECK(std::memcmp(found->data, "abc", 3) == 0);
+    CHECK_EQUAL(library.find("large")->len, large.size());
+
+    library.define("small", "de", 2);
+    CHECK_EQUAL(library.find("small")->len, 2u);
+    CHECK(library.find("missing") == nullptr);
+    CHECK_THROWS(library.define("empty", "", 0), std::runtime_error);
+
+    library.clear();
+    CHECK(library.payloads().empty());
+}
+
+static void test_load(void)
+{
+    const char* path = "payload_library_test.hex";
+    {
+        std::ofstream out(path);
+        out << "01 02\n03 04\n";
+    }
+    PayloadLibrary library;
+    const PayloadLibrary::Payload& hex = library.load("hex", path, true);
+    CHECK_EQUAL(std::string(hex.data, hex.len), std::string("\x01\x02\x03\x04"));
+    const PayloadLibrary::Payload& binary = library.load("binary", path, false);
+    CHECK_EQUAL(std::string(binary.data, binary.len), std::string("01 02\n03 04\n"));
+    std::remove(path);
+    CHECK_THROWS(library.load("missing", "no/such/file", false), std::runtime_error);
+}
+
+int main(void)
+{
+    test_decode_hex();
+    test_references();
+    test_define();
+    test_load();
+    return check_result();
+}
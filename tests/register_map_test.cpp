@@ -0,0 +1,207 @@
+#include <register_map.hpp>
+#include <bus_connections.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <check.hpp>
+
+using namespace Nos3;
+
+static void test_check_range(void)
+{
+    RegisterMap::check_range(0x40, 0, 256);
+    RegisterMap::check_range(0x40, 255, 1);
+    RegisterMap::check_range(127, 0x10, 4);
+    CHECK_THROWS(RegisterMap::check_range(128, 0, 1), std::runtime_error);
+    CHECK_THROWS(RegisterMap::check_range(0x40, 256, 1), std::runtime_error);
+    CHECK_THROWS(RegisterMap::check_range(0x40, 0, 0), std::runtime_error);
+    CHECK_THROWS(RegisterMap::check_range(0x40, 255, 2), std::runtime_error);
+    CHECK_THROWS(RegisterMap::check_range(0x40, 0, 257), std::runtime_error);
+    // counts that would overflow a start + count check
+    CHECK_THROWS(RegisterMap::check_range(0x40, 1, static_cast<size_t>(-1)), std::runtime_error);
+    CHECK_THROWS(RegisterMap::check_range(0x40, static_cast<unsigned long>(-1), 1), std::runtime_error);
+}
+
+static const char* write_map(void)
+{
+    const char* path = "register_map_test.map";
+    std::ofstream out(path);
+    out << "# device register name\n";
+    out << "0x40 0x0F WHO_AM_I STATIC\n";
+    out << "0x40 0x10 ID_1 STATIC # trailing comment\n";
+    out << "0x40 0x11 DATA\n";
+    out << "\n";
+    out << "64 0x12 ID_2 STATIC\n";
+    return path;
+}
+
+static void test_load(void)
+{
+    RegisterMap map;
+    const char* path = write_map();
+    map.load(path);
+    CHECK_EQUAL(map.size(), 4u);
+    CHECK(map.find(0x40, 0x0F) != nullptr);
+    CHECK(map.find(0x40, 0x0F)->is_static);
+    CHECK_EQUAL(map.find(0x40, 0x0F)->name, std::string("WHO_AM_I"));
+    CHECK(!map.find(0x40, 0x11)->is_static);
+    CHECK(map.find(0x41, 0x0F) == nullptr);
+
+    {
+        std::ofstream out(path);
+        out << "0x40 0x100 TOO_HIGH\n";
+    }
+    CHECK_THROWS(map.load(path), std::runtime_error);
+    CHECK_EQUAL(map.size(), 4u); // a bad file leaves the map as it was
+
+    // a leading zero is decimal, not octal, as for bus targets
+    {
+        std::ofstream out(path);
+        out << "010 010 DECIMAL\n";
+        out << "0x10 0x10 HEX\n";
+    }
+    map.load(path);
+    CHECK_EQUAL(map.size(), 2u);
+    CHECK(map.find(10, 10) != nullptr);
+    CHECK_EQUAL(map.find(10, 10)->name, std::string("DECIMAL"));
+    CHECK(map.find(8, 8) == nullptr);
+    CHECK_EQUAL(map.find(16, 16)->name, std::string("HEX"));
+    {
+        std::ofstream out(path);
+        out << "-1 0x10 NEGATIVE\n";
+    }
+    CHECK_THROWS(map.load(path), std::runtime_error);
+    std::remove(path);
+    CHECK_THROWS(map.load("no/such/file"), std::runtime_error);
+}
+
+static void test_read_chunks(void)
+{
+    RegisterMap map;
+    I2CConnection bus;
+    bus.chunk_size = 4;
+    for (int r = 0; r < 256; r++) bus.registers[0x40][r] = static_cast<uint8_t>(r ^ 0x5A);
+    std::vector<uint8_t> values(10);
+    unsigned transactions;
+    CHECK_EQUAL(map.read(bus, 0x40, 0x20, values.size(), values.data(), true, transactions), BUS_SUCCESS);
+    CHECK_EQUAL(transactions, 3u);
+    for (size_t i = 0; i < values.size(); i++) CHECK_EQUAL(unsigned(values[i]), unsigned((0x20 + i) ^ 0x5A));
+
+    bus.result = BUS_TIMEOUT;
+    CHECK_EQUAL(map.read(bus, 0x40, 0x20, values.size(), values.data(), true, transactions), BUS_TIMEOUT);
+    CHECK_EQUAL(transactions, 1u);
+}
+
+static void test_cache(void)
+{
+    RegisterMap map;
+    const char* path = write_map();
+    map.load(path);
+    std::remove(path);
+    map.set_cache_enabled(true);
+    I2CConnection bus;
+    bus.registers[0x40][0x0F] = 0x68;
+    bus.registers[0x40][0x10] = 0x01;
+    bus.registers[0x40][0x11] = 0x22;
+    bus.registers[0x40][0x12] = 0x02;
+
+    uint8_t values[4];
+    unsigned transactions;
+    CHECK_EQUAL(map.read(bus, 0x40, 0x0F, 4, values, true, transactions), BUS_SUCCESS);
+    CHECK_EQUAL(transactions, 1u);
+    CHECK_EQUAL(map.cached(), 3u); // the STATIC registers
+
+    // the cached ends are served from the shadow and only the middle is read
+    bus.registers[0x40][0x0F] = 0x00;
+    bus.registers[0x40][0x11] = 0x33;
+    CHECK_EQUAL(map.read(bus, 0x40, 0x0F, 4, values, true, transactions), BUS_SUCCESS);
+    CHECK_EQUAL(transactions, 1u);
+    CHECK_EQUAL(unsigned(values[0]), 0x68u);
+    CHECK_EQUAL(unsigned(values[2]), 0x33u);
+
+    CHECK_EQUAL(map.read(bus, 0x40, 0x0F, 2, values, true, transactions), BUS_SUCCESS);
+    CHECK_EQUAL(transactions, 0u);
+
+    // bypassing the cache reads the bus
+    CHECK_EQUAL(map.read(bus, 0x40, 0x0F, 1, values, false, transactions), BUS_SUCCESS);
+    CHECK_EQUAL(transactions, 1u);
+    CHECK_EQUAL(unsigned(values[0]), 0x00u);
+
+    // writing drops what was written from the shadow
+    uint8_t written = 0x77;
+    CHECK_EQUAL(map.write(bus, 0x40, 0x0F, &written, 1), BUS_SUCCESS);
+    CHECK_EQUAL(unsigned(bus.registers[0x40][0x0F]), 0x77u);
+    CHECK_EQUAL(map.cached(), 2u);
+    CHECK_EQUAL(map.read(bus, 0x40, 0x0F, 1, values, true, transactions), BUS_SUCCESS);
+    CHECK_EQUAL(transactions, 1u);
+    CHECK_EQUAL(unsigned(values[0]), 0x77u);
+
+    map.set_cache_enabled(false);
+    CHECK_EQUAL(map.cached(), 0u);
+}
+
+static void test_watcher(void)
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    I2CConnection bus;
+    std::vector<RegisterWatcher::Change> reported;
+    std::vector<BusResult> results;
+
+    RegisterWatcher watcher(
+        [&](int device, int start, size_t count, uint8_t* values) {
+            std::lock_guard<std::mutex> lock(mutex);
+            uint8_t reg = start;
+            return bus.try_transact_device(device, &reg, 1, values, count);
+        },
+        [&](unsigned, const RegisterWatcher::Watch&, const std::vector<RegisterWatcher::Change>& changes, BusResult result) {
+            std::lock_guard<std::mutex> lock(mutex);
+            reported.insert(reported.end(), changes.begin(), changes.end());
+            results.push_back(result);
+            cv.notify_all();
+        });
+    RegisterWatcher::Watch watch = {0x40, 0x20, 4, std::chrono::milliseconds(1)};
+    unsigned id = watcher.add(watch, std::vector<uint8_t>(4, 0));
+    CHECK_EQUAL(watcher.watches().size(), 1u);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    bus.registers[0x40][0x22] = 9;
+    CHECK(cv.wait_for(lock, std::chrono::seconds(5), [&]{return !results.empty();}));
+    CHECK_EQUAL(reported.size(), 1u);
+    if (reported.size() == 1) {
+        CHECK_EQUAL(reported[0].reg, 0x22);
+        CHECK_EQUAL(unsigned(reported[0].old_value), 0u);
+        CHECK_EQUAL(unsigned(reported[0].new_value), 9u);
+    }
+
+    // a failing read is reported once, however many times it fails
+    bus.result = BUS_ERROR;
+    CHECK(cv.wait_for(lock, std::chrono::seconds(5), [&]{return results.size() == 2;}));
+    CHECK_EQUAL(results.back(), BUS_ERROR);
+    lock.unlock();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    lock.lock();
+    CHECK_EQUAL(results.size(), 2u);
+    lock.unlock();
+
+    CHECK(watcher.remove(id));
+    CHECK(!watcher.remove(id));
+    CHECK(watcher.watches().empty());
+}
+
+int main(void)
+{
+    test_check_range();
+    test_load();
+    test_read_chunks();
+    test_cache();
+    test_watcher();
+    return check_result();
+}
@@ -0,0 +1,197 @@
+#include <stress_generator.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <check.hpp>
+
+using namespace Nos3;
+
+static StressGenerator::Options defaults(void)
+{
+    StressGenerator::Options options;
+    options.seed = 1;
+    options.operations = 0;
+    options.workers = 4;
+    options.mix[0] = options.mix[1] = options.mix[2] = 1;
+    StressGenerator::SizeRange sizes = {1, 16};
+    options.sizes.push_back(sizes);
+    options.gap_us = 0;
+    return options;
+}
+
+static StressGenerator::Options parsed(const std::string& command)
+{
+    std::vector<std::string> tokens;
+    std::stringstream in(command);
+    std::string token;
+    while (in >> token) tokens.push_back(token);
+    StressGenerator::Options options = defaults();
+    StressGenerator::parse(tokens, 1, options);
+    return options;
+}
+
+static bool same_ops(StressGenerator& a, StressGenerator& b)
+{
+    StressGenerator::Op x, y;
+    while (a.remaining() > 0) {
+        if (b.remaining() == 0) return false;
+        a.next(x);
+        b.next(y);
+        if ((x.kind != y.kind) || (x.data != y.data) || (x.rlen != y.rlen) || (x.target != y.target) || (x.gap_us != y.gap_us)) return false;
+    }
+    return b.remaining() == 0;
+}
+
+static void test_parse(void)
+{
+    StressGenerator::Options options = parsed("STRESS 1000 seed=0x10 WORKERS=3 MIX=2:1:0 SIZES=4,8-12 TARGETS=a,,b MASTERS=16,0x11,18 GAP=2ms REPRO=out.txt");
+    CHECK_EQUAL(options.operations, 1000u);
+    CHECK_EQUAL(options.seed, 16u);
+    CHECK_EQUAL(options.workers, 3u);
+    CHECK_EQUAL(options.mix[0], 2u);
+    CHECK_EQUAL(options.mix[2], 0u);
+    CHECK_EQUAL(options.sizes.size(), 2u);
+    CHECK_EQUAL(options.sizes[1].min, 8u);
+    CHECK_EQUAL(options.sizes[1].max, 12u);
+    CHECK_EQUAL(options.targets.size(), 2u);
+    CHECK_EQUAL(options.masters.size(), 3u);
+    CHECK_EQUAL(options.masters[1], 17);
+    CHECK_EQUAL(options.gap_us, 2000.0);
+    CHECK_EQUAL(options.repro_path, std::string("out.txt"));
+    CHECK_EQUAL(parsed("STRESS 1 GAP=250us").gap_us, 250.0);
+    CHECK_EQUAL(parsed("STRESS 1 GAP=1s").gap_us, 1000000.0);
+    CHECK_EQUAL(parsed("STRESS 1 GAP=3").gap_us, 3000.0);
+
+    const char* bad[] = {"STRESS", "STRESS 0", "STRESS x", "STRESS 10 WORKERS=0", "STRESS 10 WORKERS=65", "STRESS 10 MIX=1:1",
+                         "STRESS 10 MIX=0:0:0", "STRESS 10 SIZES=0", "STRESS 10 SIZES=8-4", "STRESS 10 SIZES=65537", "STRESS 10 GAP=1h",
+                         "STRESS 10 GAP=-1ms", "STRESS 10 SEED=", "STRESS 10 COLOR=red", "STRESS 10 MASTERS=1,2",
+                         "STRESS 10 WORKERS=1 MASTERS=0x20000000"};
+    for (const char* command : bad) CHECK_THROWS(parsed(command), std::runtime_error);
+}
+
+static void test_command_line(void)
+{
+    StressGenerator::Options options = parsed("STRESS 50 SEED=7 WORKERS=2 MIX=1:2:3 SIZES=1-4,9 TARGETS=x,y MASTERS=3,4 GAP=500us");
+    std::string command = StressGenerator::command_line(options);
+    CHECK_EQUAL(command, std::string("STRESS 50 SEED=7 WORKERS=2 MIX=1:2:3 SIZES=1-4,9 TARGETS=x,y MASTERS=3,4 GAP=500us"));
+    StressGenerator::Options again = parsed(command);
+    CHECK_EQUAL(StressGenerator::command_line(again), command);
+}
+
+static void test_streams(void)
+{
+    StressGenerator::Options options = parsed("STRESS 1001 SEED=42 WORKERS=4 SIZES=2-3,100 TARGETS=a,b,c GAP=1ms");
+    size_t total = 0;
+    for (size_t w = 0; w < options.workers; w++) {
+        StressGenerator a(options, w), b(options, w);
+        total += a.remaining();
+        CHECK(same_ops(a, b));
+    }
+    CHECK_EQUAL(total, 1001u);
+
+    StressGenerator w0(options, 0), w1(options, 1);
+    CHECK(!same_ops(w0, w1));
+
+    StressGenerator generator(options, 0);
+    StressGenerator::Op op;
+    size_t kinds[3] = {0, 0, 0};
+    while (generator.remaining() > 0) {
+        generator.next(op);
+        kinds[op.kind]++;
+        CHECK(op.target != nullptr);
+        CHECK(op.gap_us >= 0);
+        size_t size = (op.kind == StressGenerator::READ) ? op.rlen : op.data.size();
+        CHECK(((size >= 2) && (size <= 3)) || (size == 100));
+        if (op.kind == StressGenerator::WRITE) CHECK_EQUAL(op.rlen, 0u);
+        if (op.kind == StressGenerator::READ) CHECK(op.data.empty());
+        if (op.kind == StressGenerator::TRANSACT) CHECK(op.rlen > 0);
+    }
+    for (size_t k = 0; k < 3; k++) CHECK(kinds[k] > 0);
+
+    StressGenerator::Options writes = parsed("STRESS 100 MIX=1:0:0");
+    StressGenerator only_writes(writes, 3);
+    while (only_writes.remaining() > 0) {
+        only_writes.next(op);
+        CHECK_EQUAL(op.kind, StressGenerator::WRITE);
+        CHECK(op.target == nullptr);
+        CHECK_EQUAL(op.gap_us, 0.0);
+    }
+}
+
+static StressGenerator::Op op_of(StressGenerator::OpKind kind, size_t index, size_t wlen, size_t rlen, const std::string* target)
+{
+    StressGenerator::Op op;
+    op.index = index;
+    op.kind = kind;
+    op.target = target;
+    op.data.assign(wlen, '\x5a');
+    op.rlen = rlen;
+    op.gap_us = 0;
+    return op;
+}
+
+static void test_tally(void)
+{
+    StressGenerator::Options options = parsed("STRESS 6 SEED=9 WORKERS=2 REPRO=stress_generator_test.txt");
+    std::string target = "0x40";
+    StressTally first, second;
+    CHECK(!first.failed());
+    first.record(0, op_of(StressGenerator::WRITE, 0, 2, 0, nullptr), BUS_SUCCESS, 10);
+    first.record(0, op_of(StressGenerator::READ, 1, 0, 3, nullptr), BUS_SUCCESS, 1000);
+    first.record(0, op_of(StressGenerator::TRANSACT, 2, 1, 1, &target), BUS_SUCCESS, 0.5);
+    second.record(1, op_of(StressGenerator::WRITE, 0, 2, 0, &target), BUS_TIMEOUT, 5000, "no reply");
+    second.record(1, op_of(StressGenerator::READ, 1, 0, 1, nullptr), BUS_BUSY, 20);
+    second.record(1, op_of(StressGenerator::READ, 2, 0, 1, nullptr), BUS_SUCCESS, 20);
+    CHECK(second.failed());
+
+    StressTally total;
+    total.merge(first);
+    total.merge(second);
+    CHECK_EQUAL(total.operations(), 6u);
+    CHECK_EQUAL(total.errors(BUS_TIMEOUT), 1u);
+    CHECK_EQUAL(total.errors(BUS_BUSY), 1u);
+    CHECK(total.failed());
+
+    // the histogram holds every operation, whatever the run's length
+    uint64_t counted = 0;
+    for (size_t b = 0; b < StressTally::BUCKETS; b++) counted += total.buckets()[b];
+    CHECK_EQUAL(counted, 6u);
+    CHECK_EQUAL(total.buckets()[0], 1u);  // 0.5 us
+    CHECK_EQUAL(total.buckets()[3], 1u);  // 10 us
+    CHECK_EQUAL(total.buckets()[4], 2u);  // 20 us
+    CHECK_EQUAL(total.buckets()[9], 1u);  // 1000 us
+    CHECK_EQUAL(total.buckets()[12], 1u); // 5000 us
+
+    std::string report = total.report(options, 2.0);
+    CHECK(report.find("6 operations on 2 workers") != std::string::npos);
+    CHECK(report.find("writes 2, reads 3, transactions 1") != std::string::npos);
+    CHECK(report.find("latency us: min 0.5, mean 1008.4, max 5000.0; p50 < 32, p90 < 8192, p99 < 8192") != std::string::npos);
+    CHECK(report.find("errors: 2 (Busy 1, Timeout 1)") != std::string::npos);
+    CHECK(report.find("first failure: worker 1, operation 0, write of 2 bytes to 0x40: Timeout after 5000 us (no reply)") != std::string::npos);
+
+    std::vector<std::string> nodes = {"17", "18"};
+    CHECK_EQUAL(total.write_repro(options, "I2C", "i2c_2", nodes), std::string());
+    std::ifstream in(options.repro_path);
+    std::stringstream repro;
+    repro << in.rdbuf();
+    in.close();
+    std::remove(options.repro_path.c_str());
+    CHECK(repro.str().find("SET SIMBUSTYPE I2C\nSET SIMBUS i2c_2\nSET TERMNODE 18\nSET SIMNODE 0x40\nSET HEX IN\nWRITE 5a5a\n") != std::string::npos);
+
+    StressTally clean;
+    clean.record(0, op_of(StressGenerator::WRITE, 0, 1, 0, nullptr), BUS_SUCCESS, 1);
+    CHECK(clean.report(options, 1.0).find("no errors") != std::string::npos);
+}
+
+int main(void)
+{
+    test_parse();
+    test_command_line();
+    test_streams();
+    test_tally();
+    return check_result();
+}